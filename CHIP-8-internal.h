@@ -0,0 +1,135 @@
+#ifndef CHIP_8_CHIP_8_INTERNAL_H
+#define CHIP_8_CHIP_8_INTERNAL_H
+
+// shared between the execution engines, not part of the public interface
+
+#include "CHIP-8.h"
+
+#define FONT_MEMORY_OFFSET 0x50
+#define FONT_SIZE 16
+#define BYTES_PER_FONT_CHARACTER 5
+#define BIG_FONT_MEMORY_OFFSET 0xA0
+#define BYTES_PER_BIG_FONT_CHARACTER 10
+
+#define CLEAR_OR_RETURN_NIBBLE      0x0
+#define JUMP_NIBBLE                 0x1
+#define CALL_SUBROUTINE_NIBBLE      0x2
+#define SKIP_IF_EQ_IMM              0x3
+#define SKIP_IF_NEQ_IMM             0x4
+#define SKIP_IF_EQ_REG              0x5
+#define SET_REGISTER_NIBBLE         0x6
+#define ADD_IMMEDIATE_NIBBLE        0x7
+
+#define ARITH_LOGIC_NIBBLE          0x8
+#define LOAD_NIBBLE                 0x0
+#define OR_NIBBLE                   0x1
+#define AND_NIBBLE                  0x2
+#define XOR_NIBBLE                  0x3
+#define ADD_NIBBLE                  0x4
+#define SUBTRACT_NIBBLE             0x5
+#define RIGHT_SHIFT_NIBBLE          0x6
+#define SUBTRACT_N_NIBBLE           0x7
+#define LEFT_SHIFT_NIBBLE           0xe
+
+
+#define SKIP_IF_NE_NIBBLE           0x9
+#define SET_INDEX_REG_NIBBLE        0xa
+#define JUMP_OFFSET_NIBBLE          0xb
+#define GENERATE_RANDOM_NIBBLE      0xc
+#define DRAW_NIBBLE                 0xd
+
+#define SKIP_IF_KEY_NIBBLE          0xe
+#define SKIP_IF_KEY_END_BYTE        0x9e
+#define SKIP_IF_NOT_KEY_END_BYTE    0xa1
+
+// SCHIP and XO-CHIP
+#define CLEAR_SCREEN_INSTRUCTION    0x00e0
+#define RETURN_INSTRUCTION          0x00ee
+#define SCROLL_DOWN_INSTRUCTION     0x00c0 // 00CN
+#define SCROLL_UP_INSTRUCTION       0x00d0 // 00DN, XO-CHIP
+#define SCROLL_RIGHT_INSTRUCTION    0x00fb
+#define SCROLL_LEFT_INSTRUCTION     0x00fc
+#define EXIT_INSTRUCTION            0x00fd
+#define LORES_INSTRUCTION           0x00fe
+#define HIRES_INSTRUCTION           0x00ff
+#define SAVE_RANGE_NIBBLE           0x2 // 5XY2, XO-CHIP
+#define LOAD_RANGE_NIBBLE           0x3 // 5XY3, XO-CHIP
+#define LONG_INDEX_INSTRUCTION      0xf000 // F000 NNNN, XO-CHIP
+#define LOAD_AUDIO_INSTRUCTION      0xf002 // XO-CHIP
+#define SELECT_PLANES_BYTE          0x01 // FN01, XO-CHIP
+#define BIG_FONT_CHARACTER_BYTE     0x30
+#define SET_PITCH_BYTE              0x3a // XO-CHIP
+#define SAVE_FLAGS_BYTE             0x75
+#define LOAD_FLAGS_BYTE             0x85
+
+#define MISCELLANEOUS_NIBBLE        0xf
+#define SET_REG_TO_DEL_TIMER_BYTE   0x07
+#define SET_DEL_TIMER_BYTE          0x15
+#define SET_SOUND_TIMER_BYTE        0x18
+#define ADD_TO_INDEX_BYTE           0x1e
+#define GET_KEY_BYTE                0x0a
+#define FONT_CHARACTER_BYTE         0x29
+#define BIN_TO_DEC_BYTE             0x33
+#define STORE_REGS_TO_MEM_BYTE      0x55
+#define LOAD_REGS_FROM_MEM_BYTE     0x65
+
+#define MASK_NIBBLES(instruction, n) (instruction & (0xffffU >> n * 4))
+#define GET_NIBBLE(instruction, n) ((instruction & (0xf000U >> n * 4)) >> (3 - n) * 4)
+
+#define ALL_ROWS_DIRTY UINT64_MAX
+#define PROGRAM_END (PROGRAM_OFFSET + MAX_BINARY_LENGTH)
+#define program_end(state) ((state)->mode == MODE_XO_CHIP ? XO_MEMORY_SIZE : PROGRAM_END)
+#define machine_blocked(state) ((state)->waiting_for_timer || (state)->waiting_for_key)
+#define PC_ADDRESS(state) ((uint16_t) ((uint8_t*) (state)->rf.pc - (state)->mem.mem))
+#define ADDRESS_TO_PC(state, address) ((uint16_t*) ((state)->mem.mem + (address)))
+
+// the quirks of every profile as constants, so specialized loops can be generated from them
+#define QUIRKS_MODERN_FLAGS QUIRK_INDEX_OVERFLOW
+#define QUIRKS_SCHIP_FLAGS QUIRK_JUMP_VX
+#define QUIRKS_XO_CHIP_FLAGS (QUIRK_SHIFT_VY | QUIRK_INDEX_INCREMENT | QUIRK_WRAP_SPRITES)
+#define QUIRKS_COSMAC_VIP_FLAGS (QUIRK_VF_RESET | QUIRK_SHIFT_VY | QUIRK_INDEX_INCREMENT)
+#define QUIRKS_CHIP_48_FLAGS (QUIRK_JUMP_VX | QUIRK_INDEX_ADD_X)
+
+// X(profile, name, flags) for every QuirksProfile
+#define FOR_EACH_QUIRKS_PROFILE(X) \
+    X(QUIRKS_MODERN, modern, QUIRKS_MODERN_FLAGS) \
+    X(QUIRKS_SCHIP, schip, QUIRKS_SCHIP_FLAGS) \
+    X(QUIRKS_XO_CHIP, xo_chip, QUIRKS_XO_CHIP_FLAGS) \
+    X(QUIRKS_COSMAC_VIP, cosmac_vip, QUIRKS_COSMAC_VIP_FLAGS) \
+    X(QUIRKS_CHIP_48, chip_48, QUIRKS_CHIP_48_FLAGS)
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+extern void present_screen(struct MachineState* state);
+extern uint8_t random_byte(struct MachineState* state);
+extern bool key_down(const struct MachineState* state, uint8_t key);
+// consumes the lowest key that went down at the last input poll
+extern bool take_key_press(struct MachineState* state, uint8_t* key);
+extern void read_sprite_data(struct MachineState* state, uint8_t x, uint8_t y, uint8_t rows);
+// DXYN with QUIRK_WRAP_SPRITES, the sprite wraps around the edges instead of being clipped
+extern void wrap_sprite_data(struct MachineState* state, uint8_t x, uint8_t y, uint8_t rows);
+
+// framebuffer routines of the extended modes, see screen.c
+extern void clear_screen(struct MachineState* state);
+extern void set_resolution(struct MachineState* state, bool hires);
+extern void draw_extended_sprite(struct MachineState* state, uint8_t x, uint8_t y, uint8_t n, bool wrap);
+extern void scroll_screen_down(struct MachineState* state, uint8_t rows);
+extern void scroll_screen_up(struct MachineState* state, uint8_t rows);
+extern void scroll_screen_right(struct MachineState* state);
+extern void scroll_screen_left(struct MachineState* state);
+// both halt the machine with stack_fault set instead of overflowing or underflowing, push then returns false
+// and pop NULL, which it also does for a return address outside the program area
+extern bool stack_push_pc(struct MachineState* state);
+extern uint16_t* stack_pop_pc(struct MachineState* state);
+extern void write_memory(struct MachineState* state, uint16_t address, uint8_t value);
+// write_memory without notifying the JIT, for its store helpers, returns the masked address
+extern uint16_t store_memory(struct MachineState* state, uint16_t address, uint8_t value);
+// the reference interpreter with the machine's quirks looked up on every instruction, the dispatch loops use
+// copies specialized for their profile instead
+extern void execute_instruction_cycle(struct MachineState* state);
+
+#endif //CHIP_8_CHIP_8_INTERNAL_H
@@ -1,13 +1,21 @@
 #include "CHIP-8.h"
+#include "CHIP-8-internal.h"
+#include "predecode.h"
+#include "jit.h"
+#include "timer.h"
+#include "trace.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "analysis.h"
 #include <malloc.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+#include <time.h>
 
 
-#define FONT_MEMORY_OFFSET 0x50
-#define FONT_SIZE 16
-#define BYTES_PER_FONT_CHARACTER 5
-
 static uint8_t font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -27,233 +35,415 @@ static uint8_t font[] = {
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// 8x10 digits for FX30, SCHIP only has 0 to 9
+static uint8_t big_font[] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+#define DEFAULT_AUDIO_PITCH 64 // 4000 Hz
+
+
+// the decode cache is as large as the rest of the machine and is only used together with it
+struct MachineArena {
+    struct MachineState state;
+    struct DecodeCache decode_cache;
+};
+
+struct MachinePool {
+    struct MachineArena* arenas;
+    size_t count;
+};
+
+static void init_machine(struct MachineArena* arena, struct Frontend* frontend, bool pooled) {
+    struct MachineState* state = &arena->state;
+    memset(&arena->decode_cache, 0, sizeof(arena->decode_cache));
+    state->decode_cache = &arena->decode_cache;
+    state->jit = NULL;
+    state->frontend = frontend;
+    state->engine = ENGINE_PREDECODED;
+    state->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    state->trace = NULL;
+    state->profiler = NULL;
+    state->rewind = NULL;
+    state->recorder = NULL;
+    state->analysis = NULL;
+    state->turbo = false;
+    state->turbo_frame_skip = DEFAULT_TURBO_FRAME_SKIP;
+    state->pooled = pooled;
+    state->mode = MODE_CHIP_8;
+    state->quirks_profile = QUIRKS_MODERN;
+    state->quirks = QUIRKS_MODERN_FLAGS;
+    reset_machine(state);
+}
+
+static struct MachineArena* allocate_arenas(size_t count) {
+    struct MachineArena* arenas = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(struct MachineArena));
+    if (!arenas) {
+        exit(EXIT_FAILURE);
+    }
+    return arenas;
+}
+
+struct MachineState* create_machine(struct Frontend* frontend) {
+    struct MachineArena* arena = allocate_arenas(1);
+    init_machine(arena, frontend, false);
+    return &arena->state;
+}
+
+void reset_machine(struct MachineState* state) {
+    bool xo_chip = state->mode == MODE_XO_CHIP;
+    memset(&state->rf, 0, sizeof(state->rf));
+    // the classic modes never address anything past their 4 KB
+    memset(state->mem.mem, 0, xo_chip ? sizeof(state->mem.mem) : MEMORY_SIZE);
+    state->address_mask = xo_chip ? XO_MEMORY_SIZE - 1 : MEMORY_SIZE - 1;
+    state->mem.stack_base_pointer = (uint16_t**) (state->mem.mem + (xo_chip ? XO_MEMORY_SIZE : STACK_OFFSET));
+    state->mem.stack_pointer = state->mem.stack_base_pointer;
+    memset(&state->screen, 0, sizeof(state->screen));
+    state->screen.width = SCREEN_WIDTH;
+    state->screen.height = SCREEN_HEIGHT;
+    state->planes = 1;
+    memset(state->rpl_flags, 0, sizeof(state->rpl_flags));
+    memset(state->audio_pattern, 0, sizeof(state->audio_pattern));
+    state->audio_pitch = DEFAULT_AUDIO_PITCH;
+    state->rf.pc = ADDRESS_TO_PC(state, PROGRAM_OFFSET);
+    state->pc_confined = false;
+    state->stack_fault = false;
 
-struct MachineState* create_machine() {
-    struct RegisterFile* registerFile = malloc(sizeof(struct RegisterFile));
-    struct Memory* memory = malloc(sizeof(struct Memory));
-    struct Screen* screen = malloc(sizeof(struct Screen));
-    struct MachineState* state = malloc(sizeof(struct MachineState));
-    if (!registerFile || !memory || !screen || !state) {
+    state->side_effects = 0;
+    state->cycles = 0;
+    state->elapsed_ticks = 0;
+    seed_random(state, DEFAULT_RANDOM_SEED);
+    state->keypad = 0;
+    state->key_presses = 0;
+    state->waiting_for_key = false;
+    state->timer_ticks = 0;
+    reset_idle_detection(state);
+    invalidate_decode_cache(state->decode_cache, 0, MEMORY_SIZE);
+    reset_jit_cache(state->jit);
+    if (state->rewind) reset_rewind(state->rewind);
+}
+
+struct MachinePool* create_machine_pool(size_t machines, struct Frontend* frontend) {
+    struct MachinePool* pool = malloc(sizeof(struct MachinePool));
+    if (!pool) {
         exit(EXIT_FAILURE);
     }
+    pool->arenas = allocate_arenas(machines);
+    pool->count = machines;
+    for (size_t i = 0; i < machines; ++i) {
+        init_machine(&pool->arenas[i], frontend, true);
+    }
+    return pool;
+}
+
+struct MachineState* pool_machine(struct MachinePool* pool, size_t index) {
+    return index < pool->count ? &pool->arenas[index].state : NULL;
+}
 
-    // initialize memory
-    memory->stack_base_pointer = (uint16_t**) (memory->mem + STACK_OFFSET);
-    memory->stack_pointer = memory->stack_base_pointer;
-
-    // initialize screen
-    SDL_Event event;
-    SDL_Renderer *renderer;
-    SDL_Window *window;
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_CreateWindowAndRenderer(SCREEN_WIDTH, SCREEN_HEIGHT, 0, &window, &renderer);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-    SDL_RenderClear(renderer);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-
-    screen->renderer = renderer;
-    screen->event = event;
-    screen->window = window;
-
-    state->rf = registerFile;
-    state->mem = memory;
-    state->screen = screen;
-    return state;
-}
-
-#define CLEAR_OR_RETURN_NIBBLE      0x0
-#define CLEAR_SCREEN_NIBBLE         0x0
-#define RETURN_NIBBLE               0xe
-#define JUMP_NIBBLE                 0x1
-#define CALL_SUBROUTINE_NIBBLE      0x2
-#define SKIP_IF_EQ_IMM              0x3
-#define SKIP_IF_NEQ_IMM             0x4
-#define SKIP_IF_EQ_REG              0x5
-#define SET_REGISTER_NIBBLE         0x6
-#define ADD_IMMEDIATE_NIBBLE        0x7
-
-#define ARITH_LOGIC_NIBBLE          0x8
-#define LOAD_NIBBLE                 0x0
-#define OR_NIBBLE                   0x1
-#define AND_NIBBLE                  0x2
-#define XOR_NIBBLE                  0x3
-#define ADD_NIBBLE                  0x4
-#define SUBTRACT_NIBBLE             0x5
-#define RIGHT_SHIFT_NIBBLE          0x6
-#define SUBTRACT_N_NIBBLE           0x7
-#define LEFT_SHIFT_NIBBLE           0xe
-
-
-#define SKIP_IF_NE_NIBBLE           0x9
-#define SET_INDEX_REG_NIBBLE        0xa
-#define JUMP_OFFSET_NIBBLE          0xb
-#define GENERATE_RANDOM_NIBBLE      0xc
-#define DRAW_NIBBLE                 0xd
-
-#define SKIP_IF_KEY_NIBBLE          0xe
-#define SKIP_IF_KEY_END_BYTE        0x9e
-#define SKIP_IF_NOT_KEY_END_BYTE    0xa1
-
-#define MISCELLANEOUS_NIBBLE        0xf
-#define SET_REG_TO_DEL_TIMER_BYTE   0x07
-#define SET_DEL_TIMER_BYTE          0x15
-#define SET_SOUND_TIMER_BYTE        0x18
-#define ADD_TO_INDEX_BYTE           0x1e
-#define GET_KEY_BYTE                0x0a
-#define FONT_CHARACTER_BYTE         0x29
-#define BIN_TO_DEC_BYTE             0x33
-#define STORE_REGS_TO_MEM_BYTE      0x55
-#define LOAD_REGS_FROM_MEM_BYTE     0x65
-
-#define MASK_NIBBLES(instruction, n) (instruction & (0xffffU >> n * 4))
-#define GET_NIBBLE(instruction, n) ((instruction & (0xf000U >> n * 4)) >> (3 - n) * 4)
-
-void prepare_memory(struct MachineState* state, uint8_t* binary, size_t binary_size) {
-    if (binary_size > MAX_BINARY_LENGTH) {
+void delete_machine_pool(struct MachinePool** pool) {
+    if (!(*pool)) return;
+
+    for (size_t i = 0; i < (*pool)->count; ++i) {
+        delete_jit_cache(&(*pool)->arenas[i].state.jit);
+    }
+    free((*pool)->arenas);
+    free(*pool);
+    *pool = NULL;
+}
+
+// hands the framebuffer to the frontend if anything was drawn since the last call
+void present_screen(struct MachineState* state) {
+    if (!state->screen.dirty_rows) return;
+    if (state->frontend && state->frontend->present) {
+        state->frontend->present(state->frontend, &state->screen);
+    }
+    state->screen.dirty_rows = 0;
+}
+
+bool key_down(const struct MachineState* state, uint8_t key) {
+    return (state->keypad >> (key & 0xf)) & 1U;
+}
+
+bool take_key_press(struct MachineState* state, uint8_t* key) {
+    if (!state->key_presses) return false;
+    *key = (uint8_t) __builtin_ctz(state->key_presses);
+    state->key_presses &= state->key_presses - 1;
+    return true;
+}
+
+// xorshift32, the generator lives in the machine so runs are reproducible and threads never share a sequence
+uint8_t random_byte(struct MachineState* state) {
+    uint32_t x = state->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->random_state = x;
+    state->side_effects++;
+    return (uint8_t) (x >> 24);
+}
+
+void seed_random(struct MachineState* state, uint32_t seed) {
+    // xorshift never leaves zero
+    state->random_state = seed ? seed : DEFAULT_RANDOM_SEED;
+}
+
+void set_keypad(struct MachineState* state, uint16_t keypad) {
+    state->key_presses = keypad & ~state->keypad;
+    state->keypad = keypad;
+}
+
+// hash is the binary's hash_rom if the caller knows it, NULL otherwise
+void prepare_memory(struct MachineState* state, const uint8_t* binary, size_t binary_size, const uint64_t* hash) {
+    if (binary_size > max_program_length(state->mode)) {
         fprintf(stderr, "Binary is too long: %zu bytes", binary_size);
         exit(EXIT_FAILURE);
     }
-    memmove(state->mem->mem + PROGRAM_OFFSET, binary, binary_size);
+    memmove(state->mem.mem + PROGRAM_OFFSET, binary, binary_size);
 
     //move font data into memory
-    memmove(state->mem->mem + FONT_MEMORY_OFFSET, font, FONT_SIZE * BYTES_PER_FONT_CHARACTER);
-    state->rf->pc = (uint16_t*) &(state->mem->mem[PROGRAM_OFFSET]);
+    memmove(state->mem.mem + FONT_MEMORY_OFFSET, font, FONT_SIZE * BYTES_PER_FONT_CHARACTER);
+    if (state->mode != MODE_CHIP_8) {
+        memmove(state->mem.mem + BIG_FONT_MEMORY_OFFSET, big_font, FONT_SIZE * BYTES_PER_BIG_FONT_CHARACTER);
+    }
+    state->rf.pc = (uint16_t*) &(state->mem.mem[PROGRAM_OFFSET]);
+    // return addresses left on the stack were never analyzed
+    state->pc_confined = state->mem.stack_pointer == state->mem.stack_base_pointer &&
+                         (hash ? analysis_covers_hashed(state->analysis, state->mode, binary_size, *hash)
+                               : analysis_covers(state->analysis, state->mode, binary, binary_size)) &&
+                         state->analysis->summary.pc_confined;
+    invalidate_decode_cache(state->decode_cache, 0, MEMORY_SIZE);
+    reset_jit_cache(state->jit);
+    if (state->rewind) reset_rewind(state->rewind);
+    state->cycles = 0;
+    state->elapsed_ticks = 0;
 }
 
-bool check_program_quit(struct MachineState* state) {
-    while (SDL_PollEvent(&(state->screen->event))) {
-        switch (state->screen->event.type) {
-            case SDL_KEYDOWN: {
-                if (state->screen->event.key.keysym.sym == SDLK_ESCAPE) {
-                    return true;
-                }
-                break;
-            }
-            case SDL_QUIT:
-            {
-                return true;
-            }
-        }
+// the only place the frontend is asked for input, once per frame, returns the INPUT_* commands
+uint32_t poll_input(struct MachineState* state) {
+    if (!state->frontend || !state->frontend->poll_input) return 0;
+    uint16_t keypad = state->keypad;
+    uint32_t commands = state->frontend->poll_input(state->frontend, &keypad);
+    set_keypad(state, keypad);
+    return commands;
+}
+
+// every sprite byte is shifted into place and XORed into its row word, anything past the right edge falls off
+void read_sprite_data(struct MachineState* state, uint8_t x, uint8_t y, uint8_t rows) {
+    uint8_t x_start = state->rf.d_reg[x] % SCREEN_WIDTH;
+    uint8_t y_start = state->rf.d_reg[y] % SCREEN_HEIGHT;
+    uint64_t* screen_rows = state->screen.rows[0] + y_start;
+    uint64_t collision = 0;
+    if (rows > SCREEN_HEIGHT - y_start) rows = SCREEN_HEIGHT - y_start;
+    for (int row = 0; row < rows; ++row) {
+        uint64_t sprite = (uint64_t) state->mem.mem[(state->rf.I + row) & (MEMORY_SIZE - 1)] << (SCREEN_WIDTH - 8) >> x_start;
+        collision |= screen_rows[row] & sprite;
+        screen_rows[row] ^= sprite;
     }
-    return false;
+    state->rf.d_reg[0xf] = collision != 0;
+    state->side_effects++;
+    state->screen.dirty_rows |= ((1ULL << rows) - 1) << y_start;
 }
 
-void read_sprite_data(struct MachineState* state, uint16_t instruction) {
-    SDL_RenderClear(state->screen->renderer);
-    SDL_RenderPresent(state->screen->renderer);
-    state->rf->d_reg[0xf] = 1;
-    uint8_t x_start = state->rf->d_reg[GET_NIBBLE(instruction, 1)] % SCREEN_WIDTH;
-    uint8_t y_start = state->rf->d_reg[GET_NIBBLE(instruction, 2)] % SCREEN_HEIGHT;
-    uint8_t rows = GET_NIBBLE(instruction, 3);
+// the same with the rows and bits pushed past an edge coming back in on the other side
+void wrap_sprite_data(struct MachineState* state, uint8_t x, uint8_t y, uint8_t rows) {
+    uint8_t x_start = state->rf.d_reg[x] % SCREEN_WIDTH;
+    uint8_t y_start = state->rf.d_reg[y] % SCREEN_HEIGHT;
+    uint64_t* screen_rows = state->screen.rows[0];
+    uint64_t collision = 0;
     for (int row = 0; row < rows; ++row) {
-        if (row + y_start >= SCREEN_HEIGHT) break;
-        uint8_t pixels = state->mem->mem[state->rf->I + row];
-        for (int column = 0; column < 8; ++column) {
-            if (column + x_start >= SCREEN_WIDTH) break;
-            bool pixel = (pixels & (0xff >> column)) >> (7 - column);
-            if (pixel) {
-                state->screen->pixels[row + y_start][column + x_start] = !state->screen->pixels[row + y_start][column + x_start];
-            }
-        }
+        uint8_t screen_row = (y_start + row) % SCREEN_HEIGHT;
+        uint64_t placed = (uint64_t) state->mem.mem[(state->rf.I + row) & (MEMORY_SIZE - 1)] << (SCREEN_WIDTH - 8);
+        uint64_t sprite = placed >> x_start;
+        if (x_start) sprite |= placed << (SCREEN_WIDTH - x_start);
+        collision |= screen_rows[screen_row] & sprite;
+        screen_rows[screen_row] ^= sprite;
+        state->screen.dirty_rows |= 1ULL << screen_row;
     }
+    state->rf.d_reg[0xf] = collision != 0;
+    state->side_effects++;
 }
 
-#define KEY_PRESSED_INVALID 16
+// every store into Memory::mem goes through here so cached decodings of the bytes stay valid
+static inline uint16_t store_byte(struct MachineState* state, uint16_t address, uint8_t value, bool notify_jit) {
+    address &= state->address_mask;
+    state->side_effects++;
+    // changed code or return addresses can send pc anywhere
+    if (state->pc_confined && ((state->analysis->flags[address] & (ANALYSIS_CODE | ANALYSIS_OPERAND)) ||
+                               (state->mode != MODE_XO_CHIP && address >= STACK_OFFSET))) {
+        state->pc_confined = false;
+    }
+    if (address >= MEMORY_SIZE) {
+        // XO-CHIP only, nothing up there is ever decoded, translated or rewound
+        state->mem.mem[address] = value;
+        return address;
+    }
+    if (state->rewind) rewind_note_write(state->rewind, state, address);
+    state->mem.mem[address] = value;
+    invalidate_decode_cache(state->decode_cache, address, 1);
+    if (notify_jit) jit_note_write(state->jit, address);
+    return address;
+}
 
-uint16_t scancode_to_int(SDL_Scancode scancode) {
-    switch (scancode) {
-        case SDL_SCANCODE_0: {
-            return 0;
-        }
-        case SDL_SCANCODE_1: {
-            return 1;
-        }
-        case SDL_SCANCODE_2: {
-            return 2;
-        }
-        case SDL_SCANCODE_3: {
-            return 3;
-        }
-        case SDL_SCANCODE_4: {
-            return 4;
-        }
-        case SDL_SCANCODE_5: {
-            return 5;
-        }
-        case SDL_SCANCODE_6: {
-            return 6;
-        }
-        case SDL_SCANCODE_7: {
-            return 7;
-        }
-        case SDL_SCANCODE_8: {
-            return 8;
-        }
-        case SDL_SCANCODE_9: {
-            return 9;
-        }
-        case SDL_SCANCODE_A: {
-            return 0xa;
-        }
-        case SDL_SCANCODE_B: {
-            return 0xb;
-        }
-        case SDL_SCANCODE_C: {
-            return 0xc;
-        }
-        case SDL_SCANCODE_D: {
-            return 0xd;
-        }
-        case SDL_SCANCODE_E: {
-            return 0xe;
-        }
-        case SDL_SCANCODE_F: {
-            return 0xf;
-        }
-        default: {
-            return KEY_PRESSED_INVALID;
-        }
+void write_memory(struct MachineState* state, uint16_t address, uint8_t value) {
+    store_byte(state, address, value, true);
+}
+
+uint16_t store_memory(struct MachineState* state, uint16_t address, uint8_t value) {
+    return store_byte(state, address, value, false);
+}
+
+// the machine halts on the faulting instruction, pc stays on it so the fault can be reported
+static void halt_on_stack_fault(struct MachineState* state) {
+    state->stack_fault = true;
+    state->pc_confined = false;
+}
+
+bool stack_push_pc(struct MachineState* state) {
+    if (state->mem.stack_pointer + sizeof(state->rf.pc) > state->mem.stack_base_pointer + STACK_SIZE) {
+        halt_on_stack_fault(state);
+        return false;
     }
+    *(state->mem.stack_pointer) = state->rf.pc + 1;
+    state->mem.stack_pointer++;
+    return true;
+}
+
+uint16_t* stack_pop_pc(struct MachineState* state) {
+    if (state->mem.stack_pointer == state->mem.stack_base_pointer) {
+        halt_on_stack_fault(state);
+        return NULL;
+    }
+    // the slots lie in memory the program can store into, whatever it left there must not become pc
+    uint16_t* result = *(state->mem.stack_pointer - 1);
+    if (result < ADDRESS_TO_PC(state, PROGRAM_OFFSET) || result >= ADDRESS_TO_PC(state, program_end(state))) {
+        halt_on_stack_fault(state);
+        return NULL;
+    }
+    state->mem.stack_pointer--;
+    // only the live slots hold host pointers, snapshots zero them and keep the rest of the area
+    *(state->mem.stack_pointer) = NULL;
+    return result;
 }
 
-void render_image(struct MachineState* state) {
-    for (int i = 0; i < SCREEN_HEIGHT / PIXEL_SIZE; ++i) {
-        for (int j = 0; j < SCREEN_WIDTH / PIXEL_SIZE; ++j) {
-            if (!state->screen->pixels[i][j]) continue;
-            SDL_Rect rect;
-            rect.x = j * PIXEL_SIZE;
-            rect.y = i * PIXEL_SIZE;
-            rect.w = PIXEL_SIZE;
-            rect.h = PIXEL_SIZE;
-            SDL_SetRenderDrawColor(state->screen->renderer, 0, 255, 0, 255);
-            SDL_RenderFillRect(state->screen->renderer, &rect);
+// where FX55 and FX65 leave I
+static ALWAYS_INLINE void advance_index(struct MachineState* state, uint8_t x, const uint32_t quirks) {
+    if (quirks & QUIRK_INDEX_INCREMENT) {
+        state->rf.I += x + 1;
+    } else if (quirks & QUIRK_INDEX_ADD_X) {
+        state->rf.I += x;
+    }
+}
+
+// the skipped instruction may be the four byte F000 NNNN on XO-CHIP
+static void skip_instruction(struct MachineState* state) {
+    if (state->mode == MODE_XO_CHIP && be16toh(state->rf.pc[1]) == LONG_INDEX_INSTRUCTION) state->rf.pc++;
+    state->rf.pc++;
+}
+
+// 00CN, 00DN and 00FB to 00FF, returns false for anything else
+static bool execute_extended_system(struct MachineState* state, uint16_t instruction, bool* increment_pc) {
+    if ((instruction & 0xfff0) == SCROLL_DOWN_INSTRUCTION) {
+        scroll_screen_down(state, instruction & 0xf);
+        return true;
+    }
+    if (state->mode == MODE_XO_CHIP && (instruction & 0xfff0) == SCROLL_UP_INSTRUCTION) {
+        scroll_screen_up(state, instruction & 0xf);
+        return true;
+    }
+    switch (instruction) {
+        case SCROLL_RIGHT_INSTRUCTION: scroll_screen_right(state); return true;
+        case SCROLL_LEFT_INSTRUCTION: scroll_screen_left(state); return true;
+        case LORES_INSTRUCTION: set_resolution(state, false); return true;
+        case HIRES_INSTRUCTION: set_resolution(state, true); return true;
+        case EXIT_INSTRUCTION: {
+            // leaving the program area halts the machine
+            state->rf.pc = ADDRESS_TO_PC(state, 0);
+            *increment_pc = false;
+            return true;
         }
+        default: return false;
     }
-    SDL_SetRenderDrawColor(state->screen->renderer, 0, 0, 0, 255);
-    SDL_RenderPresent(state->screen->renderer);
 }
 
-void stack_push_pc(struct MachineState* state) {
-    if (state->mem->stack_pointer + sizeof(state->rf->pc) > state->mem->stack_base_pointer + STACK_SIZE) {
-        fprintf(stderr, "Stack overflow!");
-        exit(EXIT_FAILURE);
+// 5XY2 and 5XY3 walk the registers in either direction and leave I alone
+static void transfer_register_range(struct MachineState* state, uint8_t x, uint8_t y, bool save) {
+    int step = x <= y ? 1 : -1;
+    int count = (x <= y ? y - x : x - y) + 1;
+    for (int i = 0; i < count; ++i) {
+        uint8_t reg = (uint8_t) (x + i * step);
+        if (save) {
+            write_memory(state, state->rf.I + i, state->rf.d_reg[reg]);
+        } else {
+            state->rf.d_reg[reg] = state->mem.mem[(state->rf.I + i) & state->address_mask];
+        }
     }
-    *(state->mem->stack_pointer) = state->rf->pc + 1;
-    state->mem->stack_pointer++;
 }
 
-uint16_t* stack_pop_pc(struct MachineState* state) {
-    if (state->mem->stack_pointer == state->mem->stack_base_pointer) {
-        fprintf(stderr, "Cannot pop from empty stack!");
-        exit(EXIT_FAILURE);
+// FX30, FX75 and FX85, on XO-CHIP also F000 NNNN, FN01, F002 and FX3A, returns false for anything else
+static bool execute_extended_misc(struct MachineState* state, uint16_t instruction) {
+    uint8_t x = GET_NIBBLE(instruction, 1);
+    switch (MASK_NIBBLES(instruction, 2)) {
+        case BIG_FONT_CHARACTER_BYTE: {
+            state->rf.I = BIG_FONT_MEMORY_OFFSET + (state->rf.d_reg[x] & 0xf) * BYTES_PER_BIG_FONT_CHARACTER;
+            return true;
+        }
+        case SAVE_FLAGS_BYTE: {
+            memcpy(state->rpl_flags, state->rf.d_reg, x + 1);
+            state->side_effects++;
+            return true;
+        }
+        case LOAD_FLAGS_BYTE: {
+            memcpy(state->rf.d_reg, state->rpl_flags, x + 1);
+            return true;
+        }
+        default: break;
+    }
+    if (state->mode != MODE_XO_CHIP) return false;
+
+    if (instruction == LONG_INDEX_INSTRUCTION) {
+        state->rf.I = be16toh(state->rf.pc[1]);
+        state->rf.pc++;
+        return true;
+    }
+    if (instruction == LOAD_AUDIO_INSTRUCTION) {
+        for (size_t i = 0; i < sizeof(state->audio_pattern); ++i) {
+            state->audio_pattern[i] = state->mem.mem[(state->rf.I + i) & state->address_mask];
+        }
+        state->side_effects++;
+        return true;
+    }
+    switch (MASK_NIBBLES(instruction, 2)) {
+        case SELECT_PLANES_BYTE: {
+            state->planes = x & 0x3;
+            return true;
+        }
+        case SET_PITCH_BYTE: {
+            state->audio_pitch = state->rf.d_reg[x];
+            state->side_effects++;
+            return true;
+        }
+        default: return false;
     }
-    state->mem->stack_pointer--;
-    uint16_t* result = *(state->mem->stack_pointer);
-    return result;
 }
 
-void execute_instruction_cycle(struct MachineState* state) {
-    uint16_t instruction = *((uint16_t*) (state->rf->pc));
+// quirks is a constant wherever this is inlined into a specialized loop, so the quirk tests fold away
+static ALWAYS_INLINE void execute_instruction(struct MachineState* state, const uint32_t quirks) {
+    uint16_t instruction = *((uint16_t*) (state->rf.pc));
     // instructions are stored in big endian format
     instruction = be16toh(instruction);
 
@@ -261,73 +451,76 @@ void execute_instruction_cycle(struct MachineState* state) {
     bool increment_pc = true;
     switch (first_nibble) {
         case CLEAR_OR_RETURN_NIBBLE: {
-            if (GET_NIBBLE(instruction, 3) == CLEAR_SCREEN_NIBBLE) {
-                for (int i = 0; i < SCREEN_HEIGHT / PIXEL_SIZE; ++i) {
-                    for (int j = 0; j < SCREEN_WIDTH / PIXEL_SIZE; ++j) {
-                        state->screen->pixels[i][j] = 0;
-                    }
-                }
-                SDL_RenderClear(state->screen->renderer);
-                SDL_RenderPresent(state->screen->renderer);
-                printf("Cleared screen!\n");
+            if (state->mode != MODE_CHIP_8 && execute_extended_system(state, instruction, &increment_pc)) {
                 break;
-            } else if (GET_NIBBLE(instruction, 3) == RETURN_NIBBLE){
+            }
+            if (instruction == CLEAR_SCREEN_INSTRUCTION) {
+                clear_screen(state);
+                TRACE_DEBUG("Cleared screen!\n");
+            } else if (instruction == RETURN_INSTRUCTION) {
                 increment_pc = false;
                 uint16_t* return_address = stack_pop_pc(state);
-                state->rf->pc = return_address;
-                break;
+                if (return_address) state->rf.pc = return_address;
+            } else {
+                // 0NNN would call machine code of the original host, there is none to run
+                TRACE_ERROR("Instruction 0x%x ignored!\n", instruction);
             }
+            break;
         }
         case JUMP_NIBBLE: {
             increment_pc = false;
             uint16_t jump_address = MASK_NIBBLES(instruction, 1);
-            //printf("Jumped to %x!\n", jump_address);
-            state->rf->pc = (uint16_t*) (state->mem->mem + jump_address);
+            TRACE_DEBUG("Jumped to %x!\n", jump_address);
+            state->rf.pc = (uint16_t*) (state->mem.mem + jump_address);
             break;
         }
         case CALL_SUBROUTINE_NIBBLE: {
             increment_pc = false;
             uint16_t jump_address = MASK_NIBBLES(instruction, 1);
-            stack_push_pc(state);
-            state->rf->pc = (uint16_t*) (state->mem->mem + jump_address);
+            if (stack_push_pc(state)) state->rf.pc = (uint16_t*) (state->mem.mem + jump_address);
             break;
         }
         case SKIP_IF_EQ_IMM: {
             uint8_t reg = GET_NIBBLE(instruction, 1);
             uint8_t value = MASK_NIBBLES(instruction, 2);
-            if (state->rf->d_reg[reg] == value) {
-                state->rf->pc++;
+            if (state->rf.d_reg[reg] == value) {
+                skip_instruction(state);
             }
             break;
         }
         case SKIP_IF_NEQ_IMM: {
             uint8_t reg = GET_NIBBLE(instruction, 1);
             uint8_t value = MASK_NIBBLES(instruction, 2);
-            if (state->rf->d_reg[reg] != value) {
-                state->rf->pc++;
+            if (state->rf.d_reg[reg] != value) {
+                skip_instruction(state);
             }
             break;
         }
         case SKIP_IF_EQ_REG: {
             uint8_t x = GET_NIBBLE(instruction, 1);
             uint8_t y = GET_NIBBLE(instruction, 2);
-            if (state->rf->d_reg[x] != state->rf->d_reg[y]) {
-                state->rf->pc++;
+            if (state->mode == MODE_XO_CHIP && (GET_NIBBLE(instruction, 3) == SAVE_RANGE_NIBBLE ||
+                                                GET_NIBBLE(instruction, 3) == LOAD_RANGE_NIBBLE)) {
+                transfer_register_range(state, x, y, GET_NIBBLE(instruction, 3) == SAVE_RANGE_NIBBLE);
+                break;
+            }
+            if (state->rf.d_reg[x] == state->rf.d_reg[y]) {
+                skip_instruction(state);
             }
             break;
         }
         case SET_REGISTER_NIBBLE: {
             uint8_t reg = GET_NIBBLE(instruction, 1);
             uint8_t value = MASK_NIBBLES(instruction, 2);
-            state->rf->d_reg[reg] = value;
-            printf("Set register %x to %u!\n", reg, value);
+            state->rf.d_reg[reg] = value;
+            TRACE_DEBUG("Set register %x to %u!\n", reg, value);
             break;
         }
         case ADD_IMMEDIATE_NIBBLE: {
             uint8_t reg = GET_NIBBLE(instruction, 1);
             uint8_t value = MASK_NIBBLES(instruction, 2);
-            state->rf->d_reg[reg] += value;
-            printf("Add %d to register %x: currently: %d!\n", value, reg, state->rf->d_reg[reg]);
+            state->rf.d_reg[reg] += value;
+            TRACE_DEBUG("Add %d to register %x: currently: %d!\n", value, reg, state->rf.d_reg[reg]);
             break;
         }
         case ARITH_LOGIC_NIBBLE: {
@@ -336,211 +529,497 @@ void execute_instruction_cycle(struct MachineState* state) {
             uint8_t y = GET_NIBBLE(instruction, 2);
             switch (operation) {
                 case LOAD_NIBBLE: {
-                    state->rf->d_reg[x] = state->rf->d_reg[y];
+                    state->rf.d_reg[x] = state->rf.d_reg[y];
                     break;
                 }
                 case OR_NIBBLE: {
-                    state->rf->d_reg[x] = state->rf->d_reg[x] | state->rf->d_reg[y];
+                    state->rf.d_reg[x] = state->rf.d_reg[x] | state->rf.d_reg[y];
+                    if (quirks & QUIRK_VF_RESET) state->rf.d_reg[0xf] = 0;
                     break;
                 }
                 case AND_NIBBLE: {
-                    state->rf->d_reg[x] = state->rf->d_reg[x] & state->rf->d_reg[y];
+                    state->rf.d_reg[x] = state->rf.d_reg[x] & state->rf.d_reg[y];
+                    if (quirks & QUIRK_VF_RESET) state->rf.d_reg[0xf] = 0;
                     break;
                 }
                 case XOR_NIBBLE: {
-                    state->rf->d_reg[x] = state->rf->d_reg[x] ^ state->rf->d_reg[y];
+                    state->rf.d_reg[x] = state->rf.d_reg[x] ^ state->rf.d_reg[y];
+                    if (quirks & QUIRK_VF_RESET) state->rf.d_reg[0xf] = 0;
                     break;
                 }
                 case ADD_NIBBLE: {
-                    uint16_t res = state->rf->d_reg[x] + state->rf->d_reg[y];
+                    uint16_t res = state->rf.d_reg[x] + state->rf.d_reg[y];
                     if (res > 0xff) {
-                        state->rf->d_reg[0xf] = 1;
+                        state->rf.d_reg[0xf] = 1;
                     } else {
-                        state->rf->d_reg[0xf] = 0;
+                        state->rf.d_reg[0xf] = 0;
                     }
-                    state->rf->d_reg[x] = (uint8_t) res;
+                    state->rf.d_reg[x] = (uint8_t) res;
                     break;
                 }
                 case SUBTRACT_NIBBLE: {
-                    if (state->rf->d_reg[x] > state->rf->d_reg[y]) {
-                        state->rf->d_reg[0xf] = 1;
+                    if (state->rf.d_reg[x] > state->rf.d_reg[y]) {
+                        state->rf.d_reg[0xf] = 1;
                     } else {
-                        state->rf->d_reg[0xf] = 0;
+                        state->rf.d_reg[0xf] = 0;
                     }
-                    state->rf->d_reg[x] = state->rf->d_reg[x] - state->rf->d_reg[y];
+                    state->rf.d_reg[x] = state->rf.d_reg[x] - state->rf.d_reg[y];
                     break;
                 }
                 case RIGHT_SHIFT_NIBBLE: {
-                    if (state->rf->d_reg[x] & 0x1) {
-                        state->rf->d_reg[0xf] = 1;
+                    // the flag is written first, so the source is read again if it is VF
+                    uint8_t source = quirks & QUIRK_SHIFT_VY ? y : x;
+                    if (state->rf.d_reg[source] & 0x1) {
+                        state->rf.d_reg[0xf] = 1;
                     } else {
-                        state->rf->d_reg[0xf] = 0;
+                        state->rf.d_reg[0xf] = 0;
                     }
-                    state->rf->d_reg[x] >>= 1;
+                    state->rf.d_reg[x] = state->rf.d_reg[source] >> 1;
                     break;
                 }
                 case SUBTRACT_N_NIBBLE: {
-                    if (state->rf->d_reg[y] > state->rf->d_reg[x]) {
-                        state->rf->d_reg[0xf] = 1;
+                    if (state->rf.d_reg[y] > state->rf.d_reg[x]) {
+                        state->rf.d_reg[0xf] = 1;
                     } else {
-                        state->rf->d_reg[0xf] = 0;
+                        state->rf.d_reg[0xf] = 0;
                     }
-                    state->rf->d_reg[x] = state->rf->d_reg[y] - state->rf->d_reg[x];
+                    state->rf.d_reg[x] = state->rf.d_reg[y] - state->rf.d_reg[x];
                     break;
                 }
                 case LEFT_SHIFT_NIBBLE: {
-                    if ((state->rf->d_reg[x] >> 7) & 0x1) {
-                        state->rf->d_reg[0xf] = 1;
+                    uint8_t source = quirks & QUIRK_SHIFT_VY ? y : x;
+                    if ((state->rf.d_reg[source] >> 7) & 0x1) {
+                        state->rf.d_reg[0xf] = 1;
                     } else {
-                        state->rf->d_reg[0xf] = 0;
+                        state->rf.d_reg[0xf] = 0;
                     }
-                    state->rf->d_reg[x] <<= 1;
+                    state->rf.d_reg[x] = state->rf.d_reg[source] << 1;
                     break;
                 }
                 default:
-                    fprintf(stderr, "Instruction 0x%x not implemented!\n", instruction);
+                    TRACE_ERROR("Instruction 0x%x not implemented!\n", instruction);
             }
             break;
         }
         case SKIP_IF_NE_NIBBLE: {
             uint8_t x = GET_NIBBLE(instruction, 1);
             uint8_t y = GET_NIBBLE(instruction, 2);
-            if (state->rf->d_reg[x] != state->rf->d_reg[y]) {
-                state->rf->pc++;
+            if (state->rf.d_reg[x] != state->rf.d_reg[y]) {
+                skip_instruction(state);
             }
             break;
         }
         case SET_INDEX_REG_NIBBLE: {
             uint16_t address = MASK_NIBBLES(instruction, 1);
-            state->rf->I = address;
-            printf("Set index register to %d!\n", state->rf->I);
+            state->rf.I = address;
+            TRACE_DEBUG("Set index register to %d!\n", state->rf.I);
             break;
         }
         case JUMP_OFFSET_NIBBLE: {
             increment_pc = false;
-            uint16_t jump_address = MASK_NIBBLES(instruction, 1) + state->rf->d_reg[0];
-            //printf("Jumped to %x!\n", jump_address);
-            state->rf->pc = (uint16_t*) (state->mem->mem + jump_address);
+            uint8_t offset_register = quirks & QUIRK_JUMP_VX ? GET_NIBBLE(instruction, 1) : 0;
+            uint16_t jump_address = MASK_NIBBLES(instruction, 1) + state->rf.d_reg[offset_register];
+            TRACE_DEBUG("Jumped to %x!\n", jump_address);
+            state->rf.pc = (uint16_t*) (state->mem.mem + jump_address);
             break;
         }
         case GENERATE_RANDOM_NIBBLE: {
             uint8_t x = GET_NIBBLE(instruction, 1);
             uint8_t kk = MASK_NIBBLES(instruction, 2);
-            int random = rand() % 256;
-            state->rf->d_reg[x] = random & kk;
+            state->rf.d_reg[x] = random_byte(state) & kk;
             break;
         }
         case DRAW_NIBBLE: {
-            read_sprite_data(state, instruction);
-            render_image(state);
-            printf("Drew!\n");
+            if (state->mode == MODE_CHIP_8) {
+                if (quirks & QUIRK_WRAP_SPRITES) {
+                    wrap_sprite_data(state, GET_NIBBLE(instruction, 1), GET_NIBBLE(instruction, 2), GET_NIBBLE(instruction, 3));
+                } else {
+                    read_sprite_data(state, GET_NIBBLE(instruction, 1), GET_NIBBLE(instruction, 2), GET_NIBBLE(instruction, 3));
+                }
+            } else {
+                draw_extended_sprite(state, GET_NIBBLE(instruction, 1), GET_NIBBLE(instruction, 2),
+                                     GET_NIBBLE(instruction, 3), quirks & QUIRK_WRAP_SPRITES);
+            }
+            TRACE_DEBUG("Drew!\n");
             break;
         }
         case SKIP_IF_KEY_NIBBLE: {
             uint8_t end_nibbles = MASK_NIBBLES(instruction, 2);
-            uint8_t key = state->rf->d_reg[GET_NIBBLE(instruction, 1)];
-            SDL_Scancode scancode;
-            bool key_pressed = false;
-            while (SDL_PollEvent(&(state->screen->event))) {
-                switch (state->screen->event.type) {
-                    case SDL_KEYDOWN: {
-                        key_pressed = true;
-                        scancode = state->screen->event.key.keysym.scancode;
-                    }
-                    default: {
-                        break;
-                    }
-                }
-            }
-            if (end_nibbles == SKIP_IF_KEY_END_BYTE && key_pressed) {
-                if (key == scancode_to_int(scancode)) {
-                    state->rf->pc++;
+            uint8_t key = state->rf.d_reg[GET_NIBBLE(instruction, 1)];
+            if (end_nibbles == SKIP_IF_KEY_END_BYTE) {
+                if (key_down(state, key)) {
+                    skip_instruction(state);
                 }
             } else if (end_nibbles == SKIP_IF_NOT_KEY_END_BYTE) {
-                if (!key_pressed || key != scancode_to_int(scancode)) {
-                    state->rf->pc++;
+                if (!key_down(state, key)) {
+                    skip_instruction(state);
                 }
             } else {
-                fprintf(stderr, "Instruction 0x%x not implemented!\n", instruction);
+                TRACE_ERROR("Instruction 0x%x not implemented!\n", instruction);
             }
             break;
         }
         case MISCELLANEOUS_NIBBLE: {
+            if (state->mode != MODE_CHIP_8 && execute_extended_misc(state, instruction)) {
+                break;
+            }
             uint8_t end_byte = MASK_NIBBLES(instruction, 2);
             uint8_t x = GET_NIBBLE(instruction, 1);
             switch (end_byte) {
                 case SET_REG_TO_DEL_TIMER_BYTE: {
-                    state->rf->d_reg[x] = state->rf->delay_timer;
+                    state->rf.d_reg[x] = state->rf.delay_timer;
+                    note_delay_timer_read(state, PC_ADDRESS(state));
                     break;
                 }
                 case SET_DEL_TIMER_BYTE: {
-                    state->rf->delay_timer = state->rf->d_reg[x];
+                    state->rf.delay_timer = state->rf.d_reg[x];
                     break;
                 }
                 case SET_SOUND_TIMER_BYTE: {
-                    state->rf->sound_timer = state->rf->d_reg[x];
+                    state->rf.sound_timer = state->rf.d_reg[x];
                     break;
                 }
                 case ADD_TO_INDEX_BYTE: {
-                    state->rf->I += state->rf->d_reg[x];
+                    state->rf.I += state->rf.d_reg[x];
                     // some interpreters rely on VF being set if I is outside its normal address range
-                    if (state->rf->I >= 0x1000) {
-                        state->rf->d_reg[0xf] = 1;
+                    if ((quirks & QUIRK_INDEX_OVERFLOW) && state->rf.I >= 0x1000) {
+                        state->rf.d_reg[0xf] = 1;
                     }
                     break;
                 }
                 case GET_KEY_BYTE: {
+                    // blocks by re-executing until a key goes down
+                    if (!take_key_press(state, &state->rf.d_reg[x])) {
+                        increment_pc = false;
+                        state->waiting_for_key = true;
+                    }
                     break;
                 }
                 case FONT_CHARACTER_BYTE: {
+                    state->rf.I = FONT_MEMORY_OFFSET + (state->rf.d_reg[x] & 0xf) * BYTES_PER_FONT_CHARACTER;
                     break;
                 }
                 case BIN_TO_DEC_BYTE: {
+                    uint8_t value = state->rf.d_reg[x];
+                    write_memory(state, state->rf.I, value / 100);
+                    write_memory(state, state->rf.I + 1, value / 10 % 10);
+                    write_memory(state, state->rf.I + 2, value % 10);
                     break;
                 }
                 case STORE_REGS_TO_MEM_BYTE: {
+                    for (int i = 0; i <= x; ++i) {
+                        write_memory(state, state->rf.I + i, state->rf.d_reg[i]);
+                    }
+                    advance_index(state, x, quirks);
                     break;
                 }
                 case LOAD_REGS_FROM_MEM_BYTE: {
+                    for (int i = 0; i <= x; ++i) {
+                        state->rf.d_reg[i] = state->mem.mem[(state->rf.I + i) & state->address_mask];
+                    }
+                    advance_index(state, x, quirks);
                     break;
                 }
                 default:
-                    fprintf(stderr, "Instruction 0x%x not implemented!\n", instruction);
+                    TRACE_ERROR("Instruction 0x%x not implemented!\n", instruction);
             }
+            break;
         }
         default:
-            fprintf(stderr, "Instruction 0x%x not implemented!\n", instruction);
+            TRACE_ERROR("Instruction 0x%x not implemented!\n", instruction);
     }
     if (increment_pc) {
-        state->rf->pc++;
+        state->rf.pc++;
     }
 }
 
+void execute_instruction_cycle(struct MachineState* state) {
+    execute_instruction(state, state->quirks);
+}
 
-void run_machine(struct MachineState* state, uint8_t* binary, size_t binary_size) {
-    prepare_memory(state, binary, binary_size);
-    while (state->rf->pc >= (uint16_t*) &state->mem->mem[PROGRAM_OFFSET] && state->rf->pc < (uint16_t*) &state->mem->mem[PROGRAM_OFFSET + MAX_BINARY_LENGTH]) {
-        if (check_program_quit(state)) break;
-        execute_instruction_cycle(state);
+
+// FNV-1a over the row words in use, cheap enough to compare frames after every draw
+// an empty second plane is left out, so a 64x32 screen hashes its 32 words
+uint64_t hash_screen(const struct Screen* screen) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t words = (size_t) SCREEN_ROW_WORDS(screen) * screen->height;
+    uint64_t second_plane = 0;
+    for (size_t i = 0; i < words; ++i) {
+        second_plane |= screen->rows[1][i];
     }
+    for (int plane = 0; plane < (second_plane ? SCREEN_PLANES : 1); ++plane) {
+        for (size_t i = 0; i < words; ++i) {
+            hash ^= screen->rows[plane][i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
 }
 
-void delete_machine(struct MachineState** state) {
-    if (!(*state)) return;
+void set_machine_mode(struct MachineState* state, enum MachineMode mode) {
+    state->mode = mode;
+    set_quirks_profile(state, mode == MODE_XO_CHIP ? QUIRKS_XO_CHIP : mode == MODE_SCHIP ? QUIRKS_SCHIP : QUIRKS_MODERN);
+    reset_machine(state);
+}
 
-    SDL_DestroyRenderer((*state)->screen->renderer);
-    SDL_DestroyWindow((*state)->screen->window);
-    SDL_Quit();
-
-    if ((*state)->mem) free((*state)->mem);
-    if ((*state)->rf) free((*state)->rf);
-    if ((*state)->screen) free((*state)->screen);
-    (*state)->rf = NULL;
-    (*state)->mem = NULL;
-    (*state)->screen = NULL;
-    free((*state));
-    *state = NULL;
+// the engines notice the change themselves, the decode cache is rebound and translations are flushed
+void set_quirks_profile(struct MachineState* state, enum QuirksProfile profile) {
+    state->quirks_profile = profile;
+    state->quirks = quirks_profile_flags(profile);
 }
 
+uint32_t quirks_profile_flags(enum QuirksProfile profile) {
+    switch (profile) {
+#define QUIRKS_PROFILE_FLAGS(profile, name, flags) case profile: return flags;
+        FOR_EACH_QUIRKS_PROFILE(QUIRKS_PROFILE_FLAGS)
+#undef QUIRKS_PROFILE_FLAGS
+        default: return QUIRKS_MODERN_FLAGS;
+    }
+}
 
+const char* quirks_profile_name(enum QuirksProfile profile) {
+    switch (profile) {
+        case QUIRKS_SCHIP: return "schip";
+        case QUIRKS_XO_CHIP: return "xo-chip";
+        case QUIRKS_COSMAC_VIP: return "cosmac-vip";
+        case QUIRKS_CHIP_48: return "chip-48";
+        default: return "modern";
+    }
+}
+
+enum MachineMode quirks_profile_mode(enum QuirksProfile profile) {
+    switch (profile) {
+        case QUIRKS_SCHIP: return MODE_SCHIP;
+        case QUIRKS_XO_CHIP: return MODE_XO_CHIP;
+        default: return MODE_CHIP_8;
+    }
+}
+
+size_t max_program_length(enum MachineMode mode) {
+    return mode == MODE_XO_CHIP ? MAX_XO_BINARY_LENGTH : MAX_BINARY_LENGTH;
+}
+
+const char* machine_mode_name(enum MachineMode mode) {
+    switch (mode) {
+        case MODE_SCHIP: return "schip";
+        case MODE_XO_CHIP: return "xo-chip";
+        default: return "chip-8";
+    }
+}
+
+void load_program(struct MachineState* state, const uint8_t* binary, size_t binary_size) {
+    prepare_memory(state, binary, binary_size, NULL);
+}
+
+void load_hashed_program(struct MachineState* state, const uint8_t* binary, size_t binary_size, uint64_t hash) {
+    prepare_memory(state, binary, binary_size, &hash);
+}
 
+bool machine_halted(const struct MachineState* state) {
+    return state->stack_fault || state->rf.pc < (uint16_t*) &state->mem.mem[PROGRAM_OFFSET] || state->rf.pc >= (uint16_t*) &state->mem.mem[program_end(state)];
+}
+
+bool step_machine(struct MachineState* state) {
+    if (machine_halted(state)) {
+        return false;
+    }
+    execute_instruction_cycle(state);
+    return true;
+}
+
+// the same as ENGINE_INTERPRETER, with the trace and the profiler hooked in before every instruction
+static uint64_t run_instrumented(struct MachineState* state, uint64_t max_cycles) {
+    uint64_t cycles = 0;
+    while (cycles < max_cycles && !machine_blocked(state) && !machine_halted(state)) {
+        if (state->trace) trace_instruction(state->trace, state);
+        if (state->profiler) profile_instruction(state->profiler, state);
+        step_machine(state);
+        ++cycles;
+    }
+    return cycles;
+}
+
+// one interpreter loop per profile, each with its own copy of execute_instruction
+// while pc is confined to the analyzed code it cannot leave the program area, so it isn't checked
+#define DEFINE_INTERPRETER_LOOP(profile, name, flags) \
+    static uint64_t run_interpreter_##name(struct MachineState* state, uint64_t max_cycles) { \
+        uint64_t cycles = 0; \
+        while (cycles < max_cycles && state->pc_confined && !machine_blocked(state)) { \
+            execute_instruction(state, flags); \
+            ++cycles; \
+        } \
+        while (cycles < max_cycles && !machine_blocked(state) && !machine_halted(state)) { \
+            execute_instruction(state, flags); \
+            ++cycles; \
+        } \
+        return cycles; \
+    }
+FOR_EACH_QUIRKS_PROFILE(DEFINE_INTERPRETER_LOOP)
+#undef DEFINE_INTERPRETER_LOOP
+
+static uint64_t run_interpreter(struct MachineState* state, uint64_t max_cycles) {
+    switch (state->quirks_profile) {
+#define INTERPRETER_LOOP(profile, name, flags) case profile: return run_interpreter_##name(state, max_cycles);
+        FOR_EACH_QUIRKS_PROFILE(INTERPRETER_LOOP)
+#undef INTERPRETER_LOOP
+        default: return run_interpreter_modern(state, max_cycles);
+    }
+}
+
+static uint64_t run_engine(struct MachineState* state, uint64_t max_cycles) {
+    if (state->trace || state->profiler) return run_instrumented(state, max_cycles);
+    // the predecoded and native engines only know CHIP-8, the extended modes run on the reference interpreter
+    switch (state->mode == MODE_CHIP_8 ? state->engine : ENGINE_INTERPRETER) {
+        case ENGINE_PREDECODED: {
+            return run_predecoded(state, max_cycles);
+        }
+        case ENGINE_JIT: {
+            return run_jit(state, max_cycles);
+        }
+        case ENGINE_INTERPRETER:
+        default: {
+            return run_interpreter(state, max_cycles);
+        }
+    }
+}
+
+uint64_t run_cycles(struct MachineState* state, uint64_t max_cycles) {
+    if (state->recorder) record_frame_start(state->recorder, state);
+    uint64_t cycles = run_engine(state, max_cycles);
+    state->cycles += cycles;
+    if (state->recorder) record_frame_end(state->recorder, state);
+    return cycles;
+}
+
+// emulated frames per wall clock time since the last report
+struct TurboStats {
+    struct timespec since;
+    uint64_t frames;
+};
+
+static void report_turbo_speed(struct TurboStats* stats, const struct timespec* now, bool final) {
+    int64_t elapsed = nanoseconds_between(&stats->since, now);
+    if (!final && elapsed < NANOSECONDS_PER_SECOND) return;
+    if (elapsed > 0) {
+        fprintf(stderr, "Turbo: %.1fx real time\n", (double) stats->frames * NANOSECONDS_PER_FRAME / (double) elapsed);
+    }
+    stats->since = *now;
+    stats->frames = 0;
+}
+
+static void toggle_turbo(struct MachineState* state, struct TurboStats* stats) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    state->turbo = !state->turbo;
+    if (state->turbo) {
+        stats->since = now;
+        stats->frames = 0;
+    } else {
+        report_turbo_speed(stats, &now, true);
+        // the timers go back to the wall clock from where emulated time left them
+        start_timers(state, &now);
+    }
+}
+
+// emulated frames run back to back until the wall clock frame is over, the timers tick once per emulated frame
+static void run_turbo_frames(struct MachineState* state, const struct timespec* deadline, struct TurboStats* stats) {
+    struct timespec now;
+    do {
+        reset_idle_detection(state);
+        state->waiting_for_key = false;
+        if (state->rewind) rewind_capture(state->rewind, state);
+        run_cycles(state, state->instructions_per_frame);
+        tick_timers(state, 1);
+        stats->frames++;
+        if (state->turbo_frame_skip && stats->frames % state->turbo_frame_skip == 0) present_screen(state);
+        // a key press can only arrive with the next poll
+        if (machine_halted(state) || state->waiting_for_key) return;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (nanoseconds_between(&now, deadline) > 0);
+}
+
+// runs instructions_per_frame instructions per 60 Hz tick and presents at most once per tick
+// a program waiting on the delay timer ends its frame early and the thread sleeps until the next tick
+// in turbo mode frames run as fast as the host allows in emulated time, presenting every turbo_frame_skip-th
+void run_machine(struct MachineState* state, const uint8_t* binary, size_t binary_size) {
+    prepare_memory(state, binary, binary_size, NULL);
+    struct timespec next_frame, now;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+    start_timers(state, &next_frame);
+    struct TurboStats turbo = {next_frame, 0};
+    uint32_t commands;
+    while (!((commands = poll_input(state)) & INPUT_QUIT)) {
+        if (commands & INPUT_TURBO) toggle_turbo(state, &turbo);
+        add_nanoseconds(&next_frame, NANOSECONDS_PER_FRAME);
+        struct timespec frame_start;
+        if (state->profiler) clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        if (state->rewind && (commands & INPUT_REWIND)) {
+            // plays the last frames backwards at normal speed
+            reset_idle_detection(state);
+            state->waiting_for_key = false;
+            rewind_step(state->rewind, state, 1);
+            present_screen(state);
+        } else if (state->turbo) {
+            run_turbo_frames(state, &next_frame, &turbo);
+        } else {
+            reset_idle_detection(state);
+            state->waiting_for_key = false;
+            if (state->rewind) rewind_capture(state->rewind, state);
+            run_cycles(state, state->instructions_per_frame);
+            present_screen(state);
+        }
+        if (machine_halted(state)) break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (state->profiler) profile_frame(state->profiler, nanoseconds_between(&frame_start, &now));
+        if (now.tv_sec > next_frame.tv_sec + 1) {
+            // the host fell far behind (e.g. it was suspended), don't try to catch up
+            next_frame = now;
+        }
+        if (state->waiting_for_key && state->frontend && state->frontend->wait_input) {
+            // FX0A: sleep until either input arrives or the next tick is due
+            int64_t timeout = nanoseconds_between(&now, &next_frame) / 1000000;
+            if (timeout > 0) state->frontend->wait_input(state->frontend, (int) timeout);
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (state->turbo) {
+            report_turbo_speed(&turbo, &now, false);
+        } else {
+            update_timers(state, &now);
+        }
+    }
+    if (state->turbo) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        report_turbo_speed(&turbo, &now, true);
+    }
+}
+
+// one timer tick per instructions_per_frame instructions, without waiting for the wall clock
+uint64_t run_headless(struct MachineState* state, uint64_t max_cycles) {
+    uint64_t frame_cycles = state->instructions_per_frame ? state->instructions_per_frame : 1;
+    uint64_t cycles = 0;
+    while (cycles < max_cycles && !machine_halted(state)) {
+        reset_idle_detection(state);
+        uint64_t executed = run_cycles(state, max_cycles - cycles < frame_cycles ? max_cycles - cycles : frame_cycles);
+        cycles += executed;
+        // nobody is ever going to press a key
+        if (state->waiting_for_key || executed == 0) break;
+        tick_timers(state, 1);
+    }
+    return cycles;
+}
+
+void delete_machine(struct MachineState** state) {
+    if (!(*state)) return;
+
+    // pooled machines go away with their pool
+    if ((*state)->pooled) {
+        *state = NULL;
+        return;
+    }
+    delete_jit_cache(&(*state)->jit);
+    free((struct MachineArena*) *state);
+    *state = NULL;
+}
@@ -3,7 +3,9 @@
 
 #include <stdint.h>
 #include <stdio.h>
-#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <time.h>
+#include "frontend.h"
 
 struct RegisterFile {
     uint8_t d_reg[16]; // data registers V0-VF
@@ -13,38 +15,193 @@ struct RegisterFile {
     uint8_t sound_timer;
 };
 
+// the instruction set the machine implements, chosen before a program is loaded
+enum MachineMode {
+    MODE_CHIP_8,
+    MODE_SCHIP, // 128x64 high resolution, scrolling, 16x16 sprites, big font, RPL flags
+    MODE_XO_CHIP, // SCHIP plus two bitplanes, 64 KB of memory and an audio pattern buffer
+};
+
+// behaviors the interpreters of the past disagree on, a set bit selects the variant described
+#define QUIRK_VF_RESET 0x01U // 8XY1, 8XY2 and 8XY3 clear VF
+#define QUIRK_SHIFT_VY 0x02U // 8XY6 and 8XYE shift VY into VX instead of shifting VX in place
+#define QUIRK_JUMP_VX 0x04U // BXNN jumps to XNN + VX instead of NNN + V0
+#define QUIRK_INDEX_OVERFLOW 0x08U // FX1E sets VF when I leaves the 4 KB address space
+#define QUIRK_INDEX_INCREMENT 0x10U // FX55 and FX65 leave I behind the last register transferred
+#define QUIRK_INDEX_ADD_X 0x20U // FX55 and FX65 add X to I, one less than QUIRK_INDEX_INCREMENT
+#define QUIRK_WRAP_SPRITES 0x40U // sprites wrap around the edges instead of being clipped
+
+// A named set of quirks. Each has its own copy of the dispatch loops with the quirks compiled in, so the
+// loops never test them at run time. The first three double as the instruction set a ROM was detected as,
+// see detect_quirks_profile.
+enum QuirksProfile {
+    QUIRKS_MODERN, // what most programs written today expect, the default for CHIP-8
+    QUIRKS_SCHIP, // SCHIP 1.1 on the HP 48, the default for SCHIP
+    QUIRKS_XO_CHIP, // Octo, the default for XO-CHIP
+    QUIRKS_COSMAC_VIP, // the original interpreter
+    QUIRKS_CHIP_48, // CHIP-48 on the HP 48
+    QUIRKS_PROFILE_COUNT
+};
+
 #define STACK_SIZE 48
-#define MEMORY_SIZE 4096
+#define MEMORY_SIZE 4096 // address space of CHIP-8 and SCHIP
+#define XO_MEMORY_SIZE 0x10000 // address space of XO-CHIP
 #define PROGRAM_OFFSET 0x200
 #define STACK_OFFSET 0xEA0
+#define STACK_AREA_SIZE (MEMORY_SIZE - STACK_OFFSET)
 #define DISPLAY_REFRESH_OFFSET 0xF00
-#define MAX_BINARY_LENGTH (MEMORY_SIZE - PROGRAM_OFFSET - (MEMORY_SIZE - STACK_OFFSET))
+#define MAX_BINARY_LENGTH (MEMORY_SIZE - PROGRAM_OFFSET - STACK_AREA_SIZE)
+#define MAX_XO_BINARY_LENGTH (XO_MEMORY_SIZE - PROGRAM_OFFSET)
 
+// XO-CHIP programs may use all of their 64 KB, so their stack lives in an area behind the address space
+// instead of at STACK_OFFSET
 struct Memory {
-    uint8_t mem[MEMORY_SIZE];
+    uint8_t mem[XO_MEMORY_SIZE + STACK_AREA_SIZE];
     uint16_t** stack_base_pointer;
     uint16_t** stack_pointer;
 };
 
-#define PIXEL_SIZE 16
-#define SCREEN_WIDTH (64 * PIXEL_SIZE)
-#define SCREEN_HEIGHT (32 * PIXEL_SIZE)
+#define SCREEN_WIDTH 64
+#define SCREEN_HEIGHT 32
+#define HIRES_SCREEN_WIDTH 128
+#define HIRES_SCREEN_HEIGHT 64
+#define SCREEN_PLANES 2
+#define SCREEN_WORDS (HIRES_SCREEN_WIDTH / 64 * HIRES_SCREEN_HEIGHT)
 
+// One bit per pixel and plane, the most significant bit of a word is its leftmost pixel. A row takes width / 64
+// words, so the 64x32 screen is the first 32 words of plane 0 and the classic routines never touch the rest.
 struct Screen {
-    uint8_t pixels[SCREEN_HEIGHT / PIXEL_SIZE][SCREEN_WIDTH / PIXEL_SIZE];
-    SDL_Event event;
-    SDL_Renderer* renderer;
-    SDL_Window* window;
+    uint64_t rows[SCREEN_PLANES][SCREEN_WORDS];
+    uint64_t dirty_rows; // bit i is set if row i changed since it was last presented
+    uint8_t width; // SCREEN_WIDTH or HIRES_SCREEN_WIDTH
+    uint8_t height;
 };
 
+#define SCREEN_ROW_WORDS(screen) ((screen)->width / 64)
+#define SCREEN_PLANE_PIXEL(screen, plane, x, y) \
+    (((screen)->rows[plane][(y) * SCREEN_ROW_WORDS(screen) + (x) / 64] >> (63 - (x) % 64)) & 1U)
+// the color index, bit n is the pixel of plane n
+#define SCREEN_PIXEL(screen, x, y) (SCREEN_PLANE_PIXEL(screen, 0, x, y) | SCREEN_PLANE_PIXEL(screen, 1, x, y) << 1)
+
+enum ExecutionEngine {
+    ENGINE_INTERPRETER, // reference implementation, fetches and decodes every cycle
+    ENGINE_PREDECODED, // threaded dispatch over a cache of decoded instructions
+    ENGINE_JIT, // native code for basic blocks, x86-64 only, falls back to ENGINE_PREDECODED elsewhere
+};
+
+#define FRAME_RATE 60
+#define DEFAULT_RANDOM_SEED 1
+#define DEFAULT_TURBO_FRAME_SKIP 10
+#define DEFAULT_INSTRUCTIONS_PER_FRAME 11 // roughly 700 instructions per second
+
+// snapshot taken at a delay timer read, see note_delay_timer_read
+struct IdleDetector {
+    uint8_t d_reg[16];
+    uint16_t pc;
+    uint16_t I;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint16_t** stack_pointer;
+    uint64_t side_effects;
+    bool armed;
+};
+
+struct DecodeCache;
+struct JitCache;
+struct TraceBuffer;
+struct Profiler;
+struct Rewind;
+struct InputLog;
+struct RomAnalysis;
+
+#define CACHE_LINE_SIZE 64
+
+// The whole machine is a single cache aligned block with its decode cache right behind it. What the dispatch
+// loops touch on every instruction comes first, memory and the framebuffer follow on their own cache lines.
 struct MachineState {
-    struct RegisterFile* rf; // register file
-    struct Memory* mem; // mem
-    struct Screen* screen;
+    // hot
+    struct RegisterFile rf; // register file
+    enum ExecutionEngine engine;
+    uint32_t instructions_per_frame;
+    uint64_t side_effects; // counts memory stores, draws, screen clears, scrolls and mode switches, random numbers and RPL flag and audio writes
+    struct DecodeCache* decode_cache; // part of the machine's allocation
+    struct JitCache* jit; // created on first use of ENGINE_JIT
+    bool waiting_for_timer; // the program spins on the delay timer until the next tick
+    bool waiting_for_key; // FX0A found no key press
+    uint16_t keypad; // bit n is set while key n is held down
+    uint16_t key_presses; // keys that went down at the last input poll, consumed by FX0A
+    uint32_t random_state; // xorshift state CXNN draws from, never zero
+    uint64_t cycles; // instructions executed by run_cycles since the program was loaded
+    bool pc_confined; // pc can only be an instruction of analysis, the interpreter loops don't check it
+    bool stack_fault; // a call overflowed or a return underflowed the stack or found a return address outside the program area, the machine halted on that instruction
+
+    // cold
+    struct Frontend* frontend; // not owned by the machine
+    struct TraceBuffer* trace; // not owned, while set every instruction is traced on the reference interpreter
+    struct Profiler* profiler; // not owned, like trace it switches to the reference interpreter while set
+    struct Rewind* rewind; // not owned, run_machine captures every frame into it while set
+    struct InputLog* recorder; // not owned, every run_cycles call is recorded as a frame while set
+    const struct RomAnalysis* analysis; // not owned, load_program confines pc with it if it covers the program
+    struct timespec timer_epoch; // delay_timer and sound_timer tick at 60 Hz from here
+    uint64_t timer_ticks; // ticks already applied since timer_epoch
+    uint64_t elapsed_ticks; // every tick applied to the timers, in real or emulated time
+    struct IdleDetector idle;
+    bool turbo; // run_machine ignores the wall clock, toggled by INPUT_TURBO
+    uint32_t turbo_frame_skip; // only every n-th emulated frame is presented in turbo, 0 presents none
+    bool pooled; // owned by a MachinePool, which frees it
+    enum QuirksProfile quirks_profile; // kept by reset_machine, see set_quirks_profile
+    uint32_t quirks; // QUIRK_* bits of quirks_profile
+
+    // extended modes, only the reference interpreter runs them
+    enum MachineMode mode; // kept by reset_machine, see set_machine_mode
+    uint16_t address_mask; // memory size - 1 of the mode
+    uint8_t planes; // XO-CHIP bitplanes DXYN draws into, bit n selects plane n
+    uint8_t rpl_flags[16]; // saved by FX75 and loaded by FX85
+    uint8_t audio_pattern[16]; // XO-CHIP 1 bit sample buffer, loaded by F002
+    uint8_t audio_pitch; // XO-CHIP playback rate, set by FX3A
+
+    _Alignas(CACHE_LINE_SIZE) struct Memory mem;
+    _Alignas(CACHE_LINE_SIZE) struct Screen screen;
 };
 
-extern struct MachineState* create_machine();
-extern void run_machine(struct MachineState* state, uint8_t* binary, size_t binary_size);
+extern struct MachineState* create_machine(struct Frontend* frontend);
+// back to the state of a freshly created machine without allocating, the engine and attachments are kept
+extern void reset_machine(struct MachineState* state);
+// switches the instruction set and resets the machine
+extern void set_machine_mode(struct MachineState* state, enum MachineMode mode);
+// takes effect with the next instruction, set_machine_mode selects the default profile of the mode
+extern void set_quirks_profile(struct MachineState* state, enum QuirksProfile profile);
+extern uint32_t quirks_profile_flags(enum QuirksProfile profile);
+extern const char* quirks_profile_name(enum QuirksProfile profile);
+// the instruction set a profile belongs to
+extern enum MachineMode quirks_profile_mode(enum QuirksProfile profile);
+// the largest program the mode has room for
+extern size_t max_program_length(enum MachineMode mode);
+extern const char* machine_mode_name(enum MachineMode mode);
+extern void load_program(struct MachineState* state, const uint8_t* binary, size_t binary_size);
+// load_program of a binary whose hash_rom is already known, the analysis is checked against it without hashing
+extern void load_hashed_program(struct MachineState* state, const uint8_t* binary, size_t binary_size, uint64_t hash);
+// executes a single instruction, returns false once pc has left the program area
+extern bool step_machine(struct MachineState* state);
+// executes up to max_cycles instructions with the selected engine, returns the number executed
+// stops early if the machine halts or starts waiting on the delay timer
+extern uint64_t run_cycles(struct MachineState* state, uint64_t max_cycles);
+extern void seed_random(struct MachineState* state, uint32_t seed);
+// replaces the keypad state, usually done once per frame
+extern void set_keypad(struct MachineState* state, uint16_t keypad);
+extern bool machine_halted(const struct MachineState* state);
+extern uint64_t hash_screen(const struct Screen* screen);
+extern void run_machine(struct MachineState* state, const uint8_t* binary, size_t binary_size);
+// runs the loaded program in emulated time as fast as the host allows, returns the number of instructions executed
+// stops after max_cycles, when the machine halts or when it waits for a key
+extern uint64_t run_headless(struct MachineState* state, uint64_t max_cycles);
 extern void delete_machine(struct MachineState** state);
 
+// many machines in one allocation, e.g. one per worker of a batch run
+struct MachinePool;
+
+extern struct MachinePool* create_machine_pool(size_t machines, struct Frontend* frontend);
+extern struct MachineState* pool_machine(struct MachinePool* pool, size_t index);
+extern void delete_machine_pool(struct MachinePool** pool);
+
 #endif //CHIP_8_CHIP_8_H
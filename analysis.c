@@ -0,0 +1,629 @@
+#include "analysis.h"
+#include "CHIP-8-internal.h"
+#include "rom.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DATA_BYTES_PER_LINE 8
+#define MAX_MNEMONIC_LENGTH 32
+#define MAX_NOTES 4
+
+struct Analyzer {
+    enum MachineMode mode;
+    const uint8_t* data;
+    uint32_t rom_end; // behind the last byte of the program, at most the end of the program area
+    uint32_t memory_size;
+    uint8_t* flags;
+};
+
+// how an instruction passes control on
+struct Flow {
+    enum BlockExit exit; // BLOCK_FALLS_THROUGH for everything that simply continues behind it
+    uint8_t length; // 4 for F000 NNNN, 2 otherwise
+    uint32_t target; // of a jump or call, or the skipped-to address
+};
+
+// what prepare_memory left at the address, as far as the program is concerned
+static uint8_t read_byte(const struct Analyzer* analyzer, uint32_t address) {
+    return address >= PROGRAM_OFFSET && address < analyzer->rom_end ? analyzer->data[address - PROGRAM_OFFSET] : 0;
+}
+
+static uint16_t read_word(const struct Analyzer* analyzer, uint32_t address) {
+    return read_byte(analyzer, address) << 8 | read_byte(analyzer, address + 1);
+}
+
+static bool fits_rom(const struct Analyzer* analyzer, uint32_t address, uint32_t length) {
+    return address >= PROGRAM_OFFSET && address + length <= analyzer->rom_end;
+}
+
+// the instructions execute_extended_system takes
+static bool is_extended_system(enum MachineMode mode, uint16_t opcode) {
+    return (opcode & 0xfff0) == SCROLL_DOWN_INSTRUCTION ||
+           (mode == MODE_XO_CHIP && (opcode & 0xfff0) == SCROLL_UP_INSTRUCTION) ||
+           (opcode >= SCROLL_RIGHT_INSTRUCTION && opcode <= HIRES_INSTRUCTION);
+}
+
+// skip_instruction jumps over a following F000 NNNN as a whole
+static void skip_flow(const struct Analyzer* analyzer, uint32_t address, struct Flow* flow) {
+    flow->exit = BLOCK_SKIPS;
+    flow->target = address + 4;
+    if (analyzer->mode == MODE_XO_CHIP && read_word(analyzer, address + 2) == LONG_INDEX_INSTRUCTION) {
+        flow->target += 2;
+    }
+}
+
+// decodes like execute_instruction in the analyzed mode, quirks never change where control goes
+static struct Flow instruction_flow(const struct Analyzer* analyzer, uint32_t address) {
+    uint16_t opcode = read_word(analyzer, address);
+    struct Flow flow = {BLOCK_FALLS_THROUGH, 2, 0};
+    switch (GET_NIBBLE(opcode, 0)) {
+        case CLEAR_OR_RETURN_NIBBLE: {
+            if (analyzer->mode != MODE_CHIP_8 && is_extended_system(analyzer->mode, opcode)) {
+                if (opcode == EXIT_INSTRUCTION) flow.exit = BLOCK_HALTS;
+            } else if (opcode == RETURN_INSTRUCTION) {
+                flow.exit = BLOCK_RETURNS;
+            }
+            break;
+        }
+        case JUMP_NIBBLE: {
+            flow.exit = BLOCK_JUMPS;
+            flow.target = MASK_NIBBLES(opcode, 1);
+            break;
+        }
+        case CALL_SUBROUTINE_NIBBLE: {
+            flow.exit = BLOCK_CALLS;
+            flow.target = MASK_NIBBLES(opcode, 1);
+            break;
+        }
+        case SKIP_IF_EQ_REG: {
+            if (analyzer->mode == MODE_XO_CHIP && (GET_NIBBLE(opcode, 3) == SAVE_RANGE_NIBBLE ||
+                                                   GET_NIBBLE(opcode, 3) == LOAD_RANGE_NIBBLE)) {
+                break;
+            }
+            skip_flow(analyzer, address, &flow);
+            break;
+        }
+        case SKIP_IF_EQ_IMM:
+        case SKIP_IF_NEQ_IMM:
+        case SKIP_IF_NE_NIBBLE: {
+            skip_flow(analyzer, address, &flow);
+            break;
+        }
+        case JUMP_OFFSET_NIBBLE: {
+            flow.exit = BLOCK_JUMPS_INDIRECT;
+            break;
+        }
+        case SKIP_IF_KEY_NIBBLE: {
+            uint8_t end_byte = MASK_NIBBLES(opcode, 2);
+            if (end_byte == SKIP_IF_KEY_END_BYTE || end_byte == SKIP_IF_NOT_KEY_END_BYTE) {
+                skip_flow(analyzer, address, &flow);
+            }
+            break;
+        }
+        case MISCELLANEOUS_NIBBLE: {
+            if (analyzer->mode == MODE_XO_CHIP && opcode == LONG_INDEX_INSTRUCTION) flow.length = 4;
+            break;
+        }
+        default: break;
+    }
+    return flow;
+}
+
+static void mark_block_start(struct Analyzer* analyzer, uint32_t address) {
+    if (fits_rom(analyzer, address, 2)) analyzer->flags[address] |= ANALYSIS_BLOCK_START;
+}
+
+// Walks every path from PROGRAM_OFFSET like detect_quirks_profile, marking instructions and where blocks start.
+// Returns whether pc stays on the instructions found.
+static bool find_code(struct Analyzer* analyzer) {
+    // each visited instruction pushes at most one address
+    uint32_t* pending = malloc((analyzer->memory_size + 1) * sizeof(uint32_t));
+    if (!pending) {
+        exit(EXIT_FAILURE);
+    }
+    size_t pending_count = 0;
+    bool confined = true;
+    pending[pending_count++] = PROGRAM_OFFSET;
+    mark_block_start(analyzer, PROGRAM_OFFSET);
+    while (pending_count) {
+        uint32_t address = pending[--pending_count];
+        bool walking = true;
+        while (walking) {
+            struct Flow flow = instruction_flow(analyzer, address);
+            if (!fits_rom(analyzer, address, flow.length)) {
+                // runs off the ROM, into memory the analysis knows nothing about
+                confined = false;
+                break;
+            }
+            if (analyzer->flags[address] & ANALYSIS_CODE) {
+                // only a leader or code reached from two sides can be found again
+                analyzer->flags[address] |= ANALYSIS_BLOCK_START;
+                break;
+            }
+            analyzer->flags[address] |= ANALYSIS_CODE;
+            for (uint32_t i = 1; i < flow.length; ++i) {
+                analyzer->flags[address + i] |= ANALYSIS_OPERAND;
+            }
+            uint32_t next = address + flow.length;
+            switch (flow.exit) {
+                case BLOCK_FALLS_THROUGH: {
+                    address = next;
+                    break;
+                }
+                case BLOCK_JUMPS: {
+                    mark_block_start(analyzer, flow.target);
+                    address = flow.target;
+                    break;
+                }
+                case BLOCK_CALLS: {
+                    mark_block_start(analyzer, flow.target);
+                    if (fits_rom(analyzer, flow.target, 2)) analyzer->flags[flow.target] |= ANALYSIS_CALL_TARGET;
+                    pending[pending_count++] = flow.target;
+                    // the return site
+                    mark_block_start(analyzer, next);
+                    address = next;
+                    break;
+                }
+                case BLOCK_SKIPS: {
+                    mark_block_start(analyzer, flow.target);
+                    pending[pending_count++] = flow.target;
+                    mark_block_start(analyzer, next);
+                    address = next;
+                    break;
+                }
+                case BLOCK_JUMPS_INDIRECT: {
+                    analyzer->flags[address] |= ANALYSIS_INDIRECT_JUMP;
+                    confined = false;
+                    walking = false;
+                    break;
+                }
+                case BLOCK_HALTS: {
+                    confined = false;
+                    walking = false;
+                    break;
+                }
+                case BLOCK_RETURNS:
+                default: {
+                    walking = false;
+                    break;
+                }
+            }
+        }
+    }
+    free(pending);
+    return confined;
+}
+
+// I as far as it is known within a block, nothing is assumed about it where a block starts
+struct IndexTracker {
+    bool known;
+    uint32_t index;
+};
+
+static void note_store(struct Analyzer* analyzer, uint32_t address, const struct IndexTracker* tracker,
+                       uint32_t count) {
+    if (!tracker->known) {
+        analyzer->flags[address] |= ANALYSIS_UNRESOLVED_STORE;
+        return;
+    }
+    bool into_code = false;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t target = (tracker->index + i) & (analyzer->memory_size - 1);
+        analyzer->flags[target] |= ANALYSIS_STORED;
+        into_code |= (analyzer->flags[target] & (ANALYSIS_CODE | ANALYSIS_OPERAND)) != 0;
+    }
+    if (into_code) analyzer->flags[address] |= ANALYSIS_SELF_MODIFYING;
+}
+
+// how the instruction at address moves I and where it stores
+static void track_index(struct Analyzer* analyzer, uint32_t address, struct IndexTracker* tracker) {
+    uint16_t opcode = read_word(analyzer, address);
+    uint8_t x = GET_NIBBLE(opcode, 1);
+    uint8_t y = GET_NIBBLE(opcode, 2);
+    switch (GET_NIBBLE(opcode, 0)) {
+        case SET_INDEX_REG_NIBBLE: {
+            tracker->known = true;
+            tracker->index = MASK_NIBBLES(opcode, 1);
+            break;
+        }
+        case SKIP_IF_EQ_REG: {
+            if (analyzer->mode == MODE_XO_CHIP && GET_NIBBLE(opcode, 3) == SAVE_RANGE_NIBBLE) {
+                note_store(analyzer, address, tracker, (x <= y ? y - x : x - y) + 1);
+            }
+            break;
+        }
+        case MISCELLANEOUS_NIBBLE: {
+            if (analyzer->mode == MODE_XO_CHIP && opcode == LONG_INDEX_INSTRUCTION) {
+                tracker->known = true;
+                tracker->index = read_word(analyzer, address + 2);
+                break;
+            }
+            switch (MASK_NIBBLES(opcode, 2)) {
+                case BIN_TO_DEC_BYTE: {
+                    note_store(analyzer, address, tracker, 3);
+                    break;
+                }
+                case STORE_REGS_TO_MEM_BYTE: {
+                    note_store(analyzer, address, tracker, x + 1);
+                    // where I is left depends on the quirks
+                    tracker->known = false;
+                    break;
+                }
+                case LOAD_REGS_FROM_MEM_BYTE:
+                case ADD_TO_INDEX_BYTE:
+                case FONT_CHARACTER_BYTE:
+                case BIG_FONT_CHARACTER_BYTE: {
+                    tracker->known = false;
+                    break;
+                }
+                default: break;
+            }
+            break;
+        }
+        default: break;
+    }
+}
+
+static void append_block(struct RomAnalysis* analysis, size_t* capacity, const struct BasicBlock* block) {
+    if (analysis->block_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        analysis->blocks = realloc(analysis->blocks, *capacity * sizeof(struct BasicBlock));
+        if (!analysis->blocks) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    analysis->blocks[analysis->block_count++] = *block;
+}
+
+// follows the instructions from a block start up to the first one that passes control elsewhere
+static struct BasicBlock build_block(struct Analyzer* analyzer, uint32_t start) {
+    struct BasicBlock block = {(uint16_t) start, start, (uint16_t) start, BLOCK_FALLS_THROUGH, {0}, 0};
+    struct IndexTracker tracker = {false, 0};
+    uint32_t address = start;
+    while (true) {
+        struct Flow flow = instruction_flow(analyzer, address);
+        track_index(analyzer, address, &tracker);
+        block.last = (uint16_t) address;
+        block.end = address + flow.length;
+        block.exit = flow.exit;
+        switch (flow.exit) {
+            case BLOCK_FALLS_THROUGH: {
+                if (fits_rom(analyzer, block.end, 2) && (analyzer->flags[block.end] & ANALYSIS_CODE) &&
+                    !(analyzer->flags[block.end] & ANALYSIS_BLOCK_START)) {
+                    address = block.end;
+                    continue;
+                }
+                block.successors[block.successor_count++] = (uint16_t) block.end;
+                return block;
+            }
+            case BLOCK_JUMPS: {
+                block.successors[block.successor_count++] = (uint16_t) flow.target;
+                return block;
+            }
+            case BLOCK_CALLS: {
+                block.successors[block.successor_count++] = (uint16_t) flow.target;
+                block.successors[block.successor_count++] = (uint16_t) block.end;
+                return block;
+            }
+            case BLOCK_SKIPS: {
+                block.successors[block.successor_count++] = (uint16_t) block.end;
+                block.successors[block.successor_count++] = (uint16_t) flow.target;
+                return block;
+            }
+            default: return block;
+        }
+    }
+}
+
+struct RomAnalysis* analyze_rom(const uint8_t* data, size_t size, enum MachineMode mode) {
+    return analyze_hashed_rom(data, size, mode, hash_rom(data, size));
+}
+
+struct RomAnalysis* analyze_hashed_rom(const uint8_t* data, size_t size, enum MachineMode mode, uint64_t hash) {
+    struct RomAnalysis* analysis = calloc(1, sizeof(struct RomAnalysis));
+    if (!analysis) {
+        exit(EXIT_FAILURE);
+    }
+    analysis->mode = mode;
+    analysis->hash = hash;
+    analysis->size = size;
+    uint32_t memory_size = mode == MODE_XO_CHIP ? XO_MEMORY_SIZE : MEMORY_SIZE;
+    analysis->flags = calloc(memory_size, 1);
+    if (!analysis->flags) {
+        exit(EXIT_FAILURE);
+    }
+    // a ROM too long for the mode is analyzed as far as it would be loaded
+    size_t program_size = size < max_program_length(mode) ? size : max_program_length(mode);
+    struct Analyzer analyzer = {mode, data, PROGRAM_OFFSET + (uint32_t) program_size, memory_size, analysis->flags};
+
+    bool confined = find_code(&analyzer);
+    size_t capacity = 0;
+    for (uint32_t address = PROGRAM_OFFSET; address < analyzer.rom_end; ++address) {
+        uint8_t flags = analysis->flags[address];
+        if (!(flags & ANALYSIS_CODE) || !(flags & ANALYSIS_BLOCK_START)) continue;
+        struct BasicBlock block = build_block(&analyzer, address);
+        append_block(analysis, &capacity, &block);
+    }
+
+    struct AnalysisSummary* summary = &analysis->summary;
+    for (uint32_t address = 0; address < memory_size; ++address) {
+        uint8_t flags = analysis->flags[address];
+        if (flags & (ANALYSIS_CODE | ANALYSIS_OPERAND)) summary->code_bytes++;
+        if (flags & ANALYSIS_INDIRECT_JUMP) summary->indirect_jumps++;
+        if (flags & ANALYSIS_SELF_MODIFYING) summary->self_modifying_stores++;
+        if (flags & ANALYSIS_UNRESOLVED_STORE) summary->unresolved_stores++;
+    }
+    summary->blocks = (uint32_t) analysis->block_count;
+    summary->pc_confined = confined;
+    return analysis;
+}
+
+bool analysis_covers(const struct RomAnalysis* analysis, enum MachineMode mode, const uint8_t* data, size_t size) {
+    return analysis && analysis->mode == mode && analysis->size == size && analysis->hash == hash_rom(data, size);
+}
+
+bool analysis_covers_hashed(const struct RomAnalysis* analysis, enum MachineMode mode, size_t size, uint64_t hash) {
+    return analysis && analysis->mode == mode && analysis->size == size && analysis->hash == hash;
+}
+
+// Cowgod's mnemonics, with the SCHIP and XO-CHIP extensions where the mode decodes them
+static void format_instruction(enum MachineMode mode, uint16_t opcode, uint16_t operand, char* text) {
+    uint8_t x = GET_NIBBLE(opcode, 1);
+    uint8_t y = GET_NIBBLE(opcode, 2);
+    uint8_t n = GET_NIBBLE(opcode, 3);
+    uint8_t nn = MASK_NIBBLES(opcode, 2);
+    uint16_t nnn = MASK_NIBBLES(opcode, 1);
+    const char* format = NULL;
+    switch (GET_NIBBLE(opcode, 0)) {
+        case CLEAR_OR_RETURN_NIBBLE: {
+            if (mode != MODE_CHIP_8 && is_extended_system(mode, opcode)) {
+                switch (opcode) {
+                    case SCROLL_RIGHT_INSTRUCTION: format = "SCR"; break;
+                    case SCROLL_LEFT_INSTRUCTION: format = "SCL"; break;
+                    case EXIT_INSTRUCTION: format = "EXIT"; break;
+                    case LORES_INSTRUCTION: format = "LOW"; break;
+                    case HIRES_INSTRUCTION: format = "HIGH"; break;
+                    default: {
+                        snprintf(text, MAX_MNEMONIC_LENGTH, "%s %X",
+                                 (opcode & 0xfff0) == SCROLL_DOWN_INSTRUCTION ? "SCD" : "SCU", n);
+                        return;
+                    }
+                }
+            } else if (opcode == CLEAR_SCREEN_INSTRUCTION) {
+                format = "CLS";
+            } else if (opcode == RETURN_INSTRUCTION) {
+                format = "RET";
+            } else {
+                snprintf(text, MAX_MNEMONIC_LENGTH, "SYS %03X", nnn);
+                return;
+            }
+            snprintf(text, MAX_MNEMONIC_LENGTH, "%s", format);
+            return;
+        }
+        case JUMP_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "JP %03X", nnn); return;
+        case CALL_SUBROUTINE_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "CALL %03X", nnn); return;
+        case SKIP_IF_EQ_IMM: snprintf(text, MAX_MNEMONIC_LENGTH, "SE V%X, %02X", x, nn); return;
+        case SKIP_IF_NEQ_IMM: snprintf(text, MAX_MNEMONIC_LENGTH, "SNE V%X, %02X", x, nn); return;
+        case SKIP_IF_EQ_REG: {
+            if (mode == MODE_XO_CHIP && (n == SAVE_RANGE_NIBBLE || n == LOAD_RANGE_NIBBLE)) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, "%s V%X-V%X", n == SAVE_RANGE_NIBBLE ? "SAVE" : "LOAD", x, y);
+                return;
+            }
+            snprintf(text, MAX_MNEMONIC_LENGTH, "SE V%X, V%X", x, y);
+            return;
+        }
+        case SET_REGISTER_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "LD V%X, %02X", x, nn); return;
+        case ADD_IMMEDIATE_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "ADD V%X, %02X", x, nn); return;
+        case ARITH_LOGIC_NIBBLE: {
+            switch (n) {
+                case LOAD_NIBBLE: format = "LD"; break;
+                case OR_NIBBLE: format = "OR"; break;
+                case AND_NIBBLE: format = "AND"; break;
+                case XOR_NIBBLE: format = "XOR"; break;
+                case ADD_NIBBLE: format = "ADD"; break;
+                case SUBTRACT_NIBBLE: format = "SUB"; break;
+                case RIGHT_SHIFT_NIBBLE: format = "SHR"; break;
+                case SUBTRACT_N_NIBBLE: format = "SUBN"; break;
+                case LEFT_SHIFT_NIBBLE: format = "SHL"; break;
+                default: break;
+            }
+            break;
+        }
+        case SKIP_IF_NE_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "SNE V%X, V%X", x, y); return;
+        case SET_INDEX_REG_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "LD I, %03X", nnn); return;
+        case JUMP_OFFSET_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "JP V0, %03X", nnn); return;
+        case GENERATE_RANDOM_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "RND V%X, %02X", x, nn); return;
+        case DRAW_NIBBLE: snprintf(text, MAX_MNEMONIC_LENGTH, "DRW V%X, V%X, %X", x, y, n); return;
+        case SKIP_IF_KEY_NIBBLE: {
+            if (nn == SKIP_IF_KEY_END_BYTE) format = "SKP V%X";
+            if (nn == SKIP_IF_NOT_KEY_END_BYTE) format = "SKNP V%X";
+            if (format) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, format, x);
+                return;
+            }
+            break;
+        }
+        case MISCELLANEOUS_NIBBLE: {
+            if (mode == MODE_XO_CHIP && opcode == LONG_INDEX_INSTRUCTION) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, "LD I, %04X", operand);
+                return;
+            }
+            if (mode == MODE_XO_CHIP && opcode == LOAD_AUDIO_INSTRUCTION) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, "AUDIO");
+                return;
+            }
+            if (mode == MODE_XO_CHIP && nn == SELECT_PLANES_BYTE) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, "PLANE %X", x);
+                return;
+            }
+            switch (nn) {
+                case SET_REG_TO_DEL_TIMER_BYTE: format = "LD V%X, DT"; break;
+                case GET_KEY_BYTE: format = "LD V%X, K"; break;
+                case SET_DEL_TIMER_BYTE: format = "LD DT, V%X"; break;
+                case SET_SOUND_TIMER_BYTE: format = "LD ST, V%X"; break;
+                case ADD_TO_INDEX_BYTE: format = "ADD I, V%X"; break;
+                case FONT_CHARACTER_BYTE: format = "LD F, V%X"; break;
+                case BIN_TO_DEC_BYTE: format = "LD B, V%X"; break;
+                case STORE_REGS_TO_MEM_BYTE: format = "LD [I], V%X"; break;
+                case LOAD_REGS_FROM_MEM_BYTE: format = "LD V%X, [I]"; break;
+                default: break;
+            }
+            if (mode != MODE_CHIP_8) {
+                switch (nn) {
+                    case BIG_FONT_CHARACTER_BYTE: format = "LD HF, V%X"; break;
+                    case SAVE_FLAGS_BYTE: format = "LD R, V%X"; break;
+                    case LOAD_FLAGS_BYTE: format = "LD V%X, R"; break;
+                    case SET_PITCH_BYTE: format = mode == MODE_XO_CHIP ? "PITCH V%X" : NULL; break;
+                    default: break;
+                }
+            }
+            if (format) {
+                snprintf(text, MAX_MNEMONIC_LENGTH, format, x);
+                return;
+            }
+            break;
+        }
+        default: break;
+    }
+    if (format) {
+        // the 8XYN group
+        snprintf(text, MAX_MNEMONIC_LENGTH, "%s V%X, V%X", format, x, y);
+        return;
+    }
+    snprintf(text, MAX_MNEMONIC_LENGTH, "???");
+}
+
+// XO-CHIP addresses take four digits
+static int address_digits(const struct RomAnalysis* analysis) {
+    return analysis->mode == MODE_XO_CHIP ? 4 : 3;
+}
+
+static uint32_t rom_end(const struct RomAnalysis* analysis) {
+    size_t max_length = max_program_length(analysis->mode);
+    return PROGRAM_OFFSET + (uint32_t) (analysis->size < max_length ? analysis->size : max_length);
+}
+
+static void write_summary(const struct RomAnalysis* analysis, FILE* file) {
+    const struct AnalysisSummary* summary = &analysis->summary;
+    fprintf(file, "; %s, %zu bytes, hash %016llx\n", machine_mode_name(analysis->mode), analysis->size,
+            (unsigned long long) analysis->hash);
+    fprintf(file, "; %u code bytes in %u blocks, %u indirect jumps, %u self-modifying stores, %u unresolved stores\n",
+            summary->code_bytes, summary->blocks, summary->indirect_jumps, summary->self_modifying_stores,
+            summary->unresolved_stores);
+    fprintf(file, "; %s\n", summary->pc_confined ? "pc never leaves the code found" : "pc may leave the code found");
+}
+
+void write_disassembly(const struct RomAnalysis* analysis, const uint8_t* data, FILE* file) {
+    int digits = address_digits(analysis);
+    uint32_t end = rom_end(analysis);
+    write_summary(analysis, file);
+    uint32_t address = PROGRAM_OFFSET;
+    while (address < end) {
+        uint8_t flags = analysis->flags[address];
+        if (!(flags & ANALYSIS_CODE)) {
+            fprintf(file, "    %0*X  %-9s  db ", digits, address, "");
+            bool stored = false;
+            uint32_t count = 0;
+            do {
+                stored |= (analysis->flags[address] & ANALYSIS_STORED) != 0;
+                fprintf(file, "%s0x%02X", count ? ", " : "", data[address - PROGRAM_OFFSET]);
+                ++address;
+                ++count;
+            } while (address < end && count < DATA_BYTES_PER_LINE && !(analysis->flags[address] & ANALYSIS_CODE));
+            fprintf(file, stored ? "  ; written\n" : "\n");
+            continue;
+        }
+        if (flags & ANALYSIS_BLOCK_START) {
+            fprintf(file, "\nL%0*X:%s\n", digits, address, flags & ANALYSIS_CALL_TARGET ? "  ; subroutine" : "");
+        }
+        const uint8_t* bytes = data + address - PROGRAM_OFFSET;
+        uint16_t opcode = bytes[0] << 8 | bytes[1];
+        bool long_index = analysis->mode == MODE_XO_CHIP && opcode == LONG_INDEX_INSTRUCTION;
+        uint16_t operand = long_index ? bytes[2] << 8 | bytes[3] : 0;
+        char mnemonic[MAX_MNEMONIC_LENGTH];
+        format_instruction(analysis->mode, opcode, operand, mnemonic);
+        char encoding[16];
+        if (long_index) {
+            snprintf(encoding, sizeof(encoding), "%04X %04X", opcode, operand);
+        } else {
+            snprintf(encoding, sizeof(encoding), "%04X", opcode);
+        }
+        const char* notes[MAX_NOTES];
+        int note_count = 0;
+        if (flags & ANALYSIS_INDIRECT_JUMP) notes[note_count++] = "indirect";
+        if (flags & ANALYSIS_SELF_MODIFYING) notes[note_count++] = "stores into code";
+        if (flags & ANALYSIS_UNRESOLVED_STORE) notes[note_count++] = "stores, I unknown";
+        if ((flags | analysis->flags[address + 1]) & ANALYSIS_STORED) notes[note_count++] = "written";
+        if (!note_count) {
+            fprintf(file, "    %0*X  %-9s  %s\n", digits, address, encoding, mnemonic);
+        } else {
+            fprintf(file, "    %0*X  %-9s  %-16s  ;", digits, address, encoding, mnemonic);
+            for (int i = 0; i < note_count; ++i) {
+                fprintf(file, " %s%s", notes[i], i + 1 < note_count ? "," : "\n");
+            }
+        }
+        address += long_index ? 4 : 2;
+    }
+}
+
+static const char* const exit_names[] = {
+    [BLOCK_FALLS_THROUGH] = "falls through",
+    [BLOCK_JUMPS] = "jump",
+    [BLOCK_CALLS] = "call",
+    [BLOCK_RETURNS] = "return",
+    [BLOCK_SKIPS] = "skip",
+    [BLOCK_JUMPS_INDIRECT] = "indirect jump",
+    [BLOCK_HALTS] = "exit",
+};
+
+static bool is_instruction(const struct RomAnalysis* analysis, uint16_t address) {
+    return address < rom_end(analysis) && (analysis->flags[address] & ANALYSIS_CODE);
+}
+
+void write_cfg_dot(const struct RomAnalysis* analysis, FILE* file) {
+    int digits = address_digits(analysis);
+    bool leaves = false;
+    bool halts = false;
+    for (size_t i = 0; i < analysis->block_count; ++i) {
+        const struct BasicBlock* block = &analysis->blocks[i];
+        for (uint8_t j = 0; j < block->successor_count; ++j) {
+            leaves |= !is_instruction(analysis, block->successors[j]);
+        }
+        halts |= block->exit == BLOCK_HALTS;
+    }
+    fprintf(file, "digraph cfg {\n");
+    fprintf(file, "    node [shape=box, fontname=monospace];\n");
+    // successors that are no instruction of the ROM, computed jumps and halts share a node each
+    if (leaves) fprintf(file, "    outside [shape=octagon, label=\"outside the ROM\"];\n");
+    if (analysis->summary.indirect_jumps) fprintf(file, "    indirect [shape=diamond, label=\"BNNN\"];\n");
+    if (halts) fprintf(file, "    halt [shape=octagon, label=\"00FD\"];\n");
+    for (size_t i = 0; i < analysis->block_count; ++i) {
+        const struct BasicBlock* block = &analysis->blocks[i];
+        fprintf(file, "    L%0*X [label=\"L%0*X\\n%0*X-%0*X\\n%s\"%s];\n", digits, block->start, digits, block->start,
+                digits, block->start, digits, block->last, exit_names[block->exit],
+                analysis->flags[block->start] & ANALYSIS_CALL_TARGET ? ", peripheries=2" : "");
+        for (uint8_t j = 0; j < block->successor_count; ++j) {
+            uint16_t successor = block->successors[j];
+            const char* attributes = "";
+            if (block->exit == BLOCK_CALLS) attributes = j == 0 ? " [label=\"call\"]" : " [style=dashed]";
+            if (block->exit == BLOCK_SKIPS && j == 1) attributes = " [label=\"skip\"]";
+            if (is_instruction(analysis, successor)) {
+                fprintf(file, "    L%0*X -> L%0*X%s;\n", digits, block->start, digits, successor, attributes);
+            } else {
+                fprintf(file, "    L%0*X -> outside%s;\n", digits, block->start, attributes);
+            }
+        }
+        if (block->exit == BLOCK_JUMPS_INDIRECT) fprintf(file, "    L%0*X -> indirect;\n", digits, block->start);
+        if (block->exit == BLOCK_HALTS) fprintf(file, "    L%0*X -> halt;\n", digits, block->start);
+    }
+    fprintf(file, "}\n");
+}
+
+void delete_rom_analysis(struct RomAnalysis** analysis) {
+    if (!(*analysis)) return;
+
+    free((*analysis)->flags);
+    free((*analysis)->blocks);
+    free(*analysis);
+    *analysis = NULL;
+}
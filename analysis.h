@@ -0,0 +1,81 @@
+#ifndef CHIP_8_ANALYSIS_H
+#define CHIP_8_ANALYSIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "CHIP-8.h"
+
+// what the analysis found out about an address, one byte of flags each
+#define ANALYSIS_CODE 0x01U // a reachable instruction starts here
+#define ANALYSIS_OPERAND 0x02U // later byte of a reachable instruction
+#define ANALYSIS_BLOCK_START 0x04U
+#define ANALYSIS_CALL_TARGET 0x08U
+#define ANALYSIS_INDIRECT_JUMP 0x10U // a BNNN, where it goes depends on a register
+#define ANALYSIS_STORED 0x20U // FX33, FX55 or 5XY2 write here
+#define ANALYSIS_SELF_MODIFYING 0x40U // the instruction here stores into code
+#define ANALYSIS_UNRESOLVED_STORE 0x80U // the instruction here stores, I could not be followed
+
+// how control leaves a basic block
+enum BlockExit {
+    BLOCK_FALLS_THROUGH, // into the block behind it
+    BLOCK_JUMPS, // 1NNN
+    BLOCK_CALLS, // 2NNN, the successors are the subroutine and the return site
+    BLOCK_RETURNS, // 00EE
+    BLOCK_SKIPS, // 3XNN, 4XNN, 5XY0, 9XY0, EX9E or EXA1, the successors are the next and the skipped-to address
+    BLOCK_JUMPS_INDIRECT, // BNNN
+    BLOCK_HALTS, // 00FD
+};
+
+#define MAX_BLOCK_SUCCESSORS 2
+
+struct BasicBlock {
+    uint16_t start;
+    uint32_t end; // behind the last instruction
+    uint16_t last; // address of the last instruction
+    enum BlockExit exit;
+    uint16_t successors[MAX_BLOCK_SUCCESSORS]; // addresses that are no instruction of the ROM leave the program
+    uint8_t successor_count;
+};
+
+// the part of an analysis the ROM library caches
+struct AnalysisSummary {
+    uint32_t code_bytes;
+    uint32_t blocks;
+    uint32_t indirect_jumps;
+    uint32_t self_modifying_stores; // instructions storing into code, as far as I could be followed
+    uint32_t unresolved_stores;
+    // pc can only ever be the address of a reachable instruction: no indirect jump, no halt and no edge leaves
+    // the ROM, so the interpreter may skip its check of pc until a store hits code or the stack
+    bool pc_confined;
+};
+
+// A control flow graph of a ROM, built by following every 1NNN, 2NNN, return and skip edge from PROGRAM_OFFSET
+// the way the interpreter of the mode decodes them. Computed jumps are not followed, whatever only they lead to
+// counts as data.
+struct RomAnalysis {
+    enum MachineMode mode;
+    uint64_t hash; // hash_rom of the ROM
+    size_t size;
+    uint8_t* flags; // ANALYSIS_* of every address of the mode's memory
+    struct BasicBlock* blocks; // sorted by start
+    size_t block_count;
+    struct AnalysisSummary summary;
+};
+
+extern struct RomAnalysis* analyze_rom(const uint8_t* data, size_t size, enum MachineMode mode);
+// analyze_rom of a ROM whose hash_rom is already known, e.g. from the ROM library
+extern struct RomAnalysis* analyze_hashed_rom(const uint8_t* data, size_t size, enum MachineMode mode, uint64_t hash);
+// whether the analysis was made for this program in this mode
+extern bool analysis_covers(const struct RomAnalysis* analysis, enum MachineMode mode, const uint8_t* data,
+                            size_t size);
+extern bool analysis_covers_hashed(const struct RomAnalysis* analysis, enum MachineMode mode, size_t size,
+                                   uint64_t hash);
+// one line per instruction or up to eight data bytes, labels at block starts, data is the analyzed ROM
+extern void write_disassembly(const struct RomAnalysis* analysis, const uint8_t* data, FILE* file);
+// the graph in Graphviz dot format, one node per basic block
+extern void write_cfg_dot(const struct RomAnalysis* analysis, FILE* file);
+extern void delete_rom_analysis(struct RomAnalysis** analysis);
+
+#endif //CHIP_8_ANALYSIS_H
@@ -0,0 +1,117 @@
+#include "audio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define PATTERN_BITS (AUDIO_PATTERN_BYTES * 8)
+#define PATTERN_BASE_RATE 4000.0 // bits per second at pitch 64
+
+// 500 Hz at the default pitch for the modes without a pattern buffer
+static const uint8_t buzzer_pattern[AUDIO_PATTERN_BYTES] = {
+        0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0,
+};
+
+struct AudioRing* create_audio_ring() {
+    struct AudioRing* ring = aligned_alloc(64, sizeof(struct AudioRing));
+    if (!ring) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ring, 0, sizeof(struct AudioRing));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring;
+}
+
+void queue_audio_ticks(struct AudioRing* ring, const struct MachineState* state, uint64_t ticks) {
+    // a longer gap would only be dropped
+    if (ticks > AUDIO_RING_CAPACITY) {
+        ring->pushed += ticks - AUDIO_RING_CAPACITY;
+        ring->dropped += ticks - AUDIO_RING_CAPACITY;
+        ticks = AUDIO_RING_CAPACITY;
+    }
+    const uint8_t* pattern = state->mode == MODE_XO_CHIP ? state->audio_pattern : buzzer_pattern;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    for (uint64_t i = 0; i < ticks; ++i) {
+        ring->pushed++;
+        if (head - tail == AUDIO_RING_CAPACITY) {
+            ring->dropped++;
+            continue;
+        }
+        struct AudioTick* tick = &ring->ticks[head & (AUDIO_RING_CAPACITY - 1)];
+        // the timer counts down by one per tick
+        tick->on = state->rf.sound_timer > i;
+        tick->pitch = state->audio_pitch;
+        memcpy(tick->pattern, pattern, AUDIO_PATTERN_BYTES);
+        ++head;
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+}
+
+bool pop_audio_tick(struct AudioRing* ring, struct AudioTick* tick) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) return false;
+    *tick = ring->ticks[tail & (AUDIO_RING_CAPACITY - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void delete_audio_ring(struct AudioRing** ring) {
+    if (!(*ring)) return;
+
+    free(*ring);
+    *ring = NULL;
+}
+
+void init_audio_synth(struct AudioSynth* synth, struct AudioRing* ring, uint32_t max_queued) {
+    memset(synth, 0, sizeof(struct AudioSynth));
+    synth->ring = ring;
+    synth->max_queued = max_queued;
+}
+
+// samples of the current tick, the pattern keeps its position across ticks so a held tone has no seams
+static void play_samples(struct AudioSynth* synth, int16_t* samples, size_t count) {
+    const struct AudioTick* tick = &synth->tick;
+    if (!tick->on) {
+        memset(samples, 0, count * sizeof(int16_t));
+        return;
+    }
+    double step = PATTERN_BASE_RATE * pow(2.0, (tick->pitch - 64) / 48.0) / AUDIO_SAMPLE_RATE;
+    double position = synth->position;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned bit = (unsigned) position;
+        bool high = (tick->pattern[bit / 8] >> (7 - bit % 8)) & 1U;
+        samples[i] = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+        position += step;
+        if (position >= PATTERN_BITS) position -= PATTERN_BITS;
+    }
+    synth->position = position;
+}
+
+void synthesize_audio(struct AudioSynth* synth, int16_t* samples, size_t count) {
+    while (count > 0) {
+        if (synth->tick_samples_left == 0) {
+            struct AudioRing* ring = synth->ring;
+            if (synth->max_queued) {
+                uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+                uint64_t queued = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+                if (queued > synth->max_queued) {
+                    atomic_store_explicit(&ring->tail, tail + queued - synth->max_queued, memory_order_release);
+                }
+            }
+            // on underflow the last tick goes on, the machine is only late
+            pop_audio_tick(ring, &synth->tick);
+            synth->tick_samples_left = AUDIO_SAMPLES_PER_TICK;
+        }
+        size_t chunk = count < synth->tick_samples_left ? count : synth->tick_samples_left;
+        play_samples(synth, samples, chunk);
+        synth->tick_samples_left -= chunk;
+        samples += chunk;
+        count -= chunk;
+    }
+}
+
+void render_audio_tick(struct AudioSynth* synth, const struct AudioTick* tick, int16_t* samples) {
+    synth->tick = *tick;
+    play_samples(synth, samples, AUDIO_SAMPLES_PER_TICK);
+}
@@ -0,0 +1,56 @@
+#ifndef CHIP_8_AUDIO_H
+#define CHIP_8_AUDIO_H
+
+#include "CHIP-8.h"
+#include <stdatomic.h>
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_SAMPLES_PER_TICK (AUDIO_SAMPLE_RATE / FRAME_RATE)
+#define AUDIO_PATTERN_BYTES 16
+#define AUDIO_RING_CAPACITY 256U // ticks, a power of two
+#define AUDIO_VOLUME 4000
+
+// What the beeper does for one 60 Hz timer tick. Every mode plays a 1 bit pattern at 4000 * 2^((pitch - 64) / 48)
+// bits per second: XO-CHIP the one loaded by F002, the others a fixed square wave.
+struct AudioTick {
+    bool on; // sound_timer was running during the tick
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_BYTES];
+};
+
+// The machine pushes one AudioTick per tick into a lock-free single producer, single consumer ring and the audio
+// thread pulls them as it needs samples, so neither ever waits for the other. Ticks are dropped rather than
+// stalling the machine when the consumer falls behind.
+struct AudioRing {
+    // written by the machine only
+    _Alignas(64) atomic_uint_fast64_t head;
+    uint64_t pushed;
+    uint64_t dropped;
+    // written by the consumer only
+    _Alignas(64) atomic_uint_fast64_t tail;
+    struct AudioTick ticks[AUDIO_RING_CAPACITY];
+};
+
+// turns ticks into signed 16 bit mono samples at AUDIO_SAMPLE_RATE
+struct AudioSynth {
+    struct AudioRing* ring;
+    struct AudioTick tick; // playing
+    uint32_t tick_samples_left;
+    uint32_t max_queued; // older ticks are skipped to keep the latency down, 0 keeps every tick
+    double position; // in bits of the pattern
+};
+
+extern struct AudioRing* create_audio_ring();
+// called by tick_timers before the timers are decremented, pushes what the beeper does for each of the ticks
+extern void queue_audio_ticks(struct AudioRing* ring, const struct MachineState* state, uint64_t ticks);
+extern bool pop_audio_tick(struct AudioRing* ring, struct AudioTick* tick);
+extern void delete_audio_ring(struct AudioRing** ring);
+
+extern void init_audio_synth(struct AudioSynth* synth, struct AudioRing* ring, uint32_t max_queued);
+// for a real time device: takes the next tick whenever the current one has played, keeps playing the last one
+// while the ring is empty
+extern void synthesize_audio(struct AudioSynth* synth, int16_t* samples, size_t count);
+// exactly AUDIO_SAMPLES_PER_TICK samples of tick, without touching the ring
+extern void render_audio_tick(struct AudioSynth* synth, const struct AudioTick* tick, int16_t* samples);
+
+#endif //CHIP_8_AUDIO_H
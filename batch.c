@@ -0,0 +1,214 @@
+#include "batch.h"
+#include "timer.h"
+#include "rom.h"
+#include "analysis.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Every worker owns a contiguous slice of the jobs and takes from its front. A worker that ran out steals from
+// the back of another worker's slice, so long running ROMs don't leave the other cores idle.
+struct WorkQueue {
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+};
+
+struct Batch {
+    struct BatchJob* jobs;
+    const struct BatchOptions* options;
+    struct WorkQueue* queues;
+    unsigned queue_count;
+    struct MachinePool* machines; // one per worker, reset between jobs
+};
+
+struct Worker {
+    pthread_t thread;
+    struct Batch* batch;
+    unsigned index;
+};
+
+#define NO_JOB SIZE_MAX
+
+static size_t take_job(struct Batch* batch, unsigned index) {
+    struct WorkQueue* own = &batch->queues[index];
+    size_t job = NO_JOB;
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) job = own->head++;
+    pthread_mutex_unlock(&own->lock);
+
+    // no job creates new ones, so a single pass over the other queues finding nothing means the batch is done
+    for (unsigned i = 1; job == NO_JOB && i < batch->queue_count; ++i) {
+        struct WorkQueue* victim = &batch->queues[(index + i) % batch->queue_count];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) job = --victim->tail;
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+static void run_job(struct BatchJob* job, const struct BatchOptions* options, struct MachineState* state) {
+    struct Rom rom;
+    job->loaded = map_rom(job->path, &rom);
+    if (!job->loaded) return;
+    // every ROM runs in the mode its instructions call for, the index entry is only trusted while the size matches
+    bool indexed = job->indexed && job->size == rom.size;
+    enum QuirksProfile detected = indexed ? job->detected_quirks : detect_quirks_profile(rom.data, rom.size);
+    enum MachineMode mode = quirks_profile_mode(detected);
+    if (rom.size > max_program_length(mode)) {
+        job->loaded = false;
+        unmap_rom(&rom);
+        return;
+    }
+
+    set_machine_mode(state, mode);
+    if (job->quirks_given) set_quirks_profile(state, job->quirks);
+    state->engine = options->engine;
+    state->instructions_per_frame = options->instructions_per_frame;
+    seed_random(state, job->seed);
+    // the analysis only serves to confine pc, an indexed ROM the library found unconfinable goes without
+    struct RomAnalysis* analysis = NULL;
+    if (!indexed) {
+        analysis = analyze_rom(rom.data, rom.size, mode);
+    } else if (job->pc_confined) {
+        analysis = analyze_hashed_rom(rom.data, rom.size, mode, job->hash);
+    }
+    state->analysis = analysis;
+    if (indexed) {
+        load_hashed_program(state, rom.data, rom.size, job->hash);
+    } else {
+        load_program(state, rom.data, rom.size);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->cycles = run_headless(state, options->max_cycles);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->elapsed_ns = nanoseconds_between(&start, &end);
+    job->screen_hash = hash_screen(&state->screen);
+    job->stack_fault = state->stack_fault;
+    // the next job resets the machine before it stores anything
+    state->analysis = NULL;
+    delete_rom_analysis(&analysis);
+    unmap_rom(&rom);
+}
+
+static void* run_worker(void* data) {
+    struct Worker* worker = data;
+    struct MachineState* state = pool_machine(worker->batch->machines, worker->index);
+    size_t job;
+    while ((job = take_job(worker->batch, worker->index)) != NO_JOB) {
+        run_job(&worker->batch->jobs[job], worker->batch->options, state);
+    }
+    return NULL;
+}
+
+void run_batch(struct BatchJob* jobs, size_t job_count, const struct BatchOptions* options) {
+    unsigned threads = options->threads ? options->threads : 1;
+    if (threads > job_count) threads = job_count ? job_count : 1;
+
+    // the machines never present or poll, so they can share a frontend
+    struct Frontend* frontend = create_null_frontend();
+    struct Batch batch = {jobs, options, calloc(threads, sizeof(struct WorkQueue)), threads,
+                          create_machine_pool(threads, frontend)};
+    struct Worker* workers = calloc(threads, sizeof(struct Worker));
+    if (!batch.queues || !workers) {
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head = job_count * i / threads;
+        batch.queues[i].tail = job_count * (i + 1) / threads;
+    }
+    // the calling thread works as worker 0
+    for (unsigned i = 0; i < threads; ++i) {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        if (i > 0 && pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start a batch worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run_worker(&workers[0]);
+    for (unsigned i = 1; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free(workers);
+    free(batch.queues);
+    delete_machine_pool(&batch.machines);
+    delete_frontend(&frontend);
+}
+
+static void append_job(struct BatchJob** jobs, size_t* count, size_t* capacity, const struct BatchJob* job) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *jobs = realloc(*jobs, *capacity * sizeof(struct BatchJob));
+        if (!(*jobs)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*jobs)[(*count)++] = *job;
+}
+
+struct BatchJob* collect_batch_jobs(const char* path, size_t* count) {
+    struct BatchJob* jobs = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        fprintf(stderr, "File not found.");
+        exit(EXIT_FAILURE);
+    }
+    if (S_ISDIR(info.st_mode)) {
+        // the library index already knows which files are loadable and what they are, none of them has to be
+        // opened here
+        struct RomLibrary* library = open_rom_library(path);
+        for (size_t i = 0; i < library->count; ++i) {
+            const struct RomInfo* rom = &library->roms[i];
+            if (!rom->valid) continue;
+            struct BatchJob job = {0};
+            job.path = strdup(rom->path);
+            job.indexed = true;
+            job.size = rom->size;
+            job.hash = rom->hash;
+            job.detected_quirks = rom->quirks;
+            job.pc_confined = rom->analysis.pc_confined;
+            append_job(&jobs, count, &capacity, &job);
+        }
+        delete_rom_library(&library);
+        return jobs;
+    }
+
+    FILE* list = fopen(path, "r");
+    if (!list) {
+        fprintf(stderr, "File not found.");
+        exit(EXIT_FAILURE);
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, list)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+        if (length == 0) continue;
+        struct BatchJob job = {0};
+        job.path = strdup(line);
+        append_job(&jobs, count, &capacity, &job);
+    }
+    free(line);
+    fclose(list);
+    return jobs;
+}
+
+void free_batch_jobs(struct BatchJob* jobs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free(jobs[i].path);
+    }
+    free(jobs);
+}
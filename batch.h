@@ -0,0 +1,40 @@
+#ifndef CHIP_8_BATCH_H
+#define CHIP_8_BATCH_H
+
+#include "CHIP-8.h"
+
+struct BatchJob {
+    char* path;
+    uint32_t seed; // for CXNN
+    bool quirks_given; // otherwise the default profile of the detected mode
+    enum QuirksProfile quirks;
+    // taken from the ROM library index for jobs of a directory, run_job then doesn't detect the mode again
+    bool indexed;
+    uint64_t size;
+    uint64_t hash; // hash_rom of the contents
+    enum QuirksProfile detected_quirks;
+    bool pc_confined; // of the index's analysis summary, the ROM isn't analyzed again if it can't be confined
+
+    // filled in by run_batch
+    bool loaded;
+    bool stack_fault; // the program overflowed or underflowed its stack and was halted there
+    uint64_t screen_hash; // hash_screen of the final framebuffer
+    uint64_t cycles;
+    int64_t elapsed_ns;
+};
+
+struct BatchOptions {
+    enum ExecutionEngine engine;
+    uint32_t instructions_per_frame;
+    uint64_t max_cycles; // per ROM
+    unsigned threads;
+};
+
+// runs every job in its own headless machine, spread over a pool of worker threads
+extern void run_batch(struct BatchJob* jobs, size_t job_count, const struct BatchOptions* options);
+// one job per loadable file of a directory's ROM library (sorted by name, with what the index knows about them)
+// or per line of a list file, the caller sets the seed and quirks and frees the result
+extern struct BatchJob* collect_batch_jobs(const char* path, size_t* count);
+extern void free_batch_jobs(struct BatchJob* jobs, size_t count);
+
+#endif //CHIP_8_BATCH_H
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "CHIP-8.h"
+#include "batch.h"
+#include "timer.h"
+#include "rom.h"
+#include "wide.h"
+
+#define DEFAULT_BENCH_CYCLES 5000000
+#define DEFAULT_BENCH_REPEATS 7
+#define DEFAULT_BENCH_TOLERANCE 5.0 // percent
+#define DEFAULT_WIDE_LANES 256
+#define MAX_BASELINE_ENTRIES 256
+#define MAX_NAME_LEN 256
+
+// Synthetic programs that loop forever and are dominated by a single opcode family. They only touch memory
+// above 0x300 and never wait on timers or keys, so every engine executes exactly the requested cycle count.
+struct Kernel {
+    const char* name;
+    const uint8_t* program;
+    size_t size;
+};
+
+static const uint8_t alu_kernel[] = {
+    0x60, 0x01, // V0 = 1
+    0x61, 0x03, // V1 = 3
+    0x80, 0x14, // V0 += V1
+    0x81, 0x02, // V1 &= V0
+    0x82, 0x03, // V2 ^= V0
+    0x83, 0x16, // V3 = V1 >> 1
+    0x74, 0x05, // V4 += 5
+    0x81, 0x25, // V1 -= V2
+    0x12, 0x04, // jump 0x204
+};
+
+static const uint8_t jump_kernel[] = {
+    0x60, 0x02, // V0 = 2
+    0x12, 0x04, // jump 0x204
+    0x12, 0x06, // jump 0x206
+    0xb2, 0x00, // jump 0x200 + V0
+};
+
+// the skipped instructions are harmless loads, so taken and not taken skips both keep looping
+static const uint8_t skip_kernel[] = {
+    0x60, 0x00, // V0 = 0
+    0x30, 0x00, // skip if V0 == 0
+    0x60, 0x00,
+    0x40, 0x01, // skip if V0 != 1
+    0x60, 0x00,
+    0x50, 0x10, // V0 vs V1
+    0x60, 0x00,
+    0x90, 0x10, // V0 vs V1
+    0x60, 0x00,
+    0xe0, 0xa1, // skip if key V0 is up
+    0x60, 0x00,
+    0x12, 0x02, // jump 0x202
+};
+
+static const uint8_t call_kernel[] = {
+    0x22, 0x06, // call 0x206
+    0x12, 0x00, // jump 0x200
+    0x00, 0x00,
+    0x22, 0x0a, // call 0x20a
+    0x00, 0xee, // return
+    0x00, 0xee, // return
+};
+
+static const uint8_t draw_kernel[] = {
+    0x60, 0x00, // V0 = 0
+    0xf0, 0x29, // I = font character V0
+    0xd0, 0x15, // draw at V0, V1
+    0xd1, 0x25, // draw at V1, V2
+    0xd2, 0x15, // draw at V2, V1
+    0x71, 0x03, // V1 += 3
+    0x72, 0x05, // V2 += 5
+    0x12, 0x04, // jump 0x204
+};
+
+static const uint8_t memory_kernel[] = {
+    0xa3, 0x00, // I = 0x300
+    0xf0, 0x1e, // I += V0
+    0xf3, 0x55, // store V0 - V3
+    0xf3, 0x65, // load V0 - V3
+    0xf0, 0x33, // BCD of V0
+    0x70, 0x01, // V0 += 1
+    0x12, 0x00, // jump 0x200
+};
+
+// roughly what a game loop looks like: some arithmetic, a few draws, a subroutine and branches
+static const uint8_t mixed_kernel[] = {
+    0x60, 0x00, // V0 = 0
+    0x61, 0x00, // V1 = 0
+    0xf2, 0x29, // I = font character V2
+    0xd0, 0x15, // draw at V0, V1
+    0x22, 0x18, // call 0x218
+    0x70, 0x01, // V0 += 1
+    0x30, 0x40, // skip if V0 == 0x40
+    0x12, 0x04, // jump 0x204
+    0x71, 0x01, // V1 += 1
+    0x60, 0x00, // V0 = 0
+    0x12, 0x04, // jump 0x204
+    0x00, 0x00,
+    0x82, 0x04, // V2 += V0
+    0x83, 0x26, // V3 = V2 >> 1
+    0x00, 0xee, // return
+};
+
+#define KERNEL(name, program) {name, program, sizeof(program)}
+
+static const struct Kernel kernels[] = {
+    KERNEL("alu", alu_kernel),
+    KERNEL("jump", jump_kernel),
+    KERNEL("skip", skip_kernel),
+    KERNEL("call", call_kernel),
+    KERNEL("draw", draw_kernel),
+    KERNEL("memory", memory_kernel),
+    KERNEL("mixed", mixed_kernel),
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+// the execution engines, then the lockstep lanes of wide.h with one row for all lanes together
+#define BENCH_WIDE 3
+#define BENCH_ENGINES 4
+
+static const char* const engine_names[BENCH_ENGINES] = {"interpreter", "predecoded", "jit", "wide"};
+
+struct BenchOptions {
+    uint64_t cycles;
+    unsigned repeats;
+    uint32_t instructions_per_frame;
+    bool engines[BENCH_ENGINES];
+    const char* kernel; // NULL runs all of them
+    size_t wide_lanes;
+};
+
+struct BenchResult {
+    uint64_t cycles; // per repetition, less than requested if a ROM halted or waited for a key
+    double median_ns; // per instruction
+    double min_ns;
+    double relative_deviation; // median absolute deviation relative to the median, in percent
+};
+
+struct BaselineEntry {
+    char name[MAX_NAME_LEN];
+    char engine[16];
+    double ns_per_instruction;
+};
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static double median(double* values, unsigned count) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// every lane gets its own seed, cycles counts the instructions of all lanes
+static int64_t time_wide_run(const uint8_t* program, size_t size, const struct BenchOptions* options, uint64_t* cycles) {
+    struct WideMachines* wide = create_wide_machines(options->wide_lanes, program, size);
+    wide->instructions_per_frame = options->instructions_per_frame;
+    for (size_t lane = 0; lane < options->wide_lanes; ++lane) {
+        seed_wide_lane(wide, lane, (uint32_t) lane + 1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *cycles = 0;
+    while (*cycles < options->cycles) {
+        uint64_t executed = run_wide_frame(wide);
+        // every lane halted or waits for a key
+        if (executed == 0) break;
+        *cycles += executed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    delete_wide_machines(&wide);
+    return nanoseconds_between(&start, &end);
+}
+
+// a fresh machine per repetition, only the execution itself is timed
+static int64_t time_run(const uint8_t* program, size_t size, int engine, bool rom,
+                        const struct BenchOptions* options, uint64_t* cycles) {
+    if (engine == BENCH_WIDE) return time_wide_run(program, size, options, cycles);
+    struct Frontend* frontend = create_null_frontend();
+    struct MachineState* state = create_machine(frontend);
+    state->engine = engine;
+    state->instructions_per_frame = options->instructions_per_frame;
+    load_program(state, (uint8_t*) program, size);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // kernels never touch the timers, ROMs run in emulated time like in a batch
+    *cycles = rom ? run_headless(state, options->cycles) : run_cycles(state, options->cycles);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    delete_machine(&state);
+    delete_frontend(&frontend);
+    return nanoseconds_between(&start, &end);
+}
+
+static struct BenchResult run_bench(const uint8_t* program, size_t size, int engine, bool rom,
+                                    const struct BenchOptions* options) {
+    struct BenchResult result = {0};
+    double samples[options->repeats];
+    double deviations[options->repeats];
+    // one untimed warm up run for the caches and the branch predictors
+    time_run(program, size, engine, rom, options, &result.cycles);
+    for (unsigned i = 0; i < options->repeats; ++i) {
+        int64_t elapsed = time_run(program, size, engine, rom, options, &result.cycles);
+        samples[i] = result.cycles ? (double) elapsed / (double) result.cycles : 0;
+    }
+    result.median_ns = median(samples, options->repeats);
+    result.min_ns = samples[0]; // median sorted them
+    for (unsigned i = 0; i < options->repeats; ++i) {
+        deviations[i] = fabs(samples[i] - result.median_ns);
+    }
+    result.relative_deviation = result.median_ns > 0 ? median(deviations, options->repeats) / result.median_ns * 100 : 0;
+    return result;
+}
+
+static size_t load_baseline(const char* path, struct BaselineEntry* entries) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "File not found.");
+        exit(EXIT_FAILURE);
+    }
+    size_t count = 0;
+    while (count < MAX_BASELINE_ENTRIES &&
+           fscanf(file, "%255s %15s %lf", entries[count].name, entries[count].engine, &entries[count].ns_per_instruction) == 3) {
+        ++count;
+    }
+    fclose(file);
+    return count;
+}
+
+static const struct BaselineEntry* find_baseline(const struct BaselineEntry* entries, size_t count, const char* name, const char* engine) {
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(entries[i].name, name) == 0 && strcmp(entries[i].engine, engine) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+// prints one row and compares it against the baseline, returns false on a regression
+// with a baseline, the predecoded and JIT engines also regress if they are slower than interpreter, the result of
+// the reference interpreter for the same workload, since that holds on any host
+static bool report(const char* name, int engine, const struct BenchResult* result, FILE* save,
+                   const struct BaselineEntry* baseline, size_t baseline_count, double tolerance,
+                   const struct BenchResult* interpreter) {
+    double mips = result->median_ns > 0 ? 1000 / result->median_ns : 0;
+    printf("%-24s %-12s %12llu %10.2f %10.3f %10.3f %7.2f%%", name, engine_names[engine],
+           (unsigned long long) result->cycles, mips, result->median_ns, result->min_ns, result->relative_deviation);
+    if (save) fprintf(save, "%s %s %.6f\n", name, engine_names[engine], result->median_ns);
+
+    bool ok = true;
+    const struct BaselineEntry* entry = find_baseline(baseline, baseline_count, name, engine_names[engine]);
+    if (entry && entry->ns_per_instruction > 0) {
+        double change = (result->median_ns / entry->ns_per_instruction - 1) * 100;
+        ok = change <= tolerance;
+        printf(" %+7.2f%%%s", change, ok ? "" : " REGRESSION");
+    }
+    if (baseline_count && interpreter && interpreter->median_ns > 0 && engine != ENGINE_INTERPRETER &&
+        engine != BENCH_WIDE && (result->median_ns / interpreter->median_ns - 1) * 100 > tolerance) {
+        printf(" SLOWER THAN INTERPRETER");
+        ok = false;
+    }
+    printf("\n");
+    return ok;
+}
+
+static void print_usage() {
+    printf("Usage:\n\ncrispychip-bench [--engine interpreter | predecoded | jit | wide | all] [--wide <lanes>] "
+           "[--cycles <per run>] "
+           "[--repeats <count>] [--ipf <instructions per frame>] [--kernel <name>] [--save <file>] "
+           "[--baseline <file>] [--tolerance <percent>] [ROM...]\n\nKernels:");
+    for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+        printf(" %s", kernels[i].name);
+    }
+    printf("\n\n");
+}
+
+int main(int argc, char** argv) {
+    struct BenchOptions options = {DEFAULT_BENCH_CYCLES, DEFAULT_BENCH_REPEATS, DEFAULT_INSTRUCTIONS_PER_FRAME, {true, true, true, false}, NULL, DEFAULT_WIDE_LANES};
+    const char* save_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = DEFAULT_BENCH_TOLERANCE;
+    int arg = 1;
+    for (; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--engine") == 0 && arg + 1 < argc) {
+            const char* engine = argv[++arg];
+            bool all = strcmp(engine, "all") == 0;
+            bool known = all;
+            for (int i = 0; i < BENCH_ENGINES; ++i) {
+                options.engines[i] = all || strcmp(engine, engine_names[i]) == 0;
+                known = known || options.engines[i];
+            }
+            if (!known) break;
+        } else if (strcmp(argv[arg], "--wide") == 0 && arg + 1 < argc) {
+            options.wide_lanes = strtoull(argv[++arg], NULL, 10);
+            options.engines[BENCH_WIDE] = true;
+        } else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc) {
+            options.cycles = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--repeats") == 0 && arg + 1 < argc) {
+            options.repeats = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc) {
+            options.instructions_per_frame = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--kernel") == 0 && arg + 1 < argc) {
+            options.kernel = argv[++arg];
+        } else if (strcmp(argv[arg], "--save") == 0 && arg + 1 < argc) {
+            save_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--baseline") == 0 && arg + 1 < argc) {
+            baseline_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--tolerance") == 0 && arg + 1 < argc) {
+            tolerance = strtod(argv[++arg], NULL);
+        } else if (strncmp(argv[arg], "--", 2) == 0) {
+            break;
+        } else {
+            continue; // a ROM
+        }
+    }
+    if (arg < argc || options.repeats == 0 || options.cycles == 0 || options.wide_lanes == 0) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    struct BaselineEntry* baseline = calloc(MAX_BASELINE_ENTRIES, sizeof(struct BaselineEntry));
+    if (!baseline) {
+        exit(EXIT_FAILURE);
+    }
+    size_t baseline_count = baseline_path ? load_baseline(baseline_path, baseline) : 0;
+    FILE* save = NULL;
+    if (save_path && (save = fopen(save_path, "w")) == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", save_path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-24s %-12s %12s %10s %10s %10s %8s\n", "workload", "engine", "cycles", "MIPS", "ns/instr", "min", "mad");
+    bool ok = true;
+    for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+        if (options.kernel && strcmp(options.kernel, kernels[i].name) != 0) continue;
+        struct BenchResult interpreter = {0};
+        for (int engine = 0; engine < BENCH_ENGINES; ++engine) {
+            if (!options.engines[engine]) continue;
+            struct BenchResult result = run_bench(kernels[i].program, kernels[i].size, engine, false, &options);
+            if (engine == ENGINE_INTERPRETER) interpreter = result;
+            ok = report(kernels[i].name, engine, &result, save, baseline, baseline_count, tolerance, &interpreter) && ok;
+        }
+    }
+    for (arg = 1; arg < argc; ++arg) {
+        // skip the options and their values
+        if (strncmp(argv[arg], "--", 2) == 0) {
+            ++arg;
+            continue;
+        }
+        struct Rom rom;
+        if (!map_rom(argv[arg], &rom)) {
+            fprintf(stderr, "Could not load %s.\n", argv[arg]);
+            continue;
+        }
+        struct BenchResult interpreter = {0};
+        for (int engine = 0; engine < BENCH_ENGINES; ++engine) {
+            if (!options.engines[engine]) continue;
+            struct BenchResult result = run_bench(rom.data, rom.size, engine, true, &options);
+            if (engine == ENGINE_INTERPRETER) interpreter = result;
+            ok = report(argv[arg], engine, &result, save, baseline, baseline_count, tolerance, &interpreter) && ok;
+        }
+        unmap_rom(&rom);
+    }
+
+    if (save) fclose(save);
+    free(baseline);
+    return ok ? 0 : EXIT_FAILURE;
+}
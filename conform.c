@@ -0,0 +1,858 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CHIP-8.h"
+#include "timer.h"
+#include "rom.h"
+#include "snapshot.h"
+#include "wide.h"
+
+#define DEFAULT_CONFORM_CYCLES 100000 // per ROM
+#define UNIT_CYCLES 200 // every unit is done long before and spins in its final jump
+#define MAX_GOLDEN_ENTRIES 1024
+#define MAX_NAME_LEN 256
+#define NO_INDEX (-1)
+#define V(n) (1U << (n))
+
+// Programs testing one instruction each with the default quirks of their mode. They end in a jump to itself, by
+// then the registers selected by checked hold expected and I holds index unless it is NO_INDEX.
+struct Unit {
+    const char* name;
+    const uint8_t* program;
+    size_t size;
+    enum MachineMode mode;
+    uint16_t checked; // V(n) compares Vn
+    int32_t index;
+    uint8_t expected[16];
+    bool memory_stack; // stores into its stack slots, the wide engine keeps its stack apart from memory
+};
+
+// draws, clears and draws again, which collides only if the clear did not happen
+static const uint8_t clear_unit[] = {
+    0xf0, 0x29, // I = font character V0
+    0xd0, 0x05, // draw at V0, V0
+    0x00, 0xe0, // clear
+    0xd0, 0x05,
+    0x12, 0x08,
+};
+
+static const uint8_t call_return_unit[] = {
+    0x22, 0x06, // call 0x206
+    0x61, 0x02, // V1 = 2
+    0x12, 0x04,
+    0x60, 0x01, // V0 = 1
+    0x00, 0xee, // return
+};
+
+// the return address is overwritten with zeros, the machine halts on the return instead of jumping anywhere
+static const uint8_t stack_overwrite_unit[] = {
+    0x22, 0x06, // call 0x206
+    0x61, 0x01, // V1 = 1, never executed
+    0x12, 0x04,
+    0xae, 0xa0, // I = 0xEA0, the first stack slot
+    0xf7, 0x55, // store V0 - V7 over it
+    0x00, 0xee, // return
+};
+
+// 0NNN would run machine code of the original host and is ignored
+static const uint8_t system_unit[] = {
+    0x01, 0x23, // SYS 0x123
+    0x61, 0x01, // V1 = 1
+    0x12, 0x04,
+};
+
+static const uint8_t jump_unit[] = {
+    0x12, 0x04, // jump 0x204
+    0x60, 0x01, // V0 = 1, jumped over
+    0x61, 0x02, // V1 = 2
+    0x12, 0x06,
+};
+
+static const uint8_t skip_eq_imm_unit[] = {
+    0x60, 0x05, // V0 = 5
+    0x30, 0x05, // skip if V0 == 5
+    0x61, 0x01, // skipped
+    0x30, 0x06, // skip if V0 == 6
+    0x62, 0x01, // executed
+    0x12, 0x0a,
+};
+
+static const uint8_t skip_neq_imm_unit[] = {
+    0x60, 0x05, // V0 = 5
+    0x40, 0x05, // skip if V0 != 5
+    0x61, 0x01, // executed
+    0x40, 0x06, // skip if V0 != 6
+    0x62, 0x01, // skipped
+    0x12, 0x0a,
+};
+
+static const uint8_t skip_eq_reg_unit[] = {
+    0x60, 0x05, // V0 = 5
+    0x61, 0x05, // V1 = 5
+    0x62, 0x06, // V2 = 6
+    0x50, 0x10, // skip if V0 == V1
+    0x63, 0x01, // skipped
+    0x50, 0x20, // skip if V0 == V2
+    0x64, 0x01, // executed
+    0x12, 0x0e,
+};
+
+static const uint8_t skip_neq_reg_unit[] = {
+    0x60, 0x05, // V0 = 5
+    0x61, 0x05, // V1 = 5
+    0x62, 0x06, // V2 = 6
+    0x90, 0x10, // skip if V0 != V1
+    0x63, 0x01, // executed
+    0x90, 0x20, // skip if V0 != V2
+    0x64, 0x01, // skipped
+    0x12, 0x0e,
+};
+
+static const uint8_t set_imm_unit[] = {
+    0x6a, 0x42, // VA = 0x42
+    0x12, 0x02,
+};
+
+// no carry into VF
+static const uint8_t add_imm_unit[] = {
+    0x60, 0xff, // V0 = 0xff
+    0x70, 0x02, // V0 += 2
+    0x12, 0x04,
+};
+
+static const uint8_t load_unit[] = {
+    0x61, 0x42, // V1 = 0x42
+    0x80, 0x10, // V0 = V1
+    0x12, 0x04,
+};
+
+static const uint8_t or_unit[] = {
+    0x60, 0xf0,
+    0x61, 0x0f,
+    0x80, 0x11, // V0 |= V1
+    0x12, 0x06,
+};
+
+static const uint8_t and_unit[] = {
+    0x60, 0xf3,
+    0x61, 0x3c,
+    0x80, 0x12, // V0 &= V1
+    0x12, 0x06,
+};
+
+static const uint8_t xor_unit[] = {
+    0x60, 0xff,
+    0x61, 0x0f,
+    0x80, 0x13, // V0 ^= V1
+    0x12, 0x06,
+};
+
+static const uint8_t add_unit[] = {
+    0x60, 0xff,
+    0x61, 0x02,
+    0x80, 0x14, // V0 += V1, carries
+    0x62, 0x01,
+    0x82, 0x24, // V2 += V2, does not
+    0x12, 0x0a,
+};
+
+static const uint8_t subtract_unit[] = {
+    0x60, 0x05,
+    0x61, 0x03,
+    0x80, 0x15, // V0 -= V1, no borrow
+    0x62, 0x03,
+    0x63, 0x05,
+    0x82, 0x35, // V2 -= V3, borrows
+    0x84, 0xf0, // V4 = VF
+    0x12, 0x0e,
+};
+
+static const uint8_t right_shift_unit[] = {
+    0x60, 0x05,
+    0x80, 0x06, // V0 >>= 1
+    0x12, 0x04,
+};
+
+static const uint8_t subtract_n_unit[] = {
+    0x60, 0x03,
+    0x61, 0x05,
+    0x80, 0x17, // V0 = V1 - V0
+    0x12, 0x06,
+};
+
+static const uint8_t left_shift_unit[] = {
+    0x60, 0x81,
+    0x80, 0x0e, // V0 <<= 1
+    0x12, 0x04,
+};
+
+static const uint8_t set_index_unit[] = {
+    0xa1, 0x23, // I = 0x123
+    0x12, 0x02,
+};
+
+// jumps to 0x206 + V0 = 0x20a
+static const uint8_t jump_offset_unit[] = {
+    0x60, 0x04,
+    0xb2, 0x06,
+    0x61, 0x01,
+    0x61, 0x01,
+    0x61, 0x01,
+    0x62, 0x02, // V2 = 2
+    0x12, 0x0c,
+};
+
+// jumps to 0xf87 + 0x9c = 0x1023, past the end of memory, which halts the machine instead of spinning in a jump;
+// V0 and VF are both set so the jump quirk does not matter
+static const uint8_t jump_offset_past_memory_unit[] = {
+    0x60, 0x9c,
+    0x6f, 0x9c,
+    0xbf, 0x87,
+};
+
+// whatever the random number is, it is masked away
+static const uint8_t random_unit[] = {
+    0x60, 0xff,
+    0xc0, 0x00, // V0 = random & 0
+    0x12, 0x04,
+};
+
+// the second draw erases the first one
+static const uint8_t draw_unit[] = {
+    0xf0, 0x29, // I = font character V0
+    0xd0, 0x05, // draw at V0, V0
+    0x6e, 0x00, // VF = 0
+    0xd0, 0x05,
+    0x12, 0x08,
+};
+
+static const uint8_t skip_key_unit[] = {
+    0x60, 0x05, // V0 = 5, no key is down
+    0xe0, 0x9e, // skip if key V0 is down
+    0x61, 0x01, // executed
+    0xe0, 0xa1, // skip if key V0 is up
+    0x62, 0x01, // skipped
+    0x12, 0x0a,
+};
+
+static const uint8_t delay_timer_unit[] = {
+    0x60, 0x20,
+    0xf0, 0x15, // delay timer = V0
+    0xf1, 0x07, // V1 = delay timer, within the same frame
+    0x12, 0x06,
+};
+
+static const uint8_t add_to_index_unit[] = {
+    0x60, 0x05,
+    0xa1, 0x00,
+    0xf0, 0x1e, // I += V0
+    0x12, 0x06,
+};
+
+static const uint8_t font_character_unit[] = {
+    0x60, 0x03,
+    0xf0, 0x29, // I = font character 3
+    0x12, 0x04,
+};
+
+static const uint8_t bcd_unit[] = {
+    0x60, 0xfe, // V0 = 254
+    0xa3, 0x00,
+    0xf0, 0x33, // BCD of V0 at 0x300
+    0xf2, 0x65, // load V0 - V2
+    0x12, 0x08,
+};
+
+static const uint8_t store_load_unit[] = {
+    0x60, 0x11,
+    0x61, 0x22,
+    0x62, 0x33,
+    0xa3, 0x00,
+    0xf2, 0x55, // store V0 - V2 at 0x300
+    0x60, 0x00,
+    0x61, 0x00,
+    0x62, 0x00,
+    0xf2, 0x65, // load them back
+    0x12, 0x12,
+};
+
+static const uint8_t rpl_flags_unit[] = {
+    0x60, 0x42,
+    0xf0, 0x75, // save V0 to the RPL flags
+    0x60, 0x00,
+    0xf0, 0x85, // load it back
+    0x12, 0x08,
+};
+
+static const uint8_t exit_unit[] = {
+    0x00, 0xfd, // exit
+    0x61, 0x01, // never executed
+    0x12, 0x04,
+};
+
+static const uint8_t register_range_unit[] = {
+    0x60, 0x11,
+    0x61, 0x22,
+    0xa3, 0x00,
+    0x50, 0x12, // store V0 - V1 at 0x300
+    0x60, 0x00,
+    0x61, 0x00,
+    0x50, 0x13, // load them back, I was not moved
+    0x12, 0x0e,
+};
+
+// a skip steps over the whole four byte instruction
+static const uint8_t long_index_unit[] = {
+    0x60, 0x00,
+    0x30, 0x00, // skip if V0 == 0
+    0xf0, 0x00, 0x12, 0x34, // skipped
+    0xf0, 0x00, 0x43, 0x21, // I = 0x4321
+    0x12, 0x0c,
+};
+
+#define UNIT(name, mode, program, checked, index, ...) \
+    {name, program, sizeof(program), mode, checked, index, {__VA_ARGS__}, false}
+
+static const struct Unit units[] = {
+    UNIT("00E0-clear", MODE_CHIP_8, clear_unit, V(0xf), NO_INDEX, [0xf] = 0),
+    UNIT("2NNN-00EE-call-return", MODE_CHIP_8, call_return_unit, V(0) | V(1), NO_INDEX, [0] = 1, [1] = 2),
+    {"00EE-overwritten-stack", stack_overwrite_unit, sizeof(stack_overwrite_unit), MODE_CHIP_8, V(1), 0xea0,
+     {[1] = 0}, true},
+    UNIT("0NNN-system", MODE_CHIP_8, system_unit, V(1), NO_INDEX, [1] = 1),
+    UNIT("1NNN-jump", MODE_CHIP_8, jump_unit, V(0) | V(1), NO_INDEX, [0] = 0, [1] = 2),
+    UNIT("3XNN-skip-eq", MODE_CHIP_8, skip_eq_imm_unit, V(1) | V(2), NO_INDEX, [1] = 0, [2] = 1),
+    UNIT("4XNN-skip-neq", MODE_CHIP_8, skip_neq_imm_unit, V(1) | V(2), NO_INDEX, [1] = 1, [2] = 0),
+    UNIT("5XY0-skip-eq-reg", MODE_CHIP_8, skip_eq_reg_unit, V(3) | V(4), NO_INDEX, [3] = 0, [4] = 1),
+    UNIT("6XNN-set", MODE_CHIP_8, set_imm_unit, V(0xa), NO_INDEX, [0xa] = 0x42),
+    UNIT("7XNN-add", MODE_CHIP_8, add_imm_unit, V(0) | V(0xf), NO_INDEX, [0] = 1, [0xf] = 0),
+    UNIT("8XY0-load", MODE_CHIP_8, load_unit, V(0), NO_INDEX, [0] = 0x42),
+    UNIT("8XY1-or", MODE_CHIP_8, or_unit, V(0), NO_INDEX, [0] = 0xff),
+    UNIT("8XY2-and", MODE_CHIP_8, and_unit, V(0), NO_INDEX, [0] = 0x30),
+    UNIT("8XY3-xor", MODE_CHIP_8, xor_unit, V(0), NO_INDEX, [0] = 0xf0),
+    UNIT("8XY4-add", MODE_CHIP_8, add_unit, V(0) | V(2) | V(0xf), NO_INDEX, [0] = 1, [2] = 2, [0xf] = 0),
+    UNIT("8XY5-subtract", MODE_CHIP_8, subtract_unit, V(0) | V(2) | V(4), NO_INDEX, [0] = 2, [2] = 0xfe, [4] = 0),
+    UNIT("8XY6-right-shift", MODE_CHIP_8, right_shift_unit, V(0) | V(0xf), NO_INDEX, [0] = 2, [0xf] = 1),
+    UNIT("8XY7-subtract-n", MODE_CHIP_8, subtract_n_unit, V(0) | V(0xf), NO_INDEX, [0] = 2, [0xf] = 1),
+    UNIT("8XYE-left-shift", MODE_CHIP_8, left_shift_unit, V(0) | V(0xf), NO_INDEX, [0] = 2, [0xf] = 1),
+    UNIT("9XY0-skip-neq-reg", MODE_CHIP_8, skip_neq_reg_unit, V(3) | V(4), NO_INDEX, [3] = 1, [4] = 0),
+    UNIT("ANNN-set-index", MODE_CHIP_8, set_index_unit, 0, 0x123),
+    UNIT("BNNN-jump-offset", MODE_CHIP_8, jump_offset_unit, V(1) | V(2), NO_INDEX, [1] = 0, [2] = 2),
+    UNIT("BNNN-jump-past-memory", MODE_CHIP_8, jump_offset_past_memory_unit, V(0) | V(0xf), NO_INDEX,
+         [0] = 0x9c, [0xf] = 0x9c),
+    UNIT("CXNN-random", MODE_CHIP_8, random_unit, V(0), NO_INDEX, [0] = 0),
+    UNIT("DXYN-draw", MODE_CHIP_8, draw_unit, V(0xf), NO_INDEX, [0xf] = 1),
+    UNIT("EX9E-EXA1-skip-key", MODE_CHIP_8, skip_key_unit, V(1) | V(2), NO_INDEX, [1] = 1, [2] = 0),
+    UNIT("FX07-FX15-delay-timer", MODE_CHIP_8, delay_timer_unit, V(1), NO_INDEX, [1] = 0x20),
+    UNIT("FX1E-add-to-index", MODE_CHIP_8, add_to_index_unit, 0, 0x105),
+    UNIT("FX29-font-character", MODE_CHIP_8, font_character_unit, 0, 0x5f),
+    UNIT("FX33-bcd", MODE_CHIP_8, bcd_unit, V(0) | V(1) | V(2), 0x300, [0] = 2, [1] = 5, [2] = 4),
+    UNIT("FX55-FX65-store-load", MODE_CHIP_8, store_load_unit, V(0) | V(1) | V(2), 0x300,
+         [0] = 0x11, [1] = 0x22, [2] = 0x33),
+    UNIT("FX75-FX85-rpl-flags", MODE_SCHIP, rpl_flags_unit, V(0), NO_INDEX, [0] = 0x42),
+    UNIT("00FD-exit", MODE_SCHIP, exit_unit, V(1), NO_INDEX, [1] = 0),
+    UNIT("5XY2-5XY3-register-range", MODE_XO_CHIP, register_range_unit, V(0) | V(1), 0x300, [0] = 0x11, [1] = 0x22),
+    UNIT("F000-long-index", MODE_XO_CHIP, long_index_unit, 0, 0x4321),
+};
+
+#define UNIT_COUNT (sizeof(units) / sizeof(units[0]))
+
+// the engines that run a whole MachineState, then a single lockstep lane of wide.h, which only runs CHIP-8 and
+// cannot stop at a single instruction for --lockstep
+#define CONFORM_ENGINES 4
+#define CONFORM_WIDE 3
+
+static const char* const engine_names[CONFORM_ENGINES] = {"interpreter", "predecoded", "jit", "wide"};
+
+struct ConformOptions {
+    uint64_t cycles;
+    uint32_t instructions_per_frame;
+    bool engines[CONFORM_ENGINES];
+    const char* unit; // NULL runs all of them
+    bool lockstep;
+};
+
+// what a run leaves behind, everything a golden file records
+struct ConformResult {
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t I;
+    uint8_t v[16];
+    uint8_t stack_depth;
+    uint64_t memory_hash; // hash_rom of the 4 KB a snapshot covers
+    uint64_t screen_hash;
+};
+
+struct GoldenEntry {
+    char name[MAX_NAME_LEN];
+    struct ConformResult result;
+};
+
+// a program and the mode it runs in
+struct Workload {
+    const char* name;
+    const uint8_t* program;
+    size_t size;
+    enum MachineMode mode;
+    uint64_t cycles;
+};
+
+static struct MachineState* create_workload_machine(const struct Workload* workload, int engine,
+                                                    const struct ConformOptions* options, struct Frontend* frontend) {
+    struct MachineState* state = create_machine(frontend);
+    set_machine_mode(state, workload->mode);
+    state->engine = engine == CONFORM_WIDE ? ENGINE_INTERPRETER : engine; // the wide lane is exported into it
+    state->instructions_per_frame = options->instructions_per_frame;
+    load_program(state, workload->program, workload->size);
+    return state;
+}
+
+static void capture_result(const struct MachineState* state, struct Snapshot* snapshot, struct ConformResult* result) {
+    save_snapshot(state, snapshot);
+    result->cycles = snapshot->core.cycles;
+    result->pc = snapshot->core.pc;
+    result->I = snapshot->core.I;
+    memcpy(result->v, snapshot->core.d_reg, sizeof(result->v));
+    result->stack_depth = snapshot->core.stack_depth;
+    result->memory_hash = hash_rom(snapshot->mem, MEMORY_SIZE);
+    result->screen_hash = hash_screen(&state->screen);
+}
+
+// the first field the results disagree on, NULL if they are the same
+static const char* result_difference(const struct ConformResult* a, const struct ConformResult* b) {
+    if (memcmp(a->v, b->v, sizeof(a->v)) != 0) return "registers";
+    if (a->pc != b->pc) return "pc";
+    if (a->I != b->I) return "I";
+    if (a->stack_depth != b->stack_depth) return "stack";
+    if (a->memory_hash != b->memory_hash) return "memory";
+    if (a->screen_hash != b->screen_hash) return "screen";
+    if (a->cycles != b->cycles) return "cycles";
+    return NULL;
+}
+
+// field by field, the structs have padding
+static const char* snapshot_difference(const struct Snapshot* a, const struct Snapshot* b) {
+    if (memcmp(a->core.d_reg, b->core.d_reg, sizeof(a->core.d_reg)) != 0) return "registers";
+    if (a->core.pc != b->core.pc) return "pc";
+    if (a->core.I != b->core.I) return "I";
+    if (a->core.delay_timer != b->core.delay_timer || a->core.sound_timer != b->core.sound_timer) return "timers";
+    if (a->core.stack_depth != b->core.stack_depth ||
+        memcmp(a->core.stack, b->core.stack, a->core.stack_depth * sizeof(a->core.stack[0])) != 0) return "stack";
+    if (a->core.random_state != b->core.random_state) return "random state";
+    if (a->core.cycles != b->core.cycles) return "cycles";
+    if (memcmp(a->core.rows, b->core.rows, sizeof(a->core.rows)) != 0 ||
+        a->core.screen_width != b->core.screen_width || a->core.screen_height != b->core.screen_height ||
+        a->core.planes != b->core.planes) return "screen";
+    if (memcmp(a->core.rpl_flags, b->core.rpl_flags, sizeof(a->core.rpl_flags)) != 0) return "RPL flags";
+    if (memcmp(a->mem, b->mem, sizeof(a->mem)) != 0) return "memory";
+    return NULL;
+}
+
+static void format_registers(const uint8_t* v, char* text) {
+    for (int i = 0; i < 16; ++i) {
+        sprintf(text + 2 * i, "%02x", v[i]);
+    }
+}
+
+static bool parse_registers(const char* text, uint8_t* v) {
+    if (strlen(text) != 32) return false;
+    for (int i = 0; i < 16; ++i) {
+        unsigned value;
+        if (sscanf(text + 2 * i, "%2x", &value) != 1) return false;
+        v[i] = (uint8_t) value;
+    }
+    return true;
+}
+
+static void print_snapshot(const char* engine, const struct Snapshot* snapshot) {
+    char registers[33];
+    format_registers(snapshot->core.d_reg, registers);
+    printf("    %-12s pc %03x I %04x V %s DT %02x ST %02x SP %u\n", engine, snapshot->core.pc, snapshot->core.I,
+           registers, snapshot->core.delay_timer, snapshot->core.sound_timer, snapshot->core.stack_depth);
+}
+
+// like one iteration of run_headless, returns false once it would stop
+static bool run_frame(struct MachineState* state, uint64_t cycles, uint64_t* executed) {
+    reset_idle_detection(state);
+    *executed = run_cycles(state, cycles);
+    if (state->waiting_for_key || *executed == 0) return false;
+    tick_timers(state, 1);
+    return true;
+}
+
+// Replays a frame both machines disagree after one instruction at a time from the snapshots taken at its start
+// and reports the first instruction after which they differ.
+static void pinpoint_divergence(struct MachineState* reference, struct MachineState* tested, int engine,
+                                struct Snapshot* snapshots, uint64_t frame_cycles) {
+    restore_snapshot(reference, &snapshots[0]);
+    restore_snapshot(tested, &snapshots[1]);
+    reset_idle_detection(reference);
+    reset_idle_detection(tested);
+    for (uint64_t i = 0; i < frame_cycles; ++i) {
+        save_snapshot(reference, &snapshots[0]);
+        uint16_t pc = snapshots[0].core.pc;
+        uint16_t opcode = pc < MEMORY_SIZE - 1 ? (uint16_t) (snapshots[0].mem[pc] << 8 | snapshots[0].mem[pc + 1]) : 0;
+        uint64_t reference_executed = run_cycles(reference, 1);
+        uint64_t tested_executed = run_cycles(tested, 1);
+        save_snapshot(reference, &snapshots[0]);
+        save_snapshot(tested, &snapshots[1]);
+        const char* difference = reference_executed != tested_executed ? "executed instructions"
+                                                                       : snapshot_difference(&snapshots[0], &snapshots[1]);
+        if (difference) {
+            printf("  first divergence at cycle %llu, pc %03x, opcode %04x: %s\n",
+                   (unsigned long long) snapshots[0].core.cycles, pc, opcode, difference);
+            print_snapshot(engine_names[ENGINE_INTERPRETER], &snapshots[0]);
+            print_snapshot(engine_names[engine], &snapshots[1]);
+            return;
+        }
+        if (reference_executed == 0) break;
+    }
+    // the instructions agree, so the frame boundary differs, e.g. the idle detection or the timers
+    printf("  the instructions of the frame agree, it ends differently\n");
+    print_snapshot(engine_names[ENGINE_INTERPRETER], &snapshots[0]);
+    print_snapshot(engine_names[engine], &snapshots[1]);
+}
+
+// Runs the workload on the reference interpreter and on engine frame by frame and compares the complete machine
+// state after every frame. Returns false if they diverged.
+static bool run_lockstep(const struct Workload* workload, int engine, const struct ConformOptions* options) {
+    struct Frontend* frontend = create_null_frontend();
+    struct MachineState* reference = create_workload_machine(workload, ENGINE_INTERPRETER, options, frontend);
+    struct MachineState* tested = create_workload_machine(workload, engine, options, frontend);
+    // at the start of the frame, then at its end
+    struct Snapshot* snapshots = malloc(4 * sizeof(struct Snapshot));
+    if (!snapshots) {
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t frame_cycles = options->instructions_per_frame ? options->instructions_per_frame : 1;
+    uint64_t cycles = 0;
+    bool ok = true;
+    while (cycles < workload->cycles && !machine_halted(reference)) {
+        uint64_t frame = workload->cycles - cycles < frame_cycles ? workload->cycles - cycles : frame_cycles;
+        save_snapshot(reference, &snapshots[0]);
+        save_snapshot(tested, &snapshots[1]);
+        uint64_t reference_executed, tested_executed;
+        bool reference_runs = run_frame(reference, frame, &reference_executed);
+        bool tested_runs = run_frame(tested, frame, &tested_executed);
+        save_snapshot(reference, &snapshots[2]);
+        save_snapshot(tested, &snapshots[3]);
+        if (reference_executed != tested_executed || reference_runs != tested_runs ||
+            snapshot_difference(&snapshots[2], &snapshots[3])) {
+            printf("%-32s %-12s DIVERGED in the frame starting at cycle %llu\n", workload->name,
+                   engine_names[engine], (unsigned long long) cycles);
+            pinpoint_divergence(reference, tested, engine, snapshots, frame);
+            ok = false;
+            break;
+        }
+        cycles += reference_executed;
+        if (!reference_runs) break;
+    }
+    if (ok) {
+        printf("%-32s %-12s lockstep ok, %llu cycles\n", workload->name, engine_names[engine],
+               (unsigned long long) cycles);
+    }
+
+    free(snapshots);
+    delete_machine(&tested);
+    delete_machine(&reference);
+    delete_frontend(&frontend);
+    return ok;
+}
+
+// Stores into the stack area while a call is live, so the rewind has to restore a page saved with a host
+// pointer in it. Rewinding across the call, or across the call and its return, has to give back the state
+// exactly as it was captured.
+static const uint8_t rewind_program[] = {
+    0x22, 0x06, // call 0x206
+    0x12, 0x02,
+    0x12, 0x04,
+    0xae, 0xa8, // I = 0xEA8, the slot above the return address
+    0xf0, 0x55, // store V0 there
+    0x00, 0xee, // return
+};
+
+#define REWIND_NAME "rewind-across-call"
+
+static bool check_rewind(int engine, const struct ConformOptions* options) {
+    static const uint64_t run_lengths[] = {1, 4};
+    struct Frontend* frontend = create_null_frontend();
+    struct Workload workload = {REWIND_NAME, rewind_program, sizeof(rewind_program), MODE_CHIP_8, 0};
+    struct MachineState* state = create_workload_machine(&workload, engine, options, frontend);
+    struct Rewind* rewind = create_rewind(1);
+    state->rewind = rewind;
+    struct Snapshot* snapshots = malloc(2 * sizeof(struct Snapshot));
+    if (!snapshots) {
+        exit(EXIT_FAILURE);
+    }
+
+    const char* difference = NULL;
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < sizeof(run_lengths) / sizeof(run_lengths[0]) && !difference; ++i) {
+        cycles = run_lengths[i];
+        save_snapshot(state, &snapshots[0]);
+        rewind_capture(rewind, state);
+        reset_idle_detection(state);
+        run_cycles(state, cycles);
+        rewind_step(rewind, state, 1);
+        save_snapshot(state, &snapshots[1]);
+        difference = snapshot_difference(&snapshots[0], &snapshots[1]);
+    }
+    printf("%-32s %-12s", REWIND_NAME, engine_names[engine]);
+    if (difference) {
+        printf(" DIFFERS after rewinding %llu cycles: %s\n", (unsigned long long) cycles, difference);
+    } else {
+        printf(" ok\n");
+    }
+
+    free(snapshots);
+    state->rewind = NULL;
+    delete_rewind(&rewind);
+    delete_machine(&state);
+    delete_frontend(&frontend);
+    return !difference;
+}
+
+// like run_headless, the lane is exported into a machine for the result
+static void run_wide_lane(const struct Workload* workload, const struct ConformOptions* options,
+                          struct MachineState* state) {
+    struct WideMachines* wide = create_wide_machines(1, workload->program, workload->size);
+    uint64_t frame_cycles = options->instructions_per_frame ? options->instructions_per_frame : 1;
+    while (wide->cycles[0] < workload->cycles && !wide_lane_halted(wide, 0)) {
+        uint64_t left = workload->cycles - wide->cycles[0];
+        wide->instructions_per_frame = (uint32_t) (left < frame_cycles ? left : frame_cycles);
+        uint64_t executed = run_wide_frame(wide);
+        if ((wide->status[0] & WIDE_WAITING_FOR_KEY) || executed == 0) break;
+    }
+    export_wide_lane(wide, 0, state);
+    delete_wide_machines(&wide);
+}
+
+static void run_workload(const struct Workload* workload, int engine, const struct ConformOptions* options,
+                         struct ConformResult* result) {
+    struct Frontend* frontend = create_null_frontend();
+    struct MachineState* state = create_workload_machine(workload, engine, options, frontend);
+    struct Snapshot* snapshot = malloc(sizeof(struct Snapshot));
+    if (!snapshot) {
+        exit(EXIT_FAILURE);
+    }
+    if (engine == CONFORM_WIDE) {
+        run_wide_lane(workload, options, state);
+    } else {
+        run_headless(state, workload->cycles);
+    }
+    capture_result(state, snapshot, result);
+    free(snapshot);
+    delete_machine(&state);
+    delete_frontend(&frontend);
+}
+
+// returns the first register or I the unit did not leave as expected, NULL if it passed
+static const char* unit_failure(const struct Unit* unit, const struct ConformResult* result, char* text) {
+    for (int i = 0; i < 16; ++i) {
+        if (!(unit->checked & V(i)) || result->v[i] == unit->expected[i]) continue;
+        sprintf(text, "V%X is %02x instead of %02x", i, result->v[i], unit->expected[i]);
+        return text;
+    }
+    if (unit->index != NO_INDEX && result->I != unit->index) {
+        sprintf(text, "I is %04x instead of %04x", result->I, (unsigned) unit->index);
+        return text;
+    }
+    return NULL;
+}
+
+static size_t load_golden(const char* path, struct GoldenEntry* entries) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "File not found.");
+        exit(EXIT_FAILURE);
+    }
+    size_t count = 0;
+    char registers[33];
+    unsigned pc, I, stack_depth;
+    unsigned long long memory_hash, screen_hash, cycles;
+    while (count < MAX_GOLDEN_ENTRIES &&
+           fscanf(file, "%255s %x %x %32s %u %llx %llx %llu", entries[count].name, &pc, &I, registers, &stack_depth,
+                  &memory_hash, &screen_hash, &cycles) == 8) {
+        struct ConformResult* result = &entries[count].result;
+        if (!parse_registers(registers, result->v)) break;
+        result->pc = (uint16_t) pc;
+        result->I = (uint16_t) I;
+        result->stack_depth = (uint8_t) stack_depth;
+        result->memory_hash = memory_hash;
+        result->screen_hash = screen_hash;
+        result->cycles = cycles;
+        ++count;
+    }
+    fclose(file);
+    return count;
+}
+
+static const struct GoldenEntry* find_golden(const struct GoldenEntry* entries, size_t count, const char* name) {
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(entries[i].name, name) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+// golden entries are keyed by the file name alone, so a golden file does not depend on where the ROMs are
+static const char* rom_name(const char* path) {
+    const char* name = path;
+    for (const char* c = path; *c; ++c) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+    return name;
+}
+
+static void save_result(FILE* save, const char* name, const struct ConformResult* result) {
+    char registers[33];
+    format_registers(result->v, registers);
+    fprintf(save, "%s %03x %04x %s %u %016llx %016llx %llu\n", name, result->pc, result->I, registers,
+            result->stack_depth, (unsigned long long) result->memory_hash, (unsigned long long) result->screen_hash,
+            (unsigned long long) result->cycles);
+}
+
+// Runs the workload on every selected engine. The first one is the reference the others have to match, it has
+// to match the golden entry and pass the unit if there is one. Returns false on any mismatch.
+static bool check_workload(const struct Workload* workload, const struct Unit* unit,
+                           const struct ConformOptions* options, FILE* save, const struct GoldenEntry* golden,
+                           size_t golden_count) {
+    bool ok = true;
+    int reference = -1;
+    struct ConformResult reference_result;
+    const struct GoldenEntry* entry = find_golden(golden, golden_count, workload->name);
+    for (int engine = 0; engine < CONFORM_ENGINES; ++engine) {
+        if (!options->engines[engine] ||
+            (engine == CONFORM_WIDE && (workload->mode != MODE_CHIP_8 || (unit && unit->memory_stack)))) continue;
+        struct ConformResult result;
+        run_workload(workload, engine, options, &result);
+        char failure[64];
+        const char* problem = unit ? unit_failure(unit, &result, failure) : NULL;
+        const char* difference;
+        printf("%-32s %-12s %03x %016llx %016llx", workload->name, engine_names[engine], result.pc,
+               (unsigned long long) result.memory_hash, (unsigned long long) result.screen_hash);
+        if (problem) {
+            printf(" FAILED: %s", problem);
+        } else if (reference >= 0 && (difference = result_difference(&reference_result, &result))) {
+            printf(" DIFFERS from %s: %s", engine_names[reference], difference);
+            problem = difference;
+        } else if (entry && (difference = result_difference(&entry->result, &result))) {
+            printf(" DIFFERS from golden: %s", difference);
+            problem = difference;
+        } else {
+            printf(entry ? " ok, golden" : " ok");
+        }
+        printf("\n");
+        ok = ok && !problem;
+        if (reference < 0) {
+            reference = engine;
+            reference_result = result;
+            if (save) save_result(save, workload->name, &result);
+        }
+        if (options->lockstep && engine != ENGINE_INTERPRETER && engine != CONFORM_WIDE) {
+            ok = run_lockstep(workload, engine, options) && ok;
+        }
+    }
+    return ok;
+}
+
+static void print_usage() {
+    printf("Usage:\n\ncrispychip-conform [--engine interpreter | predecoded | jit | wide | all] [--cycles <per ROM>] "
+           "[--ipf <instructions per frame>] [--unit <name>] [--lockstep] [--save <golden file>] "
+           "[--golden <golden file>] [ROM...]\n\nUnits:");
+    for (size_t i = 0; i < UNIT_COUNT; ++i) {
+        printf(" %s", units[i].name);
+    }
+    printf(" %s\n\n", REWIND_NAME);
+}
+
+int main(int argc, char** argv) {
+    struct ConformOptions options = {DEFAULT_CONFORM_CYCLES, DEFAULT_INSTRUCTIONS_PER_FRAME, {true, true, true, true}, NULL, false};
+    const char* save_path = NULL;
+    const char* golden_path = NULL;
+    int arg = 1;
+    for (; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--engine") == 0 && arg + 1 < argc) {
+            const char* engine = argv[++arg];
+            bool all = strcmp(engine, "all") == 0;
+            bool known = all;
+            for (int i = 0; i < CONFORM_ENGINES; ++i) {
+                options.engines[i] = all || strcmp(engine, engine_names[i]) == 0;
+                known = known || options.engines[i];
+            }
+            if (!known) break;
+        } else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc) {
+            options.cycles = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc) {
+            options.instructions_per_frame = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--unit") == 0 && arg + 1 < argc) {
+            options.unit = argv[++arg];
+        } else if (strcmp(argv[arg], "--lockstep") == 0) {
+            options.lockstep = true;
+        } else if (strcmp(argv[arg], "--save") == 0 && arg + 1 < argc) {
+            save_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--golden") == 0 && arg + 1 < argc) {
+            golden_path = argv[++arg];
+        } else if (strncmp(argv[arg], "--", 2) == 0) {
+            break;
+        } else {
+            continue; // a ROM
+        }
+    }
+    if (arg < argc || options.cycles == 0) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    struct GoldenEntry* golden = calloc(MAX_GOLDEN_ENTRIES, sizeof(struct GoldenEntry));
+    if (!golden) {
+        exit(EXIT_FAILURE);
+    }
+    size_t golden_count = golden_path ? load_golden(golden_path, golden) : 0;
+    FILE* save = NULL;
+    if (save_path && (save = fopen(save_path, "w")) == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", save_path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-32s %-12s %3s %16s %16s\n", "workload", "engine", "pc", "memory", "screen");
+    bool ok = true;
+    for (size_t i = 0; i < UNIT_COUNT; ++i) {
+        if (options.unit && strcmp(options.unit, units[i].name) != 0) continue;
+        struct Workload workload = {units[i].name, units[i].program, units[i].size, units[i].mode, UNIT_CYCLES};
+        ok = check_workload(&workload, &units[i], &options, save, golden, golden_count) && ok;
+    }
+    // the wide engine has no rewinding
+    for (int engine = 0; engine < CONFORM_WIDE; ++engine) {
+        if (!options.engines[engine] || (options.unit && strcmp(options.unit, REWIND_NAME) != 0)) continue;
+        ok = check_rewind(engine, &options) && ok;
+    }
+    for (arg = 1; arg < argc; ++arg) {
+        // skip the options and their values, --lockstep has none
+        if (strcmp(argv[arg], "--lockstep") == 0) continue;
+        if (strncmp(argv[arg], "--", 2) == 0) {
+            ++arg;
+            continue;
+        }
+        struct Rom rom;
+        if (!map_rom(argv[arg], &rom)) {
+            fprintf(stderr, "Could not load %s.\n", argv[arg]);
+            ok = false;
+            continue;
+        }
+        // every ROM runs in the mode its instructions call for, like in a batch
+        enum MachineMode mode = quirks_profile_mode(detect_quirks_profile(rom.data, rom.size));
+        if (rom.size > max_program_length(mode)) {
+            fprintf(stderr, "%s does not fit into memory.\n", argv[arg]);
+            ok = false;
+        } else {
+            struct Workload workload = {rom_name(argv[arg]), rom.data, rom.size, mode, options.cycles};
+            ok = check_workload(&workload, NULL, &options, save, golden, golden_count) && ok;
+        }
+        unmap_rom(&rom);
+    }
+
+    if (save) fclose(save);
+    free(golden);
+    return ok ? 0 : EXIT_FAILURE;
+}
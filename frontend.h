@@ -0,0 +1,43 @@
+#ifndef CHIP_8_FRONTEND_H
+#define CHIP_8_FRONTEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct Screen;
+struct AudioRing;
+
+// commands returned by poll_input
+#define INPUT_QUIT 0x1U
+#define INPUT_REWIND 0x2U // held down
+#define INPUT_TURBO 0x4U // pressed, toggles turbo mode
+
+// Everything the core needs from the outside world. A NULL callback is treated as a no-op, so a
+// frontend only has to implement what it actually supports.
+struct Frontend {
+    void* data; // backend specific state
+
+    // video
+    void (*present)(struct Frontend* frontend, const struct Screen* screen);
+
+    // input, polled once per frame: updates the keypad bitmask and returns the INPUT_* commands given
+    uint32_t (*poll_input)(struct Frontend* frontend, uint16_t* keypad);
+    // sleeps until input is pending or timeout_ms passed
+    void (*wait_input)(struct Frontend* frontend, int timeout_ms);
+    // may be called from any thread, ends a wait_input in progress early, e.g. because a frame is ready
+    void (*wake)(struct Frontend* frontend);
+
+    // audio, the timers push the beeper state of every tick while set, see audio.h
+    struct AudioRing* audio;
+
+    void (*destroy)(struct Frontend* frontend);
+};
+
+// headless backend, never touches SDL
+extern struct Frontend* create_null_frontend();
+extern struct Frontend* create_sdl_frontend();
+// headless as well, the beeper is written to a WAV file at path, returns NULL if it cannot be created
+extern struct Frontend* create_wav_frontend(const char* path);
+extern void delete_frontend(struct Frontend** frontend);
+
+#endif //CHIP_8_FRONTEND_H
@@ -0,0 +1,18 @@
+#include "frontend.h"
+#include <stdlib.h>
+
+struct Frontend* create_null_frontend() {
+    struct Frontend* frontend = calloc(1, sizeof(struct Frontend));
+    if (!frontend) {
+        exit(EXIT_FAILURE);
+    }
+    return frontend;
+}
+
+void delete_frontend(struct Frontend** frontend) {
+    if (!(*frontend)) return;
+
+    if ((*frontend)->destroy) (*frontend)->destroy(*frontend);
+    free(*frontend);
+    *frontend = NULL;
+}
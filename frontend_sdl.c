@@ -0,0 +1,233 @@
+#include "frontend.h"
+#include "CHIP-8.h"
+#include "audio.h"
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+
+#define PIXEL_SIZE 16
+#define WINDOW_WIDTH (SCREEN_WIDTH * PIXEL_SIZE)
+#define WINDOW_HEIGHT (SCREEN_HEIGHT * PIXEL_SIZE)
+
+// ARGB by color index, bit n is set if the pixel is lit in plane n
+static const uint32_t palette[4] = {0xff000000U, 0xff00ff00U, 0xff00a0ffU, 0xffffffffU};
+
+#define KEY_PRESSED_INVALID 16
+#define AUDIO_DEVICE_SAMPLES 512 // per callback, about 11 ms
+#define AUDIO_MAX_QUEUED_TICKS 3 // a backlog beyond this is skipped, bounding the latency to about 50 ms
+
+struct SDLFrontend {
+    SDL_Event event;
+    SDL_Renderer* renderer;
+    SDL_Window* window;
+    SDL_Texture* texture; // one texel per high resolution pixel, scaled up by the renderer
+    uint32_t texels[HIRES_SCREEN_HEIGHT][HIRES_SCREEN_WIDTH]; // what the texture currently holds
+    bool rewinding; // backspace is held down
+    Uint32 wake_event; // pushed by sdl_wake, ignored by sdl_poll_input
+    SDL_AudioDeviceID audio_device; // 0 if no device could be opened, the machine then runs silently
+    struct AudioSynth synth; // only touched by the audio callback once the device runs
+};
+
+uint16_t scancode_to_int(SDL_Scancode scancode) {
+    switch (scancode) {
+        case SDL_SCANCODE_0: {
+            return 0;
+        }
+        case SDL_SCANCODE_1: {
+            return 1;
+        }
+        case SDL_SCANCODE_2: {
+            return 2;
+        }
+        case SDL_SCANCODE_3: {
+            return 3;
+        }
+        case SDL_SCANCODE_4: {
+            return 4;
+        }
+        case SDL_SCANCODE_5: {
+            return 5;
+        }
+        case SDL_SCANCODE_6: {
+            return 6;
+        }
+        case SDL_SCANCODE_7: {
+            return 7;
+        }
+        case SDL_SCANCODE_8: {
+            return 8;
+        }
+        case SDL_SCANCODE_9: {
+            return 9;
+        }
+        case SDL_SCANCODE_A: {
+            return 0xa;
+        }
+        case SDL_SCANCODE_B: {
+            return 0xb;
+        }
+        case SDL_SCANCODE_C: {
+            return 0xc;
+        }
+        case SDL_SCANCODE_D: {
+            return 0xd;
+        }
+        case SDL_SCANCODE_E: {
+            return 0xe;
+        }
+        case SDL_SCANCODE_F: {
+            return 0xf;
+        }
+        default: {
+            return KEY_PRESSED_INVALID;
+        }
+    }
+}
+
+// only rows marked dirty are expanded to texels, the whole texture is then scaled in a single copy
+// a low resolution pixel covers 2x2 texels
+static void sdl_present(struct Frontend* frontend, const struct Screen* screen) {
+    struct SDLFrontend* sdl = frontend->data;
+    int scale = HIRES_SCREEN_WIDTH / screen->width;
+    int first_row = HIRES_SCREEN_HEIGHT;
+    int last_row = -1;
+    for (int i = 0; i < screen->height; ++i) {
+        if (!(screen->dirty_rows & (1ULL << i))) continue;
+        if (first_row == HIRES_SCREEN_HEIGHT) first_row = i * scale;
+        last_row = i * scale + scale - 1;
+        for (int j = 0; j < screen->width; ++j) {
+            uint32_t color = palette[SCREEN_PIXEL(screen, j, i)];
+            for (int k = 0; k < scale * scale; ++k) {
+                sdl->texels[i * scale + k / scale][j * scale + k % scale] = color;
+            }
+        }
+    }
+    if (last_row >= 0) {
+        SDL_Rect rows = {0, first_row, HIRES_SCREEN_WIDTH, last_row - first_row + 1};
+        SDL_UpdateTexture(sdl->texture, &rows, sdl->texels[first_row], sizeof(sdl->texels[0]));
+    }
+    SDL_RenderCopy(sdl->renderer, sdl->texture, NULL, NULL);
+    SDL_RenderPresent(sdl->renderer);
+}
+
+// drains the event queue, key transitions update the keypad bitmask
+static uint32_t sdl_poll_input(struct Frontend* frontend, uint16_t* keypad) {
+    struct SDLFrontend* sdl = frontend->data;
+    uint32_t commands = 0;
+    while (SDL_PollEvent(&(sdl->event))) {
+        switch (sdl->event.type) {
+            case SDL_KEYDOWN:
+            case SDL_KEYUP: {
+                if (sdl->event.key.keysym.sym == SDLK_ESCAPE) {
+                    commands |= INPUT_QUIT;
+                    break;
+                }
+                if (sdl->event.key.keysym.scancode == SDL_SCANCODE_TAB) {
+                    if (sdl->event.type == SDL_KEYDOWN && !sdl->event.key.repeat) commands |= INPUT_TURBO;
+                    break;
+                }
+                if (sdl->event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
+                    sdl->rewinding = sdl->event.type == SDL_KEYDOWN;
+                    break;
+                }
+                uint16_t key = scancode_to_int(sdl->event.key.keysym.scancode);
+                if (key == KEY_PRESSED_INVALID) break;
+                if (sdl->event.type == SDL_KEYDOWN) {
+                    *keypad |= 1U << key;
+                } else {
+                    *keypad &= ~(1U << key);
+                }
+                break;
+            }
+            case SDL_QUIT:
+            {
+                commands |= INPUT_QUIT;
+                break;
+            }
+        }
+    }
+    return sdl->rewinding ? commands | INPUT_REWIND : commands;
+}
+
+// events are left in the queue for the next sdl_poll_input
+static void sdl_wait_input(struct Frontend* frontend, int timeout_ms) {
+    (void) frontend;
+    SDL_WaitEventTimeout(NULL, timeout_ms);
+}
+
+// SDL_PushEvent is safe to call from any thread
+static void sdl_wake(struct Frontend* frontend) {
+    struct SDLFrontend* sdl = frontend->data;
+    SDL_Event event = {0};
+    event.type = sdl->wake_event;
+    SDL_PushEvent(&event);
+}
+
+// runs on SDL's audio thread, never waits for the machine
+static void sdl_audio_callback(void* data, Uint8* stream, int length) {
+    struct SDLFrontend* sdl = data;
+    synthesize_audio(&sdl->synth, (int16_t*) stream, (size_t) length / sizeof(int16_t));
+}
+
+static void open_audio(struct Frontend* frontend, struct SDLFrontend* sdl) {
+    SDL_AudioSpec wanted = {0};
+    wanted.freq = AUDIO_SAMPLE_RATE;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = AUDIO_DEVICE_SAMPLES;
+    wanted.callback = sdl_audio_callback;
+    wanted.userdata = sdl;
+    frontend->audio = create_audio_ring();
+    init_audio_synth(&sdl->synth, frontend->audio, AUDIO_MAX_QUEUED_TICKS);
+    sdl->audio_device = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0);
+    if (sdl->audio_device == 0) {
+        delete_audio_ring(&frontend->audio);
+        return;
+    }
+    SDL_PauseAudioDevice(sdl->audio_device, 0);
+}
+
+static void sdl_destroy(struct Frontend* frontend) {
+    struct SDLFrontend* sdl = frontend->data;
+    if (!sdl) return;
+
+    if (sdl->audio_device) SDL_CloseAudioDevice(sdl->audio_device);
+    delete_audio_ring(&frontend->audio);
+    SDL_DestroyTexture(sdl->texture);
+    SDL_DestroyRenderer(sdl->renderer);
+    SDL_DestroyWindow(sdl->window);
+    SDL_Quit();
+    free(sdl);
+    frontend->data = NULL;
+}
+
+struct Frontend* create_sdl_frontend() {
+    struct Frontend* frontend = create_null_frontend();
+    struct SDLFrontend* sdl = calloc(1, sizeof(struct SDLFrontend));
+    if (!sdl) {
+        exit(EXIT_FAILURE);
+    }
+
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+    SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, 0, &sdl->window, &sdl->renderer);
+    SDL_SetRenderDrawColor(sdl->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(sdl->renderer);
+    SDL_SetRenderDrawColor(sdl->renderer, 0, 0, 0, 255);
+    sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, HIRES_SCREEN_WIDTH, HIRES_SCREEN_HEIGHT);
+    for (int i = 0; i < HIRES_SCREEN_HEIGHT; ++i) {
+        for (int j = 0; j < HIRES_SCREEN_WIDTH; ++j) {
+            sdl->texels[i][j] = palette[0];
+        }
+    }
+    SDL_UpdateTexture(sdl->texture, NULL, sdl->texels, sizeof(sdl->texels[0]));
+
+    open_audio(frontend, sdl);
+    sdl->wake_event = SDL_RegisterEvents(1);
+
+    frontend->data = sdl;
+    frontend->present = sdl_present;
+    frontend->poll_input = sdl_poll_input;
+    frontend->wait_input = sdl_wait_input;
+    frontend->wake = sdl->wake_event == (Uint32) -1 ? NULL : sdl_wake;
+    frontend->destroy = sdl_destroy;
+    return frontend;
+}
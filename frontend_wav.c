@@ -0,0 +1,117 @@
+#include "frontend.h"
+#include "audio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+#include <time.h>
+
+#define WAV_HEADER_SIZE 44
+#define WAV_POLL_INTERVAL_NS 1000000L
+
+// A headless frontend whose audio thread writes every tick the machine produced, at whatever speed it runs,
+// as 16 bit mono PCM. The sizes in the header are filled in when the frontend is deleted.
+struct WavFrontend {
+    struct AudioRing* ring;
+    struct AudioSynth synth;
+    FILE* file;
+    uint64_t samples;
+    _Alignas(64) atomic_bool stopping;
+    pthread_t thread;
+};
+
+static void write_wav_header(FILE* file, uint64_t samples) {
+    uint32_t data_size = (uint32_t) (samples * sizeof(int16_t));
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t riff_size = htole32(WAV_HEADER_SIZE - 8 + data_size);
+    uint32_t format_size = htole32(16);
+    uint16_t format = htole16(1); // PCM
+    uint16_t channels = htole16(1);
+    uint32_t sample_rate = htole32(AUDIO_SAMPLE_RATE);
+    uint32_t byte_rate = htole32(AUDIO_SAMPLE_RATE * sizeof(int16_t));
+    uint16_t block_align = htole16(sizeof(int16_t));
+    uint16_t bits = htole16(16);
+    uint32_t data_size_le = htole32(data_size);
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 4, &riff_size, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 16, &format_size, 4);
+    memcpy(header + 20, &format, 2);
+    memcpy(header + 22, &channels, 2);
+    memcpy(header + 24, &sample_rate, 4);
+    memcpy(header + 28, &byte_rate, 4);
+    memcpy(header + 32, &block_align, 2);
+    memcpy(header + 34, &bits, 2);
+    memcpy(header + 36, "data", 4);
+    memcpy(header + 40, &data_size_le, 4);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+static void write_ticks(struct WavFrontend* wav) {
+    struct AudioTick tick;
+    int16_t samples[AUDIO_SAMPLES_PER_TICK];
+    while (pop_audio_tick(wav->ring, &tick)) {
+        render_audio_tick(&wav->synth, &tick, samples);
+        for (size_t i = 0; i < AUDIO_SAMPLES_PER_TICK; ++i) {
+            samples[i] = (int16_t) htole16((uint16_t) samples[i]);
+        }
+        fwrite(samples, sizeof(int16_t), AUDIO_SAMPLES_PER_TICK, wav->file);
+        wav->samples += AUDIO_SAMPLES_PER_TICK;
+    }
+}
+
+static void* run_wav_thread(void* data) {
+    struct WavFrontend* wav = data;
+    struct timespec interval = {0, WAV_POLL_INTERVAL_NS};
+    while (!atomic_load_explicit(&wav->stopping, memory_order_acquire)) {
+        write_ticks(wav);
+        nanosleep(&interval, NULL);
+    }
+    write_ticks(wav);
+    return NULL;
+}
+
+static void wav_destroy(struct Frontend* frontend) {
+    struct WavFrontend* wav = frontend->data;
+    if (!wav) return;
+
+    atomic_store_explicit(&wav->stopping, true, memory_order_release);
+    pthread_join(wav->thread, NULL);
+    if (wav->ring->dropped) {
+        fprintf(stderr, "Audio: dropped %llu of %llu ticks.\n", (unsigned long long) wav->ring->dropped,
+                (unsigned long long) wav->ring->pushed);
+    }
+    write_wav_header(wav->file, wav->samples);
+    fclose(wav->file);
+    delete_audio_ring(&wav->ring);
+    free(wav);
+    frontend->data = NULL;
+    frontend->audio = NULL;
+}
+
+struct Frontend* create_wav_frontend(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return NULL;
+    struct Frontend* frontend = create_null_frontend();
+    struct WavFrontend* wav = aligned_alloc(64, sizeof(struct WavFrontend));
+    if (!wav) {
+        exit(EXIT_FAILURE);
+    }
+    memset(wav, 0, sizeof(struct WavFrontend));
+    wav->ring = create_audio_ring();
+    init_audio_synth(&wav->synth, wav->ring, 0);
+    wav->file = file;
+    // the real header follows once the length is known
+    write_wav_header(file, 0);
+    atomic_init(&wav->stopping, false);
+    if (pthread_create(&wav->thread, NULL, run_wav_thread, wav) != 0) {
+        fprintf(stderr, "Could not start the audio thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    frontend->data = wav;
+    frontend->audio = wav->ring;
+    frontend->destroy = wav_destroy;
+    return frontend;
+}
@@ -0,0 +1,175 @@
+#include "handoff.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define HANDOFF_BUFFERS 3
+#define BUFFER_INDEX 0x3U
+#define FRESH_FRAME 0x4U // set on the middle buffer while the frontend has not taken its frame yet
+#define IDLE_WAIT_MS 100 // a display that can be woken is woken by every new frame
+#define POLL_WAIT_MS 1
+
+struct FrameHandoff {
+    struct Screen buffers[HANDOFF_BUFFERS];
+    _Alignas(64) atomic_uint middle; // index of the buffer passed back and forth, with FRESH_FRAME
+    // machine thread only
+    _Alignas(64) unsigned back; // being written
+    uint64_t carried_rows; // dirty rows of frames that were replaced before the frontend took them
+    uint32_t polled_generation; // input_generation at the last poll_input
+    // frontend thread only
+    _Alignas(64) unsigned front; // presented last
+    // input, written by the frontend thread
+    _Alignas(64) atomic_uint keypad;
+    atomic_uint commands; // INPUT_QUIT and INPUT_TURBO not yet taken by the machine
+    atomic_bool rewinding;
+    atomic_uint input_generation; // counts changes of the input, wait_input sleeps until it moves
+    atomic_bool stopped; // run_machine returned
+    pthread_mutex_t input_lock;
+    pthread_cond_t input_changed;
+
+    struct Frontend* display; // driven by the thread that called run_machine_threaded
+    struct Frontend frontend; // what the machine sees
+    struct MachineState* state;
+    const uint8_t* binary;
+    size_t binary_size;
+};
+
+// machine thread: the screen goes into the back buffer, which then swaps places with the middle one
+static void handoff_present(struct Frontend* frontend, const struct Screen* screen) {
+    struct FrameHandoff* handoff = frontend->data;
+    struct Screen* buffer = &handoff->buffers[handoff->back];
+    *buffer = *screen;
+    buffer->dirty_rows |= handoff->carried_rows;
+    unsigned previous = atomic_exchange_explicit(&handoff->middle, handoff->back | FRESH_FRAME, memory_order_acq_rel);
+    handoff->back = previous & BUFFER_INDEX;
+    // a frame the frontend never saw still changed rows since the one it did see
+    handoff->carried_rows = previous & FRESH_FRAME ? handoff->buffers[handoff->back].dirty_rows : 0;
+    if (handoff->display->wake) handoff->display->wake(handoff->display);
+}
+
+static uint32_t handoff_poll_input(struct Frontend* frontend, uint16_t* keypad) {
+    struct FrameHandoff* handoff = frontend->data;
+    handoff->polled_generation = atomic_load_explicit(&handoff->input_generation, memory_order_acquire);
+    *keypad = (uint16_t) atomic_load_explicit(&handoff->keypad, memory_order_acquire);
+    uint32_t commands = atomic_exchange_explicit(&handoff->commands, 0, memory_order_acq_rel);
+    return atomic_load_explicit(&handoff->rewinding, memory_order_acquire) ? commands | INPUT_REWIND : commands;
+}
+
+// sleeps until the input changed since the last poll_input or timeout_ms passed
+static void handoff_wait_input(struct Frontend* frontend, int timeout_ms) {
+    struct FrameHandoff* handoff = frontend->data;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    add_nanoseconds(&deadline, (long) timeout_ms * 1000000L);
+    pthread_mutex_lock(&handoff->input_lock);
+    while (atomic_load_explicit(&handoff->input_generation, memory_order_acquire) == handoff->polled_generation) {
+        if (pthread_cond_timedwait(&handoff->input_changed, &handoff->input_lock, &deadline) != 0) break;
+    }
+    pthread_mutex_unlock(&handoff->input_lock);
+}
+
+// frontend thread
+static void publish_input(struct FrameHandoff* handoff, uint16_t keypad, uint32_t commands) {
+    bool rewinding = commands & INPUT_REWIND;
+    commands &= ~INPUT_REWIND;
+    bool changed = commands || keypad != atomic_load_explicit(&handoff->keypad, memory_order_relaxed) ||
+                   rewinding != atomic_load_explicit(&handoff->rewinding, memory_order_relaxed);
+    if (!changed) return;
+    atomic_store_explicit(&handoff->keypad, keypad, memory_order_release);
+    atomic_store_explicit(&handoff->rewinding, rewinding, memory_order_release);
+    atomic_fetch_or_explicit(&handoff->commands, commands, memory_order_acq_rel);
+    atomic_fetch_add_explicit(&handoff->input_generation, 1, memory_order_acq_rel);
+    pthread_mutex_lock(&handoff->input_lock);
+    pthread_cond_broadcast(&handoff->input_changed);
+    pthread_mutex_unlock(&handoff->input_lock);
+}
+
+// frames completed in the meantime are skipped, only the latest one is shown
+static void present_latest_frame(struct FrameHandoff* handoff) {
+    if (!(atomic_load_explicit(&handoff->middle, memory_order_acquire) & FRESH_FRAME)) return;
+    unsigned middle = atomic_exchange_explicit(&handoff->middle, handoff->front, memory_order_acq_rel);
+    handoff->front = middle & BUFFER_INDEX;
+    if (handoff->display->present) handoff->display->present(handoff->display, &handoff->buffers[handoff->front]);
+}
+
+static void* run_machine_thread(void* data) {
+    struct FrameHandoff* handoff = data;
+    run_machine(handoff->state, handoff->binary, handoff->binary_size);
+    atomic_store_explicit(&handoff->stopped, true, memory_order_release);
+    if (handoff->display->wake) handoff->display->wake(handoff->display);
+    return NULL;
+}
+
+static struct FrameHandoff* create_frame_handoff(struct MachineState* state, const uint8_t* binary,
+                                                 size_t binary_size) {
+    struct FrameHandoff* handoff = aligned_alloc(64, sizeof(struct FrameHandoff));
+    if (!handoff) {
+        exit(EXIT_FAILURE);
+    }
+    memset(handoff, 0, sizeof(struct FrameHandoff));
+    handoff->back = 0;
+    atomic_init(&handoff->middle, 1);
+    handoff->front = 2;
+    atomic_init(&handoff->keypad, state->keypad);
+    atomic_init(&handoff->commands, 0);
+    atomic_init(&handoff->rewinding, false);
+    atomic_init(&handoff->input_generation, 0);
+    atomic_init(&handoff->stopped, false);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_mutex_init(&handoff->input_lock, NULL);
+    pthread_cond_init(&handoff->input_changed, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    handoff->display = state->frontend;
+    handoff->frontend.data = handoff;
+    handoff->frontend.present = handoff_present;
+    handoff->frontend.poll_input = handoff_poll_input;
+    handoff->frontend.wait_input = handoff_wait_input;
+    // the timers push the audio straight to the display's consumer
+    handoff->frontend.audio = state->frontend->audio;
+    handoff->state = state;
+    handoff->binary = binary;
+    handoff->binary_size = binary_size;
+    return handoff;
+}
+
+static void delete_frame_handoff(struct FrameHandoff** handoff) {
+    if (!(*handoff)) return;
+
+    pthread_cond_destroy(&(*handoff)->input_changed);
+    pthread_mutex_destroy(&(*handoff)->input_lock);
+    free(*handoff);
+    *handoff = NULL;
+}
+
+void run_machine_threaded(struct MachineState* state, const uint8_t* binary, size_t binary_size) {
+    struct FrameHandoff* handoff = create_frame_handoff(state, binary, binary_size);
+    struct Frontend* display = handoff->display;
+    state->frontend = &handoff->frontend;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_machine_thread, handoff) != 0) {
+        fprintf(stderr, "Could not start the machine thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint16_t keypad = state->keypad;
+    while (!atomic_load_explicit(&handoff->stopped, memory_order_acquire)) {
+        uint32_t commands = display->poll_input ? display->poll_input(display, &keypad) : 0;
+        publish_input(handoff, keypad, commands);
+        present_latest_frame(handoff);
+        if (display->wait_input) {
+            display->wait_input(display, display->wake ? IDLE_WAIT_MS : POLL_WAIT_MS);
+        } else {
+            struct timespec interval = {0, POLL_WAIT_MS * 1000000L};
+            nanosleep(&interval, NULL);
+        }
+    }
+    pthread_join(thread, NULL);
+    present_latest_frame(handoff);
+    state->frontend = display;
+    delete_frame_handoff(&handoff);
+}
@@ -0,0 +1,12 @@
+#ifndef CHIP_8_HANDOFF_H
+#define CHIP_8_HANDOFF_H
+
+#include "CHIP-8.h"
+
+// Runs run_machine on a thread of its own while the calling thread drives state->frontend: it only polls input
+// and presents frames. Completed frames are handed over through three screen buffers, the machine always has one
+// to write and the frontend always has the latest one, neither ever waits for the other. The keypad and commands
+// go the other way through atomics. Returns once the machine stopped, state->frontend is left as it was.
+extern void run_machine_threaded(struct MachineState* state, const uint8_t* binary, size_t binary_size);
+
+#endif //CHIP_8_HANDOFF_H
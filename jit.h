@@ -0,0 +1,16 @@
+#ifndef CHIP_8_JIT_H
+#define CHIP_8_JIT_H
+
+#include "CHIP-8.h"
+
+struct JitCache;
+
+// translates basic blocks into native code, everything it cannot translate runs on the predecoded engine
+extern uint64_t run_jit(struct MachineState* state, uint64_t max_cycles);
+// drops all translations, e.g. after a new program has been loaded
+extern void reset_jit_cache(struct JitCache* cache);
+// called for every store into Memory::mem so translated code never goes stale
+extern void jit_note_write(struct JitCache* cache, uint16_t address);
+extern void delete_jit_cache(struct JitCache** cache);
+
+#endif //CHIP_8_JIT_H
@@ -0,0 +1,712 @@
+#include "jit.h"
+#include "predecode.h"
+#include "CHIP-8-internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#define JIT_BUFFER_SIZE (1 << 20)
+#define JIT_MAX_BLOCK_BYTES 16384 // headroom that has to be left in the buffer before translating a block, FX65 takes up to 255 bytes
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_MAX_BLOCKS 2048
+#define JIT_MAX_PATCHES 4096
+
+// state the generated code needs besides the register file
+struct JitContext {
+    int64_t budget; // remaining cycles, every block subtracts its length on entry
+    uint8_t* mem;
+    struct Memory* memory;
+    struct MachineState* state; // first argument of the helpers generated code calls
+};
+
+// generated code is called with rdi = context and rsi = register file and returns the next pc
+// or-ed with JIT_INTERPRET_NEXT when the instruction at that pc has to be run by the interpreter
+#define JIT_INTERPRET_NEXT (1ULL << 62)
+typedef uint64_t (*JitBlockCode)(struct JitContext* ctx, struct RegisterFile* rf);
+
+struct JitBlock {
+    JitBlockCode code;
+    uint16_t start;
+    uint16_t length; // in instructions
+};
+
+// a "mov eax, target; ret" exit that becomes a direct jump once target is translated
+struct JitPatch {
+    uint32_t offset;
+    uint16_t target;
+};
+
+struct JitCache {
+    uint8_t* buffer; // mmap'd, readable, writable and executable
+    size_t used;
+    struct JitBlock blocks[JIT_MAX_BLOCKS];
+    size_t block_count;
+    struct JitBlock* block_at[MEMORY_SIZE];
+    struct JitPatch patches[JIT_MAX_PATCHES];
+    size_t patch_count;
+    uint8_t covered[MEMORY_SIZE]; // bytes belonging to a translated block
+    uint8_t written[MEMORY_SIZE]; // bytes stored to by the program, never translated again
+    // untranslatable_run of addresses marked untranslatable, only a hint: the predecoded engine runs whatever is there
+    uint8_t runs[MEMORY_SIZE];
+    uint32_t quirks; // QUIRK_* bits built into the translations
+    uint32_t flushes; // counts flush_jit_cache, a store helper compares it to find out whether its block is gone
+};
+
+// marks addresses whose first instruction cannot be translated
+static struct JitBlock untranslatable;
+
+static struct JitCache* create_jit_cache() {
+    struct JitCache* cache = calloc(1, sizeof(struct JitCache));
+    if (!cache) {
+        exit(EXIT_FAILURE);
+    }
+    void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // some hardened kernels refuse writable and executable mappings, run_jit falls back in that case
+    cache->buffer = buffer == MAP_FAILED ? NULL : buffer;
+    return cache;
+}
+
+static void flush_jit_cache(struct JitCache* cache) {
+    cache->used = 0;
+    cache->block_count = 0;
+    cache->patch_count = 0;
+    memset(cache->block_at, 0, sizeof(cache->block_at));
+    memset(cache->covered, 0, sizeof(cache->covered));
+    cache->flushes++;
+}
+
+void reset_jit_cache(struct JitCache* cache) {
+    if (!cache) return;
+    flush_jit_cache(cache);
+    memset(cache->written, 0, sizeof(cache->written));
+}
+
+void jit_note_write(struct JitCache* cache, uint16_t address) {
+    // translations never cover written bytes, so a store into data written before has nothing left to undo
+    if (!cache || cache->written[address]) return;
+    cache->written[address] = 1;
+    // generated code that calls a store helper leaves its block right after a flush, so throwing all translations away is safe
+    if (cache->covered[address]) {
+        flush_jit_cache(cache);
+    }
+    if (cache->block_at[address] == &untranslatable) cache->block_at[address] = NULL;
+    if (address > 0 && cache->block_at[address - 1] == &untranslatable) cache->block_at[address - 1] = NULL;
+}
+
+void delete_jit_cache(struct JitCache** cache) {
+    if (!(*cache)) return;
+    if ((*cache)->buffer) munmap((*cache)->buffer, JIT_BUFFER_SIZE);
+    free(*cache);
+    *cache = NULL;
+}
+
+static void emit8(struct JitCache* cache, uint8_t byte) {
+    cache->buffer[cache->used++] = byte;
+}
+
+static void emit32(struct JitCache* cache, uint32_t value) {
+    memcpy(cache->buffer + cache->used, &value, sizeof(value));
+    cache->used += sizeof(value);
+}
+
+static void emit_bytes(struct JitCache* cache, const uint8_t* bytes, size_t length) {
+    memcpy(cache->buffer + cache->used, bytes, length);
+    cache->used += length;
+}
+
+#define EMIT(cache, ...) do { const uint8_t bytes_[] = {__VA_ARGS__}; emit_bytes(cache, bytes_, sizeof(bytes_)); } while (0)
+
+static void patch_rel32(struct JitCache* cache, size_t rel_offset, size_t target) {
+    int32_t rel = (int32_t) (target - (rel_offset + 4));
+    memcpy(cache->buffer + rel_offset, &rel, sizeof(rel));
+}
+
+#define REG_DISP(reg) ((uint8_t) (offsetof(struct RegisterFile, d_reg) + (reg)))
+#define I_DISP ((uint8_t) offsetof(struct RegisterFile, I))
+#define DELAY_TIMER_DISP ((uint8_t) offsetof(struct RegisterFile, delay_timer))
+#define BUDGET_DISP ((uint8_t) offsetof(struct JitContext, budget))
+#define MEM_DISP ((uint8_t) offsetof(struct JitContext, mem))
+#define MEMORY_DISP ((uint8_t) offsetof(struct JitContext, memory))
+#define STATE_DISP ((uint8_t) offsetof(struct JitContext, state))
+#define SOUND_TIMER_DISP ((uint8_t) offsetof(struct RegisterFile, sound_timer))
+// the stack pointers sit behind Memory::mem and need 32 bit displacements
+#define STACK_POINTER_DISP ((uint32_t) offsetof(struct Memory, stack_pointer))
+#define STACK_BASE_DISP ((uint32_t) offsetof(struct Memory, stack_base_pointer))
+// so does the keypad behind MachineState::mem
+#define KEYPAD_DISP ((uint32_t) offsetof(struct MachineState, keypad))
+
+_Static_assert(offsetof(struct RegisterFile, sound_timer) < 0x80, "register file needs 8 bit displacements");
+_Static_assert(sizeof(struct JitContext) < 0x80, "context needs 8 bit displacements");
+_Static_assert(MEMORY_SIZE == 0x1000, "FX65 masks addresses with an immediate");
+_Static_assert(offsetof(struct JitBlock, code) == 0, "dynamic exits load the code without a displacement");
+
+// movzx eax, byte [rsi + disp]
+static void load_eax(struct JitCache* cache, uint8_t disp) {
+    EMIT(cache, 0x0f, 0xb6, 0x46, disp);
+}
+
+// movzx ecx, byte [rsi + disp]
+static void load_ecx(struct JitCache* cache, uint8_t disp) {
+    EMIT(cache, 0x0f, 0xb6, 0x4e, disp);
+}
+
+// mov byte [rsi + disp], al
+static void store_al(struct JitCache* cache, uint8_t disp) {
+    EMIT(cache, 0x88, 0x46, disp);
+}
+
+static void emit_return_pc(struct JitCache* cache, uint16_t pc) {
+    emit8(cache, 0xb8); // mov eax, pc
+    emit32(cache, pc);
+    emit8(cache, 0xc3); // ret
+}
+
+// leaves the block towards a statically known pc, chaining directly into its translation if possible
+static void emit_exit(struct JitCache* cache, uint16_t target) {
+    struct JitBlock* block = cache->block_at[target];
+    if (block && block != &untranslatable) {
+        emit8(cache, 0xe9); // jmp rel32
+        emit32(cache, 0);
+        patch_rel32(cache, cache->used - 4, (uint8_t*) block->code - cache->buffer);
+        return;
+    }
+    if (target >= PROGRAM_OFFSET && target < PROGRAM_END && cache->patch_count < JIT_MAX_PATCHES) {
+        cache->patches[cache->patch_count].offset = cache->used;
+        cache->patches[cache->patch_count].target = target;
+        cache->patch_count++;
+    }
+    emit_return_pc(cache, target);
+}
+
+// jcc rel32 with the displacement filled in later, returns the offset of the displacement
+static size_t emit_jcc(struct JitCache* cache, uint8_t condition) {
+    EMIT(cache, 0x0f, condition, 0, 0, 0, 0);
+    return cache->used - 4;
+}
+
+#define JCC_JB 0x82
+#define JCC_JAE 0x83
+#define JCC_JE 0x84
+#define JCC_JNE 0x85
+#define JCC_JA 0x87
+#define JCC_JL 0x8c
+
+// bails out of a block before the instruction at pc, which the interpreter then executes instead
+static void emit_bail(struct JitCache* cache, uint16_t pc, uint16_t unexecuted) {
+    EMIT(cache, 0x48, 0x81, 0x47, BUDGET_DISP); // add qword [rdi + budget], unexecuted
+    emit32(cache, unexecuted);
+    uint64_t result = pc | JIT_INTERPRET_NEXT;
+    EMIT(cache, 0x48, 0xb8); // mov rax, result
+    emit_bytes(cache, (const uint8_t*) &result, sizeof(result));
+    emit8(cache, 0xc3); // ret
+}
+
+// leaves the block towards the pc in rax, a translated target is jumped to through block_at without returning to run_jit
+static void emit_dynamic_exit(struct JitCache* cache) {
+    uint64_t block_at = (uint64_t) (uintptr_t) cache->block_at;
+    EMIT(cache, 0x48, 0x3d); // cmp rax, PROGRAM_END
+    emit32(cache, PROGRAM_END);
+    size_t outside = emit_jcc(cache, JCC_JAE);
+    EMIT(cache, 0x48, 0xba); // mov rdx, block_at
+    emit_bytes(cache, (const uint8_t*) &block_at, sizeof(block_at));
+    EMIT(cache, 0x48, 0x8b, 0x14, 0xc2); // mov rdx, [rdx + rax * 8]
+    EMIT(cache, 0x48, 0x85, 0xd2); // test rdx, rdx
+    size_t missing = emit_jcc(cache, JCC_JE);
+    EMIT(cache, 0x48, 0x8b, 0x12); // mov rdx, [rdx + code], NULL for untranslatable
+    EMIT(cache, 0x48, 0x85, 0xd2); // test rdx, rdx
+    size_t no_code = emit_jcc(cache, JCC_JE);
+    EMIT(cache, 0xff, 0xe2); // jmp rdx, the block checks the budget itself
+    patch_rel32(cache, outside, cache->used);
+    patch_rel32(cache, missing, cache->used);
+    patch_rel32(cache, no_code, cache->used);
+    emit8(cache, 0xc3); // ret
+}
+
+// leaves the block after the instruction at pc if a store of it hit translated code, which is gone by now
+static void emit_exit_if_flushed(struct JitCache* cache, uint16_t pc, uint16_t unexecuted) {
+    EMIT(cache, 0x84, 0xc0); // test al, al
+    size_t kept = emit_jcc(cache, JCC_JE);
+    EMIT(cache, 0x48, 0x81, 0x47, BUDGET_DISP); // add qword [rdi + budget], unexecuted
+    emit32(cache, unexecuted);
+    emit_return_pc(cache, pc + 2);
+    patch_rel32(cache, kept, cache->used);
+}
+
+// calls function(state, a, b, c), rdi and rsi survive and the result is left in eax
+static void emit_call(struct JitCache* cache, uint64_t function, uint8_t a, uint8_t b, uint8_t c) {
+    EMIT(cache, 0x57, 0x56); // push rdi, push rsi
+    EMIT(cache, 0x48, 0x83, 0xec, 0x08); // sub rsp, 8, the stack is 16 byte aligned at the call again
+    EMIT(cache, 0x48, 0x8b, 0x7f, STATE_DISP); // mov rdi, [rdi + state]
+    emit8(cache, 0xbe); // mov esi, a
+    emit32(cache, a);
+    emit8(cache, 0xba); // mov edx, b
+    emit32(cache, b);
+    emit8(cache, 0xb9); // mov ecx, c
+    emit32(cache, c);
+    EMIT(cache, 0x48, 0xb8); // mov rax, function
+    emit_bytes(cache, (const uint8_t*) &function, sizeof(function));
+    EMIT(cache, 0xff, 0xd0); // call rax
+    EMIT(cache, 0x48, 0x83, 0xc4, 0x08); // add rsp, 8
+    EMIT(cache, 0x5e, 0x5f); // pop rsi, pop rdi
+}
+
+// write_memory that only calls out to jit_note_write for bytes not stored to before
+static void jit_write_memory(struct MachineState* state, uint16_t address, uint8_t value) {
+    address = store_memory(state, address, value);
+    if (address < MEMORY_SIZE && !state->jit->written[address]) jit_note_write(state->jit, address);
+}
+
+// FX33 and FX55 for generated code, they return whether a store hit translated code
+static bool jit_store_bcd(struct MachineState* state, uint8_t x) {
+    uint32_t flushes = state->jit->flushes;
+    uint8_t value = state->rf.d_reg[x];
+    jit_write_memory(state, state->rf.I, value / 100);
+    jit_write_memory(state, state->rf.I + 1, value / 10 % 10);
+    jit_write_memory(state, state->rf.I + 2, value % 10);
+    return state->jit->flushes != flushes;
+}
+
+static void advance_index(struct MachineState* state, uint8_t x) {
+    if (state->quirks & QUIRK_INDEX_INCREMENT) {
+        state->rf.I += x + 1;
+    } else if (state->quirks & QUIRK_INDEX_ADD_X) {
+        state->rf.I += x;
+    }
+}
+
+static bool jit_store_registers(struct MachineState* state, uint8_t x) {
+    uint32_t flushes = state->jit->flushes;
+    for (int i = 0; i <= x; ++i) {
+        jit_write_memory(state, state->rf.I + i, state->rf.d_reg[i]);
+    }
+    advance_index(state, x);
+    return state->jit->flushes != flushes;
+}
+
+static bool is_translatable(uint8_t kind) {
+    switch (kind) {
+        case OP_RETURN:
+        case OP_JUMP:
+        case OP_JUMP_OFFSET:
+        case OP_CALL:
+        case OP_SKIP_EQ_IMM:
+        case OP_SKIP_NEQ_IMM:
+        case OP_SKIP_EQ_REG:
+        case OP_SKIP_KEY:
+        case OP_SKIP_NOT_KEY:
+        case OP_SET_IMM:
+        case OP_ADD_IMM:
+        case OP_LOAD:
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_RIGHT_SHIFT:
+        case OP_SUBTRACT_N:
+        case OP_LEFT_SHIFT:
+        case OP_SKIP_NEQ_REG:
+        case OP_SET_INDEX:
+        case OP_SET_DELAY_TIMER:
+        case OP_SET_SOUND_TIMER:
+        case OP_ADD_TO_INDEX:
+        case OP_FONT_CHARACTER:
+        case OP_DRAW:
+        case OP_BIN_TO_DEC:
+        case OP_STORE_REGS:
+        case OP_LOAD_REGS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ends_block(uint8_t kind) {
+    switch (kind) {
+        case OP_RETURN:
+        case OP_JUMP:
+        case OP_JUMP_OFFSET:
+        case OP_CALL:
+        case OP_SKIP_EQ_IMM:
+        case OP_SKIP_NEQ_IMM:
+        case OP_SKIP_EQ_REG:
+        case OP_SKIP_NEQ_REG:
+        case OP_SKIP_KEY:
+        case OP_SKIP_NOT_KEY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// emits a single instruction, the semantics (including the order in which VF and VX are written) follow the reference interpreter
+// unexecuted counts the instructions of the block behind this one
+static void translate_op(struct JitCache* cache, const struct DecodedOp* op, uint16_t pc, uint16_t unexecuted) {
+    switch (op->kind) {
+        case OP_SET_IMM: {
+            EMIT(cache, 0xc6, 0x46, REG_DISP(op->x), op->kk); // mov byte [vx], kk
+            break;
+        }
+        case OP_ADD_IMM: {
+            EMIT(cache, 0x80, 0x46, REG_DISP(op->x), op->kk); // add byte [vx], kk
+            break;
+        }
+        case OP_LOAD: {
+            load_eax(cache, REG_DISP(op->y));
+            store_al(cache, REG_DISP(op->x));
+            break;
+        }
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR: {
+            load_eax(cache, REG_DISP(op->x));
+            load_ecx(cache, REG_DISP(op->y));
+            EMIT(cache, op->kind == OP_OR ? 0x08 : op->kind == OP_AND ? 0x20 : 0x30, 0xc8); // or/and/xor al, cl
+            store_al(cache, REG_DISP(op->x));
+            if (cache->quirks & QUIRK_VF_RESET) EMIT(cache, 0xc6, 0x46, REG_DISP(0xf), 0x00); // mov byte [vf], 0
+            break;
+        }
+        case OP_ADD: {
+            load_eax(cache, REG_DISP(op->x));
+            load_ecx(cache, REG_DISP(op->y));
+            EMIT(cache, 0x00, 0xc8); // add al, cl
+            EMIT(cache, 0x0f, 0x92, 0xc1); // setc cl
+            EMIT(cache, 0x88, 0x4e, REG_DISP(0xf)); // mov [vf], cl
+            store_al(cache, REG_DISP(op->x));
+            break;
+        }
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_N: {
+            uint8_t minuend = op->kind == OP_SUBTRACT ? op->x : op->y;
+            uint8_t subtrahend = op->kind == OP_SUBTRACT ? op->y : op->x;
+            load_eax(cache, REG_DISP(minuend));
+            load_ecx(cache, REG_DISP(subtrahend));
+            EMIT(cache, 0x38, 0xc8); // cmp al, cl
+            EMIT(cache, 0x0f, 0x97, 0xc0); // seta al
+            store_al(cache, REG_DISP(0xf));
+            // the operands are read again since VF may be one of them
+            load_eax(cache, REG_DISP(minuend));
+            load_ecx(cache, REG_DISP(subtrahend));
+            EMIT(cache, 0x28, 0xc8); // sub al, cl
+            store_al(cache, REG_DISP(op->x));
+            break;
+        }
+        case OP_RIGHT_SHIFT:
+        case OP_LEFT_SHIFT: {
+            uint8_t source = cache->quirks & QUIRK_SHIFT_VY ? op->y : op->x;
+            load_eax(cache, REG_DISP(source));
+            if (op->kind == OP_RIGHT_SHIFT) {
+                EMIT(cache, 0x24, 0x01); // and al, 1
+            } else {
+                EMIT(cache, 0xc0, 0xe8, 0x07); // shr al, 7
+            }
+            store_al(cache, REG_DISP(0xf));
+            // read again, the source may be VF
+            load_eax(cache, REG_DISP(source));
+            EMIT(cache, 0xd0, op->kind == OP_RIGHT_SHIFT ? 0xe8 : 0xe0); // shr/shl al, 1
+            store_al(cache, REG_DISP(op->x));
+            break;
+        }
+        case OP_SET_INDEX: {
+            EMIT(cache, 0x66, 0xc7, 0x46, I_DISP, op->nnn & 0xff, op->nnn >> 8); // mov word [I], nnn
+            break;
+        }
+        case OP_SET_DELAY_TIMER: {
+            load_eax(cache, REG_DISP(op->x));
+            store_al(cache, DELAY_TIMER_DISP);
+            break;
+        }
+        case OP_SET_SOUND_TIMER: {
+            load_eax(cache, REG_DISP(op->x));
+            store_al(cache, SOUND_TIMER_DISP);
+            break;
+        }
+        case OP_DRAW: {
+            void (*draw)(struct MachineState*, uint8_t, uint8_t, uint8_t) =
+                    cache->quirks & QUIRK_WRAP_SPRITES ? wrap_sprite_data : read_sprite_data;
+            emit_call(cache, (uint64_t) (uintptr_t) draw, op->x, op->y, op->n);
+            break;
+        }
+        case OP_BIN_TO_DEC: {
+            emit_call(cache, (uint64_t) (uintptr_t) jit_store_bcd, op->x, 0, 0);
+            emit_exit_if_flushed(cache, pc, unexecuted);
+            break;
+        }
+        case OP_STORE_REGS: {
+            emit_call(cache, (uint64_t) (uintptr_t) jit_store_registers, op->x, 0, 0);
+            emit_exit_if_flushed(cache, pc, unexecuted);
+            break;
+        }
+        case OP_LOAD_REGS: {
+            EMIT(cache, 0x48, 0x8b, 0x4f, MEM_DISP); // mov rcx, [rdi + mem]
+            EMIT(cache, 0x0f, 0xb7, 0x56, I_DISP); // movzx edx, word [I]
+            for (uint8_t i = 0; i <= op->x; ++i) {
+                EMIT(cache, 0x8d, 0x42, i); // lea eax, [rdx + i]
+                EMIT(cache, 0x25, 0xff, 0x0f, 0x00, 0x00); // and eax, MEMORY_SIZE - 1
+                EMIT(cache, 0x0f, 0xb6, 0x04, 0x01); // movzx eax, byte [rcx + rax]
+                store_al(cache, REG_DISP(i));
+            }
+            uint8_t advance = cache->quirks & QUIRK_INDEX_INCREMENT ? op->x + 1 : cache->quirks & QUIRK_INDEX_ADD_X ? op->x : 0;
+            if (advance) EMIT(cache, 0x66, 0x83, 0x46, I_DISP, advance); // add word [I], advance
+            break;
+        }
+        case OP_ADD_TO_INDEX: {
+            load_eax(cache, REG_DISP(op->x));
+            EMIT(cache, 0x66, 0x03, 0x46, I_DISP); // add ax, [I]
+            EMIT(cache, 0x66, 0x89, 0x46, I_DISP); // mov [I], ax
+            if (!(cache->quirks & QUIRK_INDEX_OVERFLOW)) break;
+            EMIT(cache, 0x66, 0x3d, 0x00, 0x10); // cmp ax, 0x1000
+            EMIT(cache, 0x72, 0x04); // jb +4
+            EMIT(cache, 0xc6, 0x46, REG_DISP(0xf), 0x01); // mov byte [vf], 1
+            break;
+        }
+        case OP_FONT_CHARACTER: {
+            load_eax(cache, REG_DISP(op->x));
+            EMIT(cache, 0x83, 0xe0, 0x0f); // and eax, 0xf
+            EMIT(cache, 0x8d, 0x44, 0x80, FONT_MEMORY_OFFSET); // lea eax, [rax + rax * 4 + font]
+            EMIT(cache, 0x66, 0x89, 0x46, I_DISP); // mov [I], ax
+            break;
+        }
+        case OP_JUMP: {
+            emit_exit(cache, op->nnn);
+            break;
+        }
+        case OP_JUMP_OFFSET: {
+            load_eax(cache, REG_DISP(cache->quirks & QUIRK_JUMP_VX ? op->x : 0));
+            emit8(cache, 0x05); // add eax, nnn
+            emit32(cache, op->nnn);
+            emit_dynamic_exit(cache);
+            break;
+        }
+        case OP_CALL: {
+            // same overflow condition as stack_push_pc, the predecoded engine halts on it
+            EMIT(cache, 0x4c, 0x8b, 0x47, MEMORY_DISP); // mov r8, [rdi + memory]
+            EMIT(cache, 0x49, 0x8b, 0x80); // mov rax, [r8 + stack_pointer]
+            emit32(cache, STACK_POINTER_DISP);
+            EMIT(cache, 0x49, 0x8b, 0x88); // mov rcx, [r8 + stack_base_pointer]
+            emit32(cache, STACK_BASE_DISP);
+            EMIT(cache, 0x48, 0x81, 0xc1); // add rcx, (STACK_SIZE - sizeof(pc)) * sizeof(pc)
+            emit32(cache, (STACK_SIZE - sizeof(uint16_t*)) * sizeof(uint16_t*));
+            EMIT(cache, 0x48, 0x39, 0xc8); // cmp rax, rcx
+            size_t overflow = emit_jcc(cache, JCC_JA);
+            EMIT(cache, 0x48, 0x8b, 0x4f, MEM_DISP); // mov rcx, [rdi + mem]
+            EMIT(cache, 0x48, 0x81, 0xc1); // add rcx, pc + 2
+            emit32(cache, pc + 2);
+            EMIT(cache, 0x48, 0x89, 0x08); // mov [rax], rcx
+            EMIT(cache, 0x48, 0x83, 0xc0, 0x08); // add rax, 8
+            EMIT(cache, 0x49, 0x89, 0x80); // mov [r8 + stack_pointer], rax
+            emit32(cache, STACK_POINTER_DISP);
+            emit_exit(cache, op->nnn);
+            patch_rel32(cache, overflow, cache->used);
+            emit_bail(cache, pc, 1);
+            break;
+        }
+        case OP_RETURN: {
+            EMIT(cache, 0x4c, 0x8b, 0x47, MEMORY_DISP); // mov r8, [rdi + memory]
+            EMIT(cache, 0x49, 0x8b, 0x80); // mov rax, [r8 + stack_pointer]
+            emit32(cache, STACK_POINTER_DISP);
+            EMIT(cache, 0x49, 0x3b, 0x80); // cmp rax, [r8 + stack_base_pointer]
+            emit32(cache, STACK_BASE_DISP);
+            size_t underflow = emit_jcc(cache, JCC_JE);
+            // a return address the program overwrote with one outside the program area faults like underflowing
+            EMIT(cache, 0x48, 0x8b, 0x48, 0xf8); // mov rcx, [rax - 8]
+            EMIT(cache, 0x48, 0x2b, 0x4f, MEM_DISP); // sub rcx, [rdi + mem]
+            EMIT(cache, 0x48, 0x8d, 0x91); // lea rdx, [rcx - PROGRAM_OFFSET]
+            emit32(cache, (uint32_t) -PROGRAM_OFFSET);
+            EMIT(cache, 0x48, 0x81, 0xfa); // cmp rdx, PROGRAM_END - PROGRAM_OFFSET
+            emit32(cache, PROGRAM_END - PROGRAM_OFFSET);
+            size_t outside = emit_jcc(cache, JCC_JAE);
+            EMIT(cache, 0x48, 0x83, 0xe8, 0x08); // sub rax, 8
+            EMIT(cache, 0x49, 0x89, 0x80); // mov [r8 + stack_pointer], rax
+            emit32(cache, STACK_POINTER_DISP);
+            EMIT(cache, 0x48, 0xc7, 0x00, 0, 0, 0, 0); // mov qword [rax], 0, like stack_pop_pc
+            EMIT(cache, 0x48, 0x89, 0xc8); // mov rax, rcx
+            emit_dynamic_exit(cache);
+            // the interpreter then halts on the instruction with stack_fault set
+            patch_rel32(cache, underflow, cache->used);
+            patch_rel32(cache, outside, cache->used);
+            emit_bail(cache, pc, 1);
+            break;
+        }
+        case OP_SKIP_EQ_IMM:
+        case OP_SKIP_NEQ_IMM:
+        case OP_SKIP_EQ_REG:
+        case OP_SKIP_NEQ_REG:
+        case OP_SKIP_KEY:
+        case OP_SKIP_NOT_KEY: {
+            uint8_t condition;
+            if (op->kind == OP_SKIP_EQ_IMM || op->kind == OP_SKIP_NEQ_IMM) {
+                EMIT(cache, 0x80, 0x7e, REG_DISP(op->x), op->kk); // cmp byte [vx], kk
+                condition = op->kind == OP_SKIP_EQ_IMM ? JCC_JE : JCC_JNE;
+            } else if (op->kind == OP_SKIP_KEY || op->kind == OP_SKIP_NOT_KEY) {
+                EMIT(cache, 0x48, 0x8b, 0x47, STATE_DISP); // mov rax, [rdi + state]
+                EMIT(cache, 0x0f, 0xb7, 0x80); // movzx eax, word [rax + keypad]
+                emit32(cache, KEYPAD_DISP);
+                load_ecx(cache, REG_DISP(op->x));
+                EMIT(cache, 0x83, 0xe1, 0x0f); // and ecx, 0xf
+                EMIT(cache, 0x0f, 0xa3, 0xc8); // bt eax, ecx
+                condition = op->kind == OP_SKIP_KEY ? JCC_JB : JCC_JAE;
+            } else {
+                load_eax(cache, REG_DISP(op->x));
+                EMIT(cache, 0x3a, 0x46, REG_DISP(op->y)); // cmp al, [vy]
+                condition = op->kind == OP_SKIP_EQ_REG ? JCC_JE : JCC_JNE;
+            }
+            size_t skip = emit_jcc(cache, condition);
+            emit_exit(cache, pc + 2);
+            patch_rel32(cache, skip, cache->used);
+            emit_exit(cache, pc + 4);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static struct JitBlock* translate_block(struct JitCache* cache, const uint8_t* mem, uint16_t start) {
+    struct DecodedOp ops[JIT_MAX_BLOCK_INSTRUCTIONS];
+    uint16_t length = 0;
+    uint16_t pc = start;
+    while (length < JIT_MAX_BLOCK_INSTRUCTIONS) {
+        if (pc < PROGRAM_OFFSET || pc >= PROGRAM_END || cache->written[pc] || cache->written[pc + 1]) break;
+        decode_op(&ops[length], mem, pc);
+        if (!is_translatable(ops[length].kind)) break;
+        pc += 2;
+        if (ends_block(ops[length++].kind)) break;
+    }
+    if (length == 0) {
+        return &untranslatable;
+    }
+    if (cache->block_count == JIT_MAX_BLOCKS || cache->used + JIT_MAX_BLOCK_BYTES > JIT_BUFFER_SIZE) {
+        flush_jit_cache(cache);
+    }
+
+    struct JitBlock* block = &cache->blocks[cache->block_count++];
+    block->code = (JitBlockCode) (cache->buffer + cache->used);
+    block->start = start;
+    block->length = length;
+
+    // a block only runs if the whole block fits into the remaining budget
+    EMIT(cache, 0x48, 0x81, 0x7f, BUDGET_DISP); // cmp qword [rdi + budget], length
+    emit32(cache, length);
+    size_t too_few_cycles = emit_jcc(cache, JCC_JL);
+    EMIT(cache, 0x48, 0x81, 0x6f, BUDGET_DISP); // sub qword [rdi + budget], length
+    emit32(cache, length);
+
+    pc = start;
+    for (int i = 0; i < length; ++i, pc += 2) {
+        translate_op(cache, &ops[i], pc, length - i - 1);
+    }
+    if (!ends_block(ops[length - 1].kind)) {
+        emit_exit(cache, pc);
+    }
+    patch_rel32(cache, too_few_cycles, cache->used);
+    emit_return_pc(cache, start);
+
+    memset(cache->covered + start, 1, pc - start);
+    cache->block_at[start] = block;
+
+    // turn exits waiting for this block (including its own back edges) into direct jumps
+    for (size_t i = 0; i < cache->patch_count;) {
+        if (cache->patches[i].target != start) {
+            ++i;
+            continue;
+        }
+        size_t offset = cache->patches[i].offset;
+        cache->buffer[offset] = 0xe9;
+        patch_rel32(cache, offset + 1, (uint8_t*) block->code - cache->buffer);
+        cache->patches[i] = cache->patches[--cache->patch_count];
+    }
+    return block;
+}
+
+// consecutive instructions from pc that do not start a translation, the predecoded engine runs them in one call
+// the run ends with BNNN, EX9E or EXA1 (when written to), behind those pc is not known
+static uint64_t untranslatable_run(struct JitCache* cache, const uint8_t* mem, uint16_t pc) {
+    uint64_t length = 0;
+    struct DecodedOp op;
+    while (length < JIT_MAX_BLOCK_INSTRUCTIONS && pc >= PROGRAM_OFFSET && pc < PROGRAM_END) {
+        if (cache->block_at[pc] && cache->block_at[pc] != &untranslatable) break;
+        decode_op(&op, mem, pc);
+        if (is_translatable(op.kind) && !cache->written[pc] && !cache->written[pc + 1]) break;
+        ++length;
+        if (op.kind == OP_JUMP_OFFSET || op.kind == OP_SKIP_KEY || op.kind == OP_SKIP_NOT_KEY) break;
+        pc += 2;
+    }
+    return length ? length : 1;
+}
+
+uint64_t run_jit(struct MachineState* state, uint64_t max_cycles) {
+    if (!state->jit) state->jit = create_jit_cache();
+    struct JitCache* cache = state->jit;
+    if (!cache->buffer) return run_predecoded(state, max_cycles);
+    if (cache->quirks != state->quirks) {
+        flush_jit_cache(cache);
+        cache->quirks = state->quirks;
+    }
+
+    struct JitContext ctx;
+    ctx.budget = max_cycles > INT64_MAX ? INT64_MAX : (int64_t) max_cycles;
+    ctx.mem = state->mem.mem;
+    ctx.memory = &state->mem;
+    ctx.state = state;
+    int64_t initial_budget = ctx.budget;
+    uint64_t pc = (uint8_t*) state->rf.pc - ctx.mem;
+
+    bool interpret_next = false;
+    // FX07 and FX0A are left to the predecoded engine, which blocks and detects idling
+    while (ctx.budget > 0 && pc >= PROGRAM_OFFSET && pc < PROGRAM_END) {
+        struct JitBlock* block = cache->block_at[pc];
+        if (!block) {
+            block = translate_block(cache, ctx.mem, pc);
+            cache->block_at[pc] = block;
+            if (block == &untranslatable) cache->runs[pc] = (uint8_t) untranslatable_run(cache, ctx.mem, pc);
+        }
+        if (!interpret_next && block != &untranslatable && block->length <= ctx.budget) {
+            pc = block->code(&ctx, &state->rf);
+            interpret_next = pc & JIT_INTERPRET_NEXT;
+            pc &= ~JIT_INTERPRET_NEXT;
+            continue;
+        }
+        // a bail out runs the one instruction, untranslatable ones run up to the next translation and the last
+        // cycles that do not fit a whole block all go to the predecoded engine at once
+        uint64_t run = interpret_next ? 1 : block == &untranslatable ? cache->runs[pc] : ctx.budget;
+        interpret_next = false;
+        state->rf.pc = ADDRESS_TO_PC(state, pc);
+        uint64_t executed = run_predecoded(state, run < (uint64_t) ctx.budget ? run : (uint64_t) ctx.budget);
+        if (executed == 0) break;
+        ctx.budget -= (int64_t) executed;
+        pc = (uint8_t*) state->rf.pc - ctx.mem;
+        if (machine_blocked(state) || state->stack_fault) break;
+    }
+    state->rf.pc = (uint16_t*) (ctx.mem + pc);
+    return initial_budget - ctx.budget;
+}
+
+#else
+
+struct JitCache {
+    int unused;
+};
+
+uint64_t run_jit(struct MachineState* state, uint64_t max_cycles) {
+    return run_predecoded(state, max_cycles);
+}
+
+void reset_jit_cache(struct JitCache* cache) {
+    (void) cache;
+}
+
+void jit_note_write(struct JitCache* cache, uint16_t address) {
+    (void) cache;
+    (void) address;
+}
+
+void delete_jit_cache(struct JitCache** cache) {
+    (void) cache;
+}
+
+#endif
@@ -1,28 +1,320 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "CHIP-8.h"
+#include "batch.h"
+#include "trace.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "timer.h"
+#include "rom.h"
+#include "handoff.h"
+#include "analysis.h"
 
 #define MAX_PATH_LEN 4096
+#define DEFAULT_BATCH_CYCLES 10000000
+
+// one line per ROM, in the order they were listed, one halted on a stack fault has no screen hash
+static void print_batch_results(const struct BatchJob* jobs, size_t job_count) {
+    printf("hash\tcycles\telapsed_us\tpath\n");
+    for (size_t i = 0; i < job_count; ++i) {
+        if (!jobs[i].loaded) {
+            printf("-\t-\t-\t%s\n", jobs[i].path);
+            continue;
+        }
+        if (jobs[i].stack_fault) {
+            printf("fault\t%llu\t%lld\t%s\n", (unsigned long long) jobs[i].cycles, (long long) (jobs[i].elapsed_ns / 1000),
+                   jobs[i].path);
+            continue;
+        }
+        printf("%016llx\t%llu\t%lld\t%s\n", (unsigned long long) jobs[i].screen_hash, (unsigned long long) jobs[i].cycles,
+               (long long) (jobs[i].elapsed_ns / 1000), jobs[i].path);
+    }
+}
+
+// the folded call stacks go next to the report, for flamegraph.pl
+static void write_profiler_report(const struct Profiler* profiler, const char* path) {
+    char folded_path[MAX_PATH_LEN + 8];
+    snprintf(folded_path, sizeof(folded_path), "%s.folded", path);
+    FILE* report = fopen(path, "w");
+    FILE* folded = fopen(folded_path, "w");
+    if (report == NULL || folded == NULL) {
+        fprintf(stderr, "Could not write the profile to %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    write_profile(profiler, report, folded);
+    fclose(report);
+    fclose(folded);
+}
+
+// the control flow graph goes next to the listing, for Graphviz
+static void write_analysis(const struct RomAnalysis* analysis, const uint8_t* data, const char* path) {
+    char dot_path[MAX_PATH_LEN + 8];
+    snprintf(dot_path, sizeof(dot_path), "%s.dot", path);
+    FILE* listing = fopen(path, "w");
+    FILE* graph = fopen(dot_path, "w");
+    if (listing == NULL || graph == NULL) {
+        fprintf(stderr, "Could not write the analysis to %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    write_disassembly(analysis, data, listing);
+    write_cfg_dot(analysis, graph);
+    fclose(listing);
+    fclose(graph);
+}
+
+// indexes the directory, refreshing its cache, and lists what it found
+static void run_library_mode(const char* path) {
+    struct RomLibrary* library = open_rom_library(path);
+    printf("hash\tsize\tprofile\tcode\tblocks\tindirect\tself_modifying\tconfined\tpath\n");
+    for (size_t i = 0; i < library->count; ++i) {
+        const struct RomInfo* rom = &library->roms[i];
+        if (!rom->valid) {
+            printf("-\t%llu\t-\t-\t-\t-\t-\t-\t%s\n", (unsigned long long) rom->size, rom->path);
+            continue;
+        }
+        printf("%016llx\t%llu\t%s\t%u\t%u\t%u\t%u\t%s\t%s\n", (unsigned long long) rom->hash,
+               (unsigned long long) rom->size, quirks_profile_name(rom->quirks), rom->analysis.code_bytes,
+               rom->analysis.blocks, rom->analysis.indirect_jumps, rom->analysis.self_modifying_stores,
+               rom->analysis.pc_confined ? "yes" : "no", rom->path);
+    }
+    fprintf(stderr, "%zu ROMs, %zu from the cache\n", library->count, library->cached);
+    delete_rom_library(&library);
+}
+
+static void run_batch_mode(const char* path, enum ExecutionEngine engine, uint32_t instructions_per_frame,
+                           uint64_t max_cycles, unsigned threads, uint32_t seed, const enum QuirksProfile* quirks) {
+    size_t count;
+    struct BatchJob* jobs = collect_batch_jobs(path, &count);
+    for (size_t i = 0; i < count; ++i) {
+        jobs[i].seed = seed;
+        jobs[i].quirks_given = quirks != NULL;
+        if (quirks) jobs[i].quirks = *quirks;
+    }
+    struct BatchOptions options = {engine, instructions_per_frame, max_cycles, threads};
+    run_batch(jobs, count, &options);
+    print_batch_results(jobs, count);
+    free_batch_jobs(jobs, count);
+}
+
+// runs a recorded session at full speed, the output is the same on every engine unless the machine diverged
+static bool run_replay_mode(struct MachineState* state, const char* log_path, const uint8_t* binary, size_t size) {
+    struct InputLog* log = load_input_log(log_path);
+    if (!log) {
+        fprintf(stderr, "Could not read the replay %s.\n", log_path);
+        exit(EXIT_FAILURE);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool matches = replay_input_log(state, log, binary, size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t elapsed = nanoseconds_between(&start, &end);
+    printf("%s\t%016llx\t%llu cycles\t%llu frames\t%lld us\t%.1f MIPS\n", matches ? "match" : "diverged",
+           (unsigned long long) hash_screen(&state->screen), (unsigned long long) state->cycles,
+           (unsigned long long) log->header.frames, (long long) (elapsed / 1000),
+           elapsed > 0 ? state->cycles * 1000.0 / elapsed : 0.0);
+    delete_input_log(&log);
+    return matches;
+}
+
+static bool parse_quirks_profile(const char* name, enum QuirksProfile* profile) {
+    for (int i = 0; i < QUIRKS_PROFILE_COUNT; ++i) {
+        if (strcmp(name, quirks_profile_name(i)) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_mode(const char* name, enum MachineMode* mode) {
+    for (int i = MODE_CHIP_8; i <= MODE_XO_CHIP; ++i) {
+        if (strcmp(name, machine_mode_name(i)) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
 
 int main(int argc, char** argv) {
-    if (argc != 2 || strlen(argv[1]) > MAX_PATH_LEN) {
-        printf("Usage:\n\ncrispychip <Path to CHIP-8 executable>\n\n");
+    bool headless = false;
+    enum ExecutionEngine engine = ENGINE_PREDECODED;
+    uint32_t instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    bool batch = false;
+    bool library = false;
+    uint64_t max_cycles = DEFAULT_BATCH_CYCLES;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cores > 0 ? (unsigned) cores : 1;
+    uint32_t seed = DEFAULT_RANDOM_SEED;
+    const char* trace_path = NULL;
+    const char* profile_path = NULL;
+    uint32_t rewind_seconds = 0;
+    bool turbo = false;
+    uint32_t frame_skip = DEFAULT_TURBO_FRAME_SKIP;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    const char* wav_path = NULL;
+    const char* analyze_path = NULL;
+    enum MachineMode mode = MODE_CHIP_8;
+    bool detect_mode = true;
+    enum QuirksProfile quirks = QUIRKS_MODERN;
+    bool quirks_given = false;
+    int arg = 1;
+    for (; arg < argc - 1; ++arg) {
+        if (strcmp(argv[arg], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[arg], "--interpreter") == 0) {
+            engine = ENGINE_INTERPRETER;
+        } else if (strcmp(argv[arg], "--jit") == 0) {
+            engine = ENGINE_JIT;
+        } else if (strcmp(argv[arg], "--mode") == 0 && arg + 1 < argc - 1 && parse_mode(argv[arg + 1], &mode)) {
+            detect_mode = false;
+            ++arg;
+        } else if (strcmp(argv[arg], "--quirks") == 0 && arg + 1 < argc - 1 &&
+                   parse_quirks_profile(argv[arg + 1], &quirks)) {
+            quirks_given = true;
+            ++arg;
+        } else if (strcmp(argv[arg], "--ipf") == 0 && arg + 1 < argc - 1) {
+            instructions_per_frame = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc - 1) {
+            trace_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc - 1) {
+            profile_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--rewind") == 0 && arg + 1 < argc - 1) {
+            rewind_seconds = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--turbo") == 0) {
+            turbo = true;
+        } else if (strcmp(argv[arg], "--frame-skip") == 0 && arg + 1 < argc - 1) {
+            frame_skip = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--record") == 0 && arg + 1 < argc - 1) {
+            record_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--wav") == 0 && arg + 1 < argc - 1) {
+            wav_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--replay") == 0 && arg + 1 < argc - 1) {
+            replay_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--analyze") == 0 && arg + 1 < argc - 1) {
+            analyze_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[arg], "--library") == 0) {
+            library = true;
+        } else if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc - 1) {
+            max_cycles = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc - 1) {
+            threads = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc - 1) {
+            seed = strtoul(argv[++arg], NULL, 10);
+        } else {
+            break;
+        }
+    }
+    // a rewound session cannot be replayed forwards, and the audio of a headless run is written in real time
+    bool conflicting = (record_path && (rewind_seconds || replay_path)) || (wav_path && (!headless || replay_path));
+    if (arg != argc - 1 || strlen(argv[argc - 1]) > MAX_PATH_LEN || conflicting) {
+        printf("Usage:\n\ncrispychip [--headless [--wav <audio file>]] [--mode chip-8 | schip | xo-chip] [--quirks modern | schip | xo-chip | cosmac-vip | chip-48] [--interpreter | --jit] [--ipf <instructions per frame>] [--trace <binary trace file>] [--profile <report file>] [--rewind <seconds> | --record <input log>] [--turbo] [--frame-skip <n>] <Path to CHIP-8 executable>\n");
+        printf("crispychip --replay <input log> [--interpreter | --jit] [--trace <binary trace file>] [--profile <report file>] <Path to CHIP-8 executable>\n");
+        printf("crispychip --batch [--quirks <profile>] [--interpreter | --jit] [--ipf <instructions per frame>] [--cycles <per ROM>] [--threads <count>] [--seed <random seed>] <ROM directory or list file>\n");
+        printf("crispychip --library <ROM directory>\n");
+        printf("crispychip --analyze <listing file> [--mode chip-8 | schip | xo-chip] <Path to CHIP-8 executable>\n\n");
+        exit(EXIT_FAILURE);
+    }
+    if (library) {
+        run_library_mode(argv[argc - 1]);
+        return 0;
+    }
+    if (batch) {
+        run_batch_mode(argv[argc - 1], engine, instructions_per_frame, max_cycles, threads, seed,
+                       quirks_given ? &quirks : NULL);
+        return 0;
+    }
+    struct Rom rom;
+    if (!map_rom(argv[argc - 1], &rom)) {
+        fprintf(stderr, "Could not load %s, it has to hold between 1 and %d bytes.\n", argv[argc - 1], MAX_XO_BINARY_LENGTH);
         exit(EXIT_FAILURE);
     }
-    FILE* file = fopen(argv[1], "rb");
-    if (file == NULL) {
-        fprintf(stderr, "File not found.");
+    // without --mode the ROM's instructions decide
+    if (detect_mode) mode = quirks_profile_mode(detect_quirks_profile(rom.data, rom.size));
+    if (rom.size > max_program_length(mode)) {
+        fprintf(stderr, "%s does not fit into the memory of %s.\n", argv[argc - 1], machine_mode_name(mode));
+        exit(EXIT_FAILURE);
+    }
+    // the machine runs without checking pc if the analysis shows it cannot leave the code
+    struct RomAnalysis* analysis = analyze_rom(rom.data, rom.size, mode);
+    if (analyze_path) {
+        write_analysis(analysis, rom.data, analyze_path);
+        delete_rom_analysis(&analysis);
+        unmap_rom(&rom);
+        return 0;
+    }
+    if (mode == MODE_XO_CHIP && rewind_seconds) {
+        fprintf(stderr, "Rewinding does not cover the memory of xo-chip.\n");
         exit(EXIT_FAILURE);
     }
-    fseek(file, 0L, SEEK_END);
-    size_t size = ftell(file);
-    rewind(file);
-    uint8_t binary[size];
-    fread(binary, sizeof(uint8_t), size, file);
 
-    struct MachineState* state = create_machine();
-    run_machine(state, binary, size);
+    struct Frontend* frontend;
+    if (wav_path) {
+        frontend = create_wav_frontend(wav_path);
+        if (frontend == NULL) {
+            fprintf(stderr, "Could not open %s for writing.\n", wav_path);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        frontend = headless || replay_path ? create_null_frontend() : create_sdl_frontend();
+    }
+    struct MachineState* state = create_machine(frontend);
+    // the mode brings its default quirks, --quirks overrides them
+    set_machine_mode(state, mode);
+    if (quirks_given) set_quirks_profile(state, quirks);
+    state->engine = engine;
+    state->instructions_per_frame = instructions_per_frame;
+    // tab toggles turbo while running
+    state->turbo = turbo;
+    state->turbo_frame_skip = frame_skip;
+    struct TraceBuffer* trace = NULL;
+    if (trace_path && (trace = start_trace(trace_path)) == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", trace_path);
+        exit(EXIT_FAILURE);
+    }
+    state->trace = trace;
+    struct Profiler* profiler = profile_path ? create_profiler() : NULL;
+    state->profiler = profiler;
+    // hold backspace to go back in time
+    struct Rewind* rewind = rewind_seconds ? create_rewind(rewind_seconds * FRAME_RATE) : NULL;
+    state->rewind = rewind;
+    struct InputLog* recorder = record_path ? create_input_log() : NULL;
+    state->recorder = recorder;
+    state->analysis = analysis;
+    bool replayed = true;
+    if (replay_path) {
+        replayed = run_replay_mode(state, replay_path, rom.data, rom.size);
+    } else if (headless) {
+        run_machine(state, rom.data, rom.size);
+    } else {
+        // a slow present or window event must not hold up the machine
+        run_machine_threaded(state, rom.data, rom.size);
+    }
+    bool stack_fault = state->stack_fault;
+    if (stack_fault) {
+        fprintf(stderr, "Stack fault (overflow, underflow or invalid return address) at 0x%03x.\n", (unsigned) ((uint8_t*) state->rf.pc - state->mem.mem));
+    }
+    if (recorder) {
+        finish_input_log(recorder, state);
+        if (!save_input_log(recorder, record_path)) fprintf(stderr, "Could not write the replay %s.\n", record_path);
+        delete_input_log(&recorder);
+    }
+    delete_rewind(&rewind);
+    stop_trace(&trace);
+    if (profiler) {
+        write_profiler_report(profiler, profile_path);
+        delete_profiler(&profiler);
+    }
     delete_machine(&state);
-    return 0;
+    delete_frontend(&frontend);
+    delete_rom_analysis(&analysis);
+    unmap_rom(&rom);
+    return replayed && !stack_fault ? 0 : EXIT_FAILURE;
 }
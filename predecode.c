@@ -0,0 +1,141 @@
+#include "predecode.h"
+#include "CHIP-8-internal.h"
+#include "timer.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+// computed goto is a GNU extension, other compilers get a plain switch over the same handlers
+#if defined(__GNUC__)
+#define THREADED_DISPATCH
+#endif
+
+void invalidate_decode_cache(struct DecodeCache* cache, uint16_t address, uint16_t length) {
+    // an instruction starting one byte earlier also covers address
+    uint32_t start = address > 0 ? address - 1 : 0;
+    uint32_t end = (uint32_t) address + length;
+    if (end > MEMORY_SIZE) end = MEMORY_SIZE;
+    for (uint32_t i = start; i < end; ++i) {
+        cache->ops[i].kind = OP_UNDECODED;
+        cache->ops[i].handler = cache->undecoded_handler;
+    }
+}
+
+void decode_op(struct DecodedOp* op, const uint8_t* mem, uint16_t address) {
+    if (address < PROGRAM_OFFSET || address >= PROGRAM_END) {
+        op->kind = OP_HALT;
+        return;
+    }
+    uint16_t instruction = (uint16_t) (mem[address] << 8 | mem[address + 1]);
+    op->x = GET_NIBBLE(instruction, 1);
+    op->y = GET_NIBBLE(instruction, 2);
+    op->n = GET_NIBBLE(instruction, 3);
+    op->kk = MASK_NIBBLES(instruction, 2);
+    op->nnn = MASK_NIBBLES(instruction, 1);
+    op->kind = OP_UNKNOWN;
+
+    // mirrors the switch in execute_instruction_cycle, which stays the reference
+    switch (GET_NIBBLE(instruction, 0)) {
+        case CLEAR_OR_RETURN_NIBBLE: {
+            // any other 0NNN stays OP_UNKNOWN and is skipped
+            if (instruction == CLEAR_SCREEN_INSTRUCTION) {
+                op->kind = OP_CLEAR;
+            } else if (instruction == RETURN_INSTRUCTION) {
+                op->kind = OP_RETURN;
+            }
+            break;
+        }
+        case JUMP_NIBBLE: op->kind = OP_JUMP; break;
+        case CALL_SUBROUTINE_NIBBLE: op->kind = OP_CALL; break;
+        case SKIP_IF_EQ_IMM: op->kind = OP_SKIP_EQ_IMM; break;
+        case SKIP_IF_NEQ_IMM: op->kind = OP_SKIP_NEQ_IMM; break;
+        case SKIP_IF_EQ_REG: op->kind = OP_SKIP_EQ_REG; break;
+        case SET_REGISTER_NIBBLE: op->kind = OP_SET_IMM; break;
+        case ADD_IMMEDIATE_NIBBLE: op->kind = OP_ADD_IMM; break;
+        case ARITH_LOGIC_NIBBLE: {
+            switch (op->n) {
+                case LOAD_NIBBLE: op->kind = OP_LOAD; break;
+                case OR_NIBBLE: op->kind = OP_OR; break;
+                case AND_NIBBLE: op->kind = OP_AND; break;
+                case XOR_NIBBLE: op->kind = OP_XOR; break;
+                case ADD_NIBBLE: op->kind = OP_ADD; break;
+                case SUBTRACT_NIBBLE: op->kind = OP_SUBTRACT; break;
+                case RIGHT_SHIFT_NIBBLE: op->kind = OP_RIGHT_SHIFT; break;
+                case SUBTRACT_N_NIBBLE: op->kind = OP_SUBTRACT_N; break;
+                case LEFT_SHIFT_NIBBLE: op->kind = OP_LEFT_SHIFT; break;
+                default: break;
+            }
+            break;
+        }
+        case SKIP_IF_NE_NIBBLE: op->kind = OP_SKIP_NEQ_REG; break;
+        case SET_INDEX_REG_NIBBLE: op->kind = OP_SET_INDEX; break;
+        case JUMP_OFFSET_NIBBLE: op->kind = OP_JUMP_OFFSET; break;
+        case GENERATE_RANDOM_NIBBLE: op->kind = OP_RANDOM; break;
+        case DRAW_NIBBLE: op->kind = OP_DRAW; break;
+        case SKIP_IF_KEY_NIBBLE: {
+            if (op->kk == SKIP_IF_KEY_END_BYTE) {
+                op->kind = OP_SKIP_KEY;
+            } else if (op->kk == SKIP_IF_NOT_KEY_END_BYTE) {
+                op->kind = OP_SKIP_NOT_KEY;
+            }
+            break;
+        }
+        case MISCELLANEOUS_NIBBLE: {
+            switch (op->kk) {
+                case SET_REG_TO_DEL_TIMER_BYTE: op->kind = OP_GET_DELAY_TIMER; break;
+                case SET_DEL_TIMER_BYTE: op->kind = OP_SET_DELAY_TIMER; break;
+                case SET_SOUND_TIMER_BYTE: op->kind = OP_SET_SOUND_TIMER; break;
+                case ADD_TO_INDEX_BYTE: op->kind = OP_ADD_TO_INDEX; break;
+                case GET_KEY_BYTE: op->kind = OP_GET_KEY; break;
+                case FONT_CHARACTER_BYTE: op->kind = OP_FONT_CHARACTER; break;
+                case BIN_TO_DEC_BYTE: op->kind = OP_BIN_TO_DEC; break;
+                case STORE_REGS_TO_MEM_BYTE: op->kind = OP_STORE_REGS; break;
+                case LOAD_REGS_FROM_MEM_BYTE: op->kind = OP_LOAD_REGS; break;
+                default: break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+#ifdef THREADED_DISPATCH
+#define HANDLER(kind) handle_##kind
+#define DISPATCH() do { if (cycles == max_cycles) goto out; ++cycles; op = &ops[pc]; goto *op->handler; } while (0)
+#define REDISPATCH() goto *op->handler
+#else
+#define HANDLER(kind) case kind
+#define DISPATCH() continue
+#define REDISPATCH() do { --cycles; continue; } while (0)
+#endif
+
+// one dispatch loop per quirks profile, see predecode_loop.h
+#define PREDECODE_LOOP run_predecoded_modern
+#define PREDECODE_QUIRKS QUIRKS_MODERN_FLAGS
+#include "predecode_loop.h"
+
+#define PREDECODE_LOOP run_predecoded_schip
+#define PREDECODE_QUIRKS QUIRKS_SCHIP_FLAGS
+#include "predecode_loop.h"
+
+#define PREDECODE_LOOP run_predecoded_xo_chip
+#define PREDECODE_QUIRKS QUIRKS_XO_CHIP_FLAGS
+#include "predecode_loop.h"
+
+#define PREDECODE_LOOP run_predecoded_cosmac_vip
+#define PREDECODE_QUIRKS QUIRKS_COSMAC_VIP_FLAGS
+#include "predecode_loop.h"
+
+#define PREDECODE_LOOP run_predecoded_chip_48
+#define PREDECODE_QUIRKS QUIRKS_CHIP_48_FLAGS
+#include "predecode_loop.h"
+
+uint64_t run_predecoded(struct MachineState* state, uint64_t max_cycles) {
+    switch (state->quirks_profile) {
+#define PREDECODE_DISPATCH(profile, name, flags) case profile: return run_predecoded_##name(state, max_cycles);
+        FOR_EACH_QUIRKS_PROFILE(PREDECODE_DISPATCH)
+#undef PREDECODE_DISPATCH
+        default: return run_predecoded_modern(state, max_cycles);
+    }
+}
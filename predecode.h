@@ -0,0 +1,72 @@
+#ifndef CHIP_8_PREDECODE_H
+#define CHIP_8_PREDECODE_H
+
+#include "CHIP-8.h"
+
+enum OpKind {
+    OP_UNDECODED,
+    OP_HALT, // pc outside of the program area
+    OP_UNKNOWN,
+    OP_CLEAR,
+    OP_RETURN,
+    OP_JUMP,
+    OP_CALL,
+    OP_SKIP_EQ_IMM,
+    OP_SKIP_NEQ_IMM,
+    OP_SKIP_EQ_REG,
+    OP_SET_IMM,
+    OP_ADD_IMM,
+    OP_LOAD,
+    OP_OR,
+    OP_AND,
+    OP_XOR,
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_RIGHT_SHIFT,
+    OP_SUBTRACT_N,
+    OP_LEFT_SHIFT,
+    OP_SKIP_NEQ_REG,
+    OP_SET_INDEX,
+    OP_JUMP_OFFSET,
+    OP_RANDOM,
+    OP_DRAW,
+    OP_SKIP_KEY,
+    OP_SKIP_NOT_KEY,
+    OP_GET_DELAY_TIMER,
+    OP_SET_DELAY_TIMER,
+    OP_SET_SOUND_TIMER,
+    OP_ADD_TO_INDEX,
+    OP_GET_KEY,
+    OP_FONT_CHARACTER,
+    OP_BIN_TO_DEC,
+    OP_STORE_REGS,
+    OP_LOAD_REGS,
+    OP_COUNT
+};
+
+// one instruction with its operands already extracted
+struct DecodedOp {
+    const void* handler; // dispatch target for kind, bound by the dispatch loop
+    uint16_t nnn;
+    uint8_t kind;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t kk;
+};
+
+// decodings are indexed by byte address, since jumps may land on odd addresses
+// a zeroed cache is empty and unbound, the machine keeps it in its own allocation
+struct DecodeCache {
+    struct DecodedOp ops[MEMORY_SIZE];
+    const void* undecoded_handler;
+    const void* const* handlers; // table of the dispatch loop the handler pointers belong to, NULL if unbound
+};
+
+extern void decode_op(struct DecodedOp* op, const uint8_t* mem, uint16_t address);
+// drops decodings of every instruction overlapping [address, address + length)
+extern void invalidate_decode_cache(struct DecodeCache* cache, uint16_t address, uint16_t length);
+// runs the loop specialized for the machine's quirks profile
+extern uint64_t run_predecoded(struct MachineState* state, uint64_t max_cycles);
+
+#endif //CHIP_8_PREDECODE_H
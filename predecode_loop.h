@@ -0,0 +1,311 @@
+// The body of a predecoded dispatch loop, included by predecode.c once per quirks profile. Before each
+// inclusion PREDECODE_LOOP names the function and PREDECODE_QUIRKS holds the profile's QUIRK_* bits, which are
+// constant here, so every quirk test is resolved by the compiler and the handlers only contain their profile's
+// variant. There is no include guard on purpose.
+
+#define SHIFT_SOURCE (PREDECODE_QUIRKS & QUIRK_SHIFT_VY ? op->y : op->x)
+#define ADVANCE_INDEX() do { \
+    if (PREDECODE_QUIRKS & QUIRK_INDEX_INCREMENT) rf->I += op->x + 1; \
+    else if (PREDECODE_QUIRKS & QUIRK_INDEX_ADD_X) rf->I += op->x; \
+} while (0)
+// A branch with a dispatch on either side. Computing pc from the comparison would make every later operand fetch
+// wait for the register, a predicted branch lets execution run ahead.
+#define SKIP_IF(condition) if (condition) { pc += 4; DISPATCH(); } else { pc += 2; DISPATCH(); }
+
+static uint64_t PREDECODE_LOOP(struct MachineState* state, uint64_t max_cycles) {
+    struct DecodeCache* cache = state->decode_cache;
+    struct DecodedOp* ops = cache->ops;
+    struct RegisterFile* rf = &state->rf;
+    uint8_t* mem = state->mem.mem;
+    uint8_t* v = rf->d_reg;
+    uint16_t pc = PC_ADDRESS(state);
+    uint64_t cycles = 0;
+    struct DecodedOp* op;
+
+    if (pc >= MEMORY_SIZE || machine_blocked(state) || state->stack_fault) return 0;
+
+#ifdef THREADED_DISPATCH
+    static const void* const handlers[OP_COUNT] = {
+            [OP_UNDECODED] = &&HANDLER(OP_UNDECODED),
+            [OP_HALT] = &&HANDLER(OP_HALT),
+            [OP_UNKNOWN] = &&HANDLER(OP_UNKNOWN),
+            [OP_CLEAR] = &&HANDLER(OP_CLEAR),
+            [OP_RETURN] = &&HANDLER(OP_RETURN),
+            [OP_JUMP] = &&HANDLER(OP_JUMP),
+            [OP_CALL] = &&HANDLER(OP_CALL),
+            [OP_SKIP_EQ_IMM] = &&HANDLER(OP_SKIP_EQ_IMM),
+            [OP_SKIP_NEQ_IMM] = &&HANDLER(OP_SKIP_NEQ_IMM),
+            [OP_SKIP_EQ_REG] = &&HANDLER(OP_SKIP_EQ_REG),
+            [OP_SET_IMM] = &&HANDLER(OP_SET_IMM),
+            [OP_ADD_IMM] = &&HANDLER(OP_ADD_IMM),
+            [OP_LOAD] = &&HANDLER(OP_LOAD),
+            [OP_OR] = &&HANDLER(OP_OR),
+            [OP_AND] = &&HANDLER(OP_AND),
+            [OP_XOR] = &&HANDLER(OP_XOR),
+            [OP_ADD] = &&HANDLER(OP_ADD),
+            [OP_SUBTRACT] = &&HANDLER(OP_SUBTRACT),
+            [OP_RIGHT_SHIFT] = &&HANDLER(OP_RIGHT_SHIFT),
+            [OP_SUBTRACT_N] = &&HANDLER(OP_SUBTRACT_N),
+            [OP_LEFT_SHIFT] = &&HANDLER(OP_LEFT_SHIFT),
+            [OP_SKIP_NEQ_REG] = &&HANDLER(OP_SKIP_NEQ_REG),
+            [OP_SET_INDEX] = &&HANDLER(OP_SET_INDEX),
+            [OP_JUMP_OFFSET] = &&HANDLER(OP_JUMP_OFFSET),
+            [OP_RANDOM] = &&HANDLER(OP_RANDOM),
+            [OP_DRAW] = &&HANDLER(OP_DRAW),
+            [OP_SKIP_KEY] = &&HANDLER(OP_SKIP_KEY),
+            [OP_SKIP_NOT_KEY] = &&HANDLER(OP_SKIP_NOT_KEY),
+            [OP_GET_DELAY_TIMER] = &&HANDLER(OP_GET_DELAY_TIMER),
+            [OP_SET_DELAY_TIMER] = &&HANDLER(OP_SET_DELAY_TIMER),
+            [OP_SET_SOUND_TIMER] = &&HANDLER(OP_SET_SOUND_TIMER),
+            [OP_ADD_TO_INDEX] = &&HANDLER(OP_ADD_TO_INDEX),
+            [OP_GET_KEY] = &&HANDLER(OP_GET_KEY),
+            [OP_FONT_CHARACTER] = &&HANDLER(OP_FONT_CHARACTER),
+            [OP_BIN_TO_DEC] = &&HANDLER(OP_BIN_TO_DEC),
+            [OP_STORE_REGS] = &&HANDLER(OP_STORE_REGS),
+            [OP_LOAD_REGS] = &&HANDLER(OP_LOAD_REGS),
+    };
+    // label addresses only exist inside this function, so the cache is bound to the loop that last ran it
+    if (cache->handlers != handlers) {
+        for (int i = 0; i < MEMORY_SIZE; ++i) {
+            ops[i].handler = handlers[ops[i].kind];
+        }
+        cache->undecoded_handler = handlers[OP_UNDECODED];
+        cache->handlers = handlers;
+    }
+
+    DISPATCH();
+#else
+    for (;;) {
+        if (cycles == max_cycles) goto out;
+        ++cycles;
+        op = &ops[pc];
+        switch (op->kind) {
+#endif
+        HANDLER(OP_UNDECODED): {
+            decode_op(op, mem, pc);
+#ifdef THREADED_DISPATCH
+            op->handler = handlers[op->kind];
+#endif
+            REDISPATCH();
+        }
+        HANDLER(OP_HALT): {
+            --cycles;
+            goto out;
+        }
+        HANDLER(OP_UNKNOWN): {
+            TRACE_ERROR("Instruction 0x%x not implemented!\n", mem[pc] << 8 | mem[pc + 1]);
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_CLEAR): {
+            memset(state->screen.rows[0], 0, SCREEN_HEIGHT * sizeof(uint64_t));
+            state->screen.dirty_rows = ALL_ROWS_DIRTY;
+            state->side_effects++;
+            pc += 2;
+            DISPATCH();
+        }
+        // the stack slots can be overwritten by the program, stack_pop_pc only returns addresses with a decoding
+        HANDLER(OP_RETURN): {
+            uint16_t* return_address = stack_pop_pc(state);
+            if (!return_address) goto out;
+            pc = (uint16_t) ((uint8_t*) return_address - mem);
+            DISPATCH();
+        }
+        HANDLER(OP_JUMP): {
+            pc = op->nnn;
+            DISPATCH();
+        }
+        HANDLER(OP_CALL): {
+            rf->pc = ADDRESS_TO_PC(state, pc);
+            if (!stack_push_pc(state)) goto out;
+            pc = op->nnn;
+            DISPATCH();
+        }
+        HANDLER(OP_SKIP_EQ_IMM): {
+            SKIP_IF(v[op->x] == op->kk);
+        }
+        HANDLER(OP_SKIP_NEQ_IMM): {
+            SKIP_IF(v[op->x] != op->kk);
+        }
+        HANDLER(OP_SKIP_EQ_REG): {
+            SKIP_IF(v[op->x] == v[op->y]);
+        }
+        HANDLER(OP_SET_IMM): {
+            v[op->x] = op->kk;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_ADD_IMM): {
+            v[op->x] += op->kk;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_LOAD): {
+            v[op->x] = v[op->y];
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_OR): {
+            v[op->x] |= v[op->y];
+            if (PREDECODE_QUIRKS & QUIRK_VF_RESET) v[0xf] = 0;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_AND): {
+            v[op->x] &= v[op->y];
+            if (PREDECODE_QUIRKS & QUIRK_VF_RESET) v[0xf] = 0;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_XOR): {
+            v[op->x] ^= v[op->y];
+            if (PREDECODE_QUIRKS & QUIRK_VF_RESET) v[0xf] = 0;
+            pc += 2;
+            DISPATCH();
+        }
+        // the flag is written before the result, exactly like the reference interpreter
+        HANDLER(OP_ADD): {
+            uint16_t res = v[op->x] + v[op->y];
+            v[0xf] = res > 0xff;
+            v[op->x] = (uint8_t) res;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_SUBTRACT): {
+            v[0xf] = v[op->x] > v[op->y];
+            v[op->x] = v[op->x] - v[op->y];
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_RIGHT_SHIFT): {
+            v[0xf] = v[SHIFT_SOURCE] & 0x1;
+            v[op->x] = v[SHIFT_SOURCE] >> 1;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_SUBTRACT_N): {
+            v[0xf] = v[op->y] > v[op->x];
+            v[op->x] = v[op->y] - v[op->x];
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_LEFT_SHIFT): {
+            v[0xf] = (v[SHIFT_SOURCE] >> 7) & 0x1;
+            v[op->x] = v[SHIFT_SOURCE] << 1;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_SKIP_NEQ_REG): {
+            SKIP_IF(v[op->x] != v[op->y]);
+        }
+        HANDLER(OP_SET_INDEX): {
+            rf->I = op->nnn;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_JUMP_OFFSET): {
+            pc = op->nnn + v[PREDECODE_QUIRKS & QUIRK_JUMP_VX ? op->x : 0];
+            // the target can lie past the end of memory, where there is no decoding to dispatch to
+            if (pc >= MEMORY_SIZE) goto out;
+            DISPATCH();
+        }
+        HANDLER(OP_RANDOM): {
+            v[op->x] = random_byte(state) & op->kk;
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_DRAW): {
+            if (PREDECODE_QUIRKS & QUIRK_WRAP_SPRITES) {
+                wrap_sprite_data(state, op->x, op->y, op->n);
+            } else {
+                read_sprite_data(state, op->x, op->y, op->n);
+            }
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_SKIP_KEY): {
+            SKIP_IF(key_down(state, v[op->x]));
+        }
+        HANDLER(OP_SKIP_NOT_KEY): {
+            SKIP_IF(!key_down(state, v[op->x]));
+        }
+        HANDLER(OP_GET_DELAY_TIMER): {
+            v[op->x] = rf->delay_timer;
+            note_delay_timer_read(state, pc);
+            pc += 2;
+            if (state->waiting_for_timer) goto out;
+            DISPATCH();
+        }
+        HANDLER(OP_SET_DELAY_TIMER): {
+            rf->delay_timer = v[op->x];
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_SET_SOUND_TIMER): {
+            rf->sound_timer = v[op->x];
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_ADD_TO_INDEX): {
+            rf->I += v[op->x];
+            if ((PREDECODE_QUIRKS & QUIRK_INDEX_OVERFLOW) && rf->I >= 0x1000) {
+                v[0xf] = 1;
+            }
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_GET_KEY): {
+            if (!take_key_press(state, &v[op->x])) {
+                state->waiting_for_key = true;
+                goto out;
+            }
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_FONT_CHARACTER): {
+            rf->I = FONT_MEMORY_OFFSET + (v[op->x] & 0xf) * BYTES_PER_FONT_CHARACTER;
+            pc += 2;
+            DISPATCH();
+        }
+        // stores may overwrite the running code, write_memory drops the stale decodings
+        HANDLER(OP_BIN_TO_DEC): {
+            uint8_t value = v[op->x];
+            write_memory(state, rf->I, value / 100);
+            write_memory(state, rf->I + 1, value / 10 % 10);
+            write_memory(state, rf->I + 2, value % 10);
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_STORE_REGS): {
+            for (int i = 0; i <= op->x; ++i) {
+                write_memory(state, rf->I + i, v[i]);
+            }
+            ADVANCE_INDEX();
+            pc += 2;
+            DISPATCH();
+        }
+        HANDLER(OP_LOAD_REGS): {
+            for (int i = 0; i <= op->x; ++i) {
+                v[i] = mem[(rf->I + i) & (MEMORY_SIZE - 1)];
+            }
+            ADVANCE_INDEX();
+            pc += 2;
+            DISPATCH();
+        }
+#ifndef THREADED_DISPATCH
+            default:
+                goto out;
+        }
+    }
+#endif
+
+out:
+    rf->pc = ADDRESS_TO_PC(state, pc);
+    return cycles;
+}
+
+#undef SHIFT_SOURCE
+#undef ADVANCE_INDEX
+#undef SKIP_IF
+#undef PREDECODE_LOOP
+#undef PREDECODE_QUIRKS
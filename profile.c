@@ -0,0 +1,224 @@
+#include "profile.h"
+#include "CHIP-8-internal.h"
+#include "predecode.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CALL_NODES 4096
+#define MAX_CALL_DEPTH STACK_SIZE
+#define HOT_ADDRESSES 20
+#define ROOT_NODE 0
+
+// One node per distinct call path. Instructions are counted on the node of the subroutine they run in, which
+// gives the folded stacks directly. Once the tree is full, deeper paths are counted on their caller.
+struct CallNode {
+    uint16_t address; // entry point of the subroutine
+    uint16_t parent;
+    uint16_t first_child;
+    uint16_t next_sibling;
+    uint64_t instructions;
+};
+
+struct Profiler {
+    uint64_t instructions;
+    uint64_t kinds[OP_COUNT];
+    uint64_t addresses[MEMORY_SIZE];
+    uint64_t draws;
+
+    uint64_t frames;
+    int64_t frame_time_total;
+    int64_t frame_time_min;
+    int64_t frame_time_max;
+
+    struct CallNode nodes[MAX_CALL_NODES];
+    uint16_t node_count;
+    uint16_t call_stack[MAX_CALL_DEPTH]; // the node of every active subroutine
+    uint16_t call_depth;
+    uint16_t overflowed_calls; // calls that were counted on their caller
+};
+
+static const char* const kind_names[OP_COUNT] = {
+    [OP_UNDECODED] = "undecoded",
+    [OP_HALT] = "halt",
+    [OP_UNKNOWN] = "unknown",
+    [OP_CLEAR] = "00E0 clear",
+    [OP_RETURN] = "00EE return",
+    [OP_JUMP] = "1NNN jump",
+    [OP_CALL] = "2NNN call",
+    [OP_SKIP_EQ_IMM] = "3XNN skip eq",
+    [OP_SKIP_NEQ_IMM] = "4XNN skip neq",
+    [OP_SKIP_EQ_REG] = "5XY0 skip eq reg",
+    [OP_SET_IMM] = "6XNN set",
+    [OP_ADD_IMM] = "7XNN add",
+    [OP_LOAD] = "8XY0 load",
+    [OP_OR] = "8XY1 or",
+    [OP_AND] = "8XY2 and",
+    [OP_XOR] = "8XY3 xor",
+    [OP_ADD] = "8XY4 add",
+    [OP_SUBTRACT] = "8XY5 subtract",
+    [OP_RIGHT_SHIFT] = "8XY6 shift right",
+    [OP_SUBTRACT_N] = "8XY7 subtract n",
+    [OP_LEFT_SHIFT] = "8XYE shift left",
+    [OP_SKIP_NEQ_REG] = "9XY0 skip neq reg",
+    [OP_SET_INDEX] = "ANNN set index",
+    [OP_JUMP_OFFSET] = "BNNN jump offset",
+    [OP_RANDOM] = "CXNN random",
+    [OP_DRAW] = "DXYN draw",
+    [OP_SKIP_KEY] = "EX9E skip key",
+    [OP_SKIP_NOT_KEY] = "EXA1 skip not key",
+    [OP_GET_DELAY_TIMER] = "FX07 get delay",
+    [OP_SET_DELAY_TIMER] = "FX15 set delay",
+    [OP_SET_SOUND_TIMER] = "FX18 set sound",
+    [OP_ADD_TO_INDEX] = "FX1E add index",
+    [OP_GET_KEY] = "FX0A get key",
+    [OP_FONT_CHARACTER] = "FX29 font",
+    [OP_BIN_TO_DEC] = "FX33 bcd",
+    [OP_STORE_REGS] = "FX55 store",
+    [OP_LOAD_REGS] = "FX65 load",
+};
+
+struct Profiler* create_profiler() {
+    struct Profiler* profiler = calloc(1, sizeof(struct Profiler));
+    if (!profiler) {
+        exit(EXIT_FAILURE);
+    }
+    profiler->nodes[ROOT_NODE].address = PROGRAM_OFFSET;
+    profiler->node_count = 1;
+    profiler->frame_time_min = INT64_MAX;
+    return profiler;
+}
+
+static uint16_t enter_subroutine(struct Profiler* profiler, uint16_t parent, uint16_t address) {
+    for (uint16_t child = profiler->nodes[parent].first_child; child != ROOT_NODE; child = profiler->nodes[child].next_sibling) {
+        if (profiler->nodes[child].address == address) return child;
+    }
+    if (profiler->node_count == MAX_CALL_NODES) return parent;
+    uint16_t node = profiler->node_count++;
+    profiler->nodes[node].address = address;
+    profiler->nodes[node].parent = parent;
+    profiler->nodes[node].next_sibling = profiler->nodes[parent].first_child;
+    profiler->nodes[parent].first_child = node;
+    return node;
+}
+
+void profile_instruction(struct Profiler* profiler, const struct MachineState* state) {
+    uint16_t address = PC_ADDRESS(state);
+    struct DecodedOp op;
+    decode_op(&op, state->mem.mem, address);
+    profiler->instructions++;
+    profiler->kinds[op.kind]++;
+    profiler->addresses[address & (MEMORY_SIZE - 1)]++;
+
+    uint16_t current = profiler->call_depth ? profiler->call_stack[profiler->call_depth - 1] : ROOT_NODE;
+    profiler->nodes[current].instructions++;
+    switch (op.kind) {
+        case OP_DRAW: {
+            profiler->draws++;
+            break;
+        }
+        case OP_CALL: {
+            if (profiler->call_depth == MAX_CALL_DEPTH) {
+                profiler->overflowed_calls++;
+                break;
+            }
+            profiler->call_stack[profiler->call_depth++] = enter_subroutine(profiler, current, op.nnn);
+            break;
+        }
+        case OP_RETURN: {
+            // an unbalanced return leaves the root in place
+            if (profiler->call_depth) profiler->call_depth--;
+            break;
+        }
+    }
+}
+
+void profile_frame(struct Profiler* profiler, int64_t nanoseconds) {
+    profiler->frames++;
+    profiler->frame_time_total += nanoseconds;
+    if (nanoseconds < profiler->frame_time_min) profiler->frame_time_min = nanoseconds;
+    if (nanoseconds > profiler->frame_time_max) profiler->frame_time_max = nanoseconds;
+}
+
+static void write_call_path(const struct Profiler* profiler, uint16_t node, FILE* folded) {
+    if (node != ROOT_NODE) {
+        write_call_path(profiler, profiler->nodes[node].parent, folded);
+        fprintf(folded, ";sub_%03x", profiler->nodes[node].address);
+    } else {
+        fprintf(folded, "main");
+    }
+}
+
+struct Count {
+    uint16_t index;
+    uint64_t count;
+};
+
+static int compare_counts_descending(const void* a, const void* b) {
+    uint64_t x = ((const struct Count*) a)->count;
+    uint64_t y = ((const struct Count*) b)->count;
+    return (x < y) - (x > y);
+}
+
+// indices of counts sorted by count, ties keep their order
+static void sort_counts(const uint64_t* counts, struct Count* sorted, uint16_t length) {
+    for (uint16_t i = 0; i < length; ++i) {
+        sorted[i].index = i;
+        sorted[i].count = counts[i];
+    }
+    qsort(sorted, length, sizeof(struct Count), compare_counts_descending);
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * (double) part / (double) total : 0;
+}
+
+void write_profile(const struct Profiler* profiler, FILE* report, FILE* folded) {
+    if (report) {
+        fprintf(report, "instructions %llu\n", (unsigned long long) profiler->instructions);
+        fprintf(report, "draw calls   %llu", (unsigned long long) profiler->draws);
+        if (profiler->frames) fprintf(report, " (%.2f per frame)", (double) profiler->draws / (double) profiler->frames);
+        fprintf(report, "\nframes       %llu\n", (unsigned long long) profiler->frames);
+        if (profiler->frames) {
+            fprintf(report, "frame time   avg %.1f us, min %.1f us, max %.1f us\n",
+                    (double) profiler->frame_time_total / (double) profiler->frames / 1000,
+                    (double) profiler->frame_time_min / 1000, (double) profiler->frame_time_max / 1000);
+        }
+        if (profiler->overflowed_calls) {
+            fprintf(report, "calls past the stack depth counted on their caller: %u\n", profiler->overflowed_calls);
+        }
+
+        struct Count kinds[OP_COUNT];
+        sort_counts(profiler->kinds, kinds, OP_COUNT);
+        fprintf(report, "\n%-20s %14s %8s\n", "opcode class", "count", "share");
+        for (int i = 0; i < OP_COUNT && kinds[i].count; ++i) {
+            fprintf(report, "%-20s %14llu %7.2f%%\n", kind_names[kinds[i].index], (unsigned long long) kinds[i].count,
+                    percent(kinds[i].count, profiler->instructions));
+        }
+
+        struct Count* addresses = malloc(MEMORY_SIZE * sizeof(struct Count));
+        if (!addresses) {
+            exit(EXIT_FAILURE);
+        }
+        sort_counts(profiler->addresses, addresses, MEMORY_SIZE);
+        fprintf(report, "\n%-8s %14s %8s\n", "address", "count", "share");
+        for (int i = 0; i < HOT_ADDRESSES && addresses[i].count; ++i) {
+            fprintf(report, "0x%03x    %14llu %7.2f%%\n", addresses[i].index, (unsigned long long) addresses[i].count,
+                    percent(addresses[i].count, profiler->instructions));
+        }
+        free(addresses);
+    }
+    if (folded) {
+        for (uint16_t node = 0; node < profiler->node_count; ++node) {
+            if (!profiler->nodes[node].instructions) continue;
+            write_call_path(profiler, node, folded);
+            fprintf(folded, " %llu\n", (unsigned long long) profiler->nodes[node].instructions);
+        }
+    }
+}
+
+void delete_profiler(struct Profiler** profiler) {
+    if (!(*profiler)) return;
+
+    free(*profiler);
+    *profiler = NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef CHIP_8_PROFILE_H
+#define CHIP_8_PROFILE_H
+
+#include "CHIP-8.h"
+#include <stdio.h>
+
+struct Profiler;
+
+extern struct Profiler* create_profiler();
+// counts the instruction at pc before it executes, called only while state->profiler is set
+extern void profile_instruction(struct Profiler* profiler, const struct MachineState* state);
+// time spent emulating and presenting one frame, without the sleep until the next one
+extern void profile_frame(struct Profiler* profiler, int64_t nanoseconds);
+// a summary with opcode classes and hot addresses, and the call stacks in the folded format of flamegraph.pl
+extern void write_profile(const struct Profiler* profiler, FILE* report, FILE* folded);
+extern void delete_profiler(struct Profiler** profiler);
+
+#endif //CHIP_8_PROFILE_H
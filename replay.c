@@ -0,0 +1,154 @@
+#include "replay.h"
+#include "CHIP-8.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_ENTRIES 256
+
+static uint64_t hash_program(const struct MachineState* state) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t end = state->mode == MODE_XO_CHIP ? XO_MEMORY_SIZE : STACK_OFFSET;
+    for (size_t i = 0; i < end; ++i) {
+        hash ^= state->mem.mem[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct InputLog* create_input_log() {
+    struct InputLog* log = calloc(1, sizeof(struct InputLog));
+    if (!log) {
+        exit(EXIT_FAILURE);
+    }
+    log->header.magic = REPLAY_MAGIC;
+    log->header.version = REPLAY_VERSION;
+    return log;
+}
+
+static void append_entry(struct InputLog* log, const struct ReplayEntry* entry) {
+    if (log->header.entries == log->capacity) {
+        log->capacity = log->capacity ? log->capacity * 2 : INITIAL_ENTRIES;
+        log->entries = realloc(log->entries, log->capacity * sizeof(struct ReplayEntry));
+        if (!log->entries) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    log->entries[log->header.entries++] = *entry;
+}
+
+void record_frame_start(struct InputLog* log, const struct MachineState* state) {
+    if (log->header.frames == 0) {
+        // the program was just loaded
+        log->header.seed = state->random_state;
+        log->header.instructions_per_frame = state->instructions_per_frame;
+        log->header.mode = state->mode;
+        log->header.quirks = state->quirks_profile;
+        log->header.program_hash = hash_program(state);
+        log->ticks = state->elapsed_ticks;
+        log->keypad = 0;
+        log->key_presses = 0;
+    }
+    uint64_t ticks = state->elapsed_ticks - log->ticks;
+    uint64_t expected_ticks = log->header.frames == 0 ? 0 : 1;
+    if (ticks != expected_ticks || state->keypad != log->keypad || state->key_presses != log->key_presses) {
+        struct ReplayEntry entry = {log->header.frames, state->cycles, (uint32_t) ticks, state->keypad,
+                                    state->key_presses};
+        append_entry(log, &entry);
+    }
+}
+
+void record_frame_end(struct InputLog* log, const struct MachineState* state) {
+    log->header.frames++;
+    log->header.cycles = state->cycles;
+    log->ticks = state->elapsed_ticks;
+    log->keypad = state->keypad;
+    log->key_presses = state->key_presses;
+}
+
+void finish_input_log(struct InputLog* log, const struct MachineState* state) {
+    log->header.screen_hash = hash_screen(&state->screen);
+}
+
+bool save_input_log(const struct InputLog* log, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    bool written = fwrite(&log->header, sizeof(struct ReplayHeader), 1, file) == 1 &&
+                   fwrite(log->entries, sizeof(struct ReplayEntry), log->header.entries, file) == log->header.entries;
+    return fclose(file) == 0 && written;
+}
+
+// the header comes from an arbitrary file, nothing in it is trusted before it was checked
+static bool valid_header(const struct ReplayHeader* header, long entry_bytes) {
+    return header->magic == REPLAY_MAGIC && header->version == REPLAY_VERSION && header->mode <= MODE_XO_CHIP &&
+           header->quirks < QUIRKS_PROFILE_COUNT && header->entries <= (uint64_t) entry_bytes / sizeof(struct ReplayEntry);
+}
+
+struct InputLog* load_input_log(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    struct InputLog* log = create_input_log();
+    // the entries cannot be more than the rest of the file holds
+    long entry_bytes = -1;
+    if (fread(&log->header, sizeof(struct ReplayHeader), 1, file) == 1 && fseek(file, 0, SEEK_END) == 0) {
+        entry_bytes = ftell(file) - (long) sizeof(struct ReplayHeader);
+    }
+    if (entry_bytes < 0 || !valid_header(&log->header, entry_bytes) ||
+        fseek(file, sizeof(struct ReplayHeader), SEEK_SET) != 0) {
+        fclose(file);
+        delete_input_log(&log);
+        return NULL;
+    }
+    log->capacity = log->header.entries;
+    log->entries = malloc(log->capacity * sizeof(struct ReplayEntry));
+    if ((log->capacity && !log->entries) ||
+        fread(log->entries, sizeof(struct ReplayEntry), log->header.entries, file) != log->header.entries) {
+        delete_input_log(&log);
+    }
+    fclose(file);
+    return log;
+}
+
+// the same frame sequence run_machine goes through, with the outside world taken from the log
+bool replay_input_log(struct MachineState* state, const struct InputLog* log, const uint8_t* binary, size_t binary_size) {
+    struct InputLog* recorder = state->recorder;
+    state->recorder = NULL;
+    set_machine_mode(state, (enum MachineMode) log->header.mode);
+    set_quirks_profile(state, (enum QuirksProfile) log->header.quirks);
+    load_program(state, binary, binary_size);
+    seed_random(state, log->header.seed);
+    state->instructions_per_frame = log->header.instructions_per_frame;
+    bool following = hash_program(state) == log->header.program_hash;
+
+    uint64_t next = 0;
+    for (uint64_t frame = 0; following && frame < log->header.frames; ++frame) {
+        const struct ReplayEntry* entry = next < log->header.entries ? &log->entries[next] : NULL;
+        if (entry && entry->frame == frame) {
+            if (entry->cycle != state->cycles) {
+                following = false;
+                break;
+            }
+            tick_timers(state, entry->ticks);
+            state->keypad = entry->keypad;
+            state->key_presses = entry->key_presses;
+            next++;
+        } else if (frame > 0) {
+            tick_timers(state, 1);
+        }
+        reset_idle_detection(state);
+        state->waiting_for_key = false;
+        run_cycles(state, state->instructions_per_frame);
+    }
+    state->recorder = recorder;
+    return following && state->cycles == log->header.cycles &&
+           hash_screen(&state->screen) == log->header.screen_hash;
+}
+
+void delete_input_log(struct InputLog** log) {
+    if (!(*log)) return;
+
+    free((*log)->entries);
+    free(*log);
+    *log = NULL;
+}
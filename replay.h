@@ -0,0 +1,69 @@
+#ifndef CHIP_8_REPLAY_H
+#define CHIP_8_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A recorded session is everything that reaches the machine from outside: the random seed, the keypad and
+// the timer ticks. Every run_cycles call is one frame. A frame only gets an entry when something differs
+// from a plain emulated frame, i.e. the keypad or pending key presses changed since the previous frame ended
+// or the timers did not tick exactly once in between. Replaying the entries headlessly, without any wall
+// clock, reproduces the session instruction for instruction on every engine. The file holds a ReplayHeader
+// followed by the ReplayEntries in host byte order.
+#define REPLAY_MAGIC 0x50523843U // "C8RP"
+#define REPLAY_VERSION 3
+
+struct ReplayHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed; // random_state when the first frame started
+    uint32_t instructions_per_frame;
+    uint32_t mode; // MachineMode
+    uint32_t quirks; // QuirksProfile
+    uint64_t program_hash; // of the program memory when the first frame started
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t screen_hash; // when recording stopped
+    uint64_t entries;
+};
+
+struct ReplayEntry {
+    uint64_t frame;
+    uint64_t cycle; // instructions executed before the frame, checked while replaying
+    uint32_t ticks; // timer ticks since the previous frame ended
+    uint16_t keypad;
+    uint16_t key_presses;
+};
+
+_Static_assert(sizeof(struct ReplayEntry) == 24, "replay entries are written as fixed size blocks");
+
+struct MachineState;
+
+struct InputLog {
+    struct ReplayHeader header;
+    struct ReplayEntry* entries;
+    uint64_t capacity;
+
+    // what the previous frame left behind, only used while recording
+    uint64_t ticks;
+    uint16_t keypad;
+    uint16_t key_presses;
+};
+
+extern struct InputLog* create_input_log();
+// called by run_cycles around every frame while the log is attached as state->recorder
+extern void record_frame_start(struct InputLog* log, const struct MachineState* state);
+extern void record_frame_end(struct InputLog* log, const struct MachineState* state);
+// stores the final screen hash, call once recording is over
+extern void finish_input_log(struct InputLog* log, const struct MachineState* state);
+extern bool save_input_log(const struct InputLog* log, const char* path);
+// returns NULL if the file is missing, not a replay or damaged, or there is not enough memory for it
+extern struct InputLog* load_input_log(const char* path);
+// Loads the program into state and runs the recorded frames at full speed. Returns false and stops at the
+// first point where the machine no longer follows the recording, e.g. because a different ROM was given.
+extern bool replay_input_log(struct MachineState* state, const struct InputLog* log, const uint8_t* binary,
+                             size_t binary_size);
+extern void delete_input_log(struct InputLog** log);
+
+#endif //CHIP_8_REPLAY_H
@@ -0,0 +1,266 @@
+#include "rom.h"
+#include "CHIP-8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ROM_LIBRARY_HEADER "crispychip-library 2"
+
+bool map_rom(const char* path, struct Rom* rom) {
+    rom->data = NULL;
+    rom->size = 0;
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+    struct stat info;
+    bool fits = fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+                info.st_size <= MAX_XO_BINARY_LENGTH;
+    void* data = fits ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+    // the mapping keeps the file alive
+    close(file);
+    if (data == MAP_FAILED) return false;
+    rom->data = data;
+    rom->size = info.st_size;
+    return true;
+}
+
+void unmap_rom(struct Rom* rom) {
+    if (!rom->data) return;
+
+    munmap((void*) rom->data, rom->size);
+    rom->data = NULL;
+    rom->size = 0;
+}
+
+uint64_t hash_rom(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static enum QuirksProfile opcode_profile(uint16_t opcode) {
+    // F000 NNNN, 5XY2, 5XY3, FN01, F002, FX3A, 00DN
+    if (opcode == 0xF000 || (opcode & 0xF00E) == 0x5002 || (opcode & 0xF0FF) == 0xF001 || opcode == 0xF002 ||
+        (opcode & 0xF0FF) == 0xF03A || (opcode & 0xFFF0) == 0x00D0) {
+        return QUIRKS_XO_CHIP;
+    }
+    // 00CN, 00FB to 00FF, DXY0, FX30, FX75, FX85
+    if (((opcode & 0xFFF0) == 0x00C0 && (opcode & 0xF)) || (opcode >= 0x00FB && opcode <= 0x00FF) ||
+        (opcode & 0xF00F) == 0xD000 || (opcode & 0xF0FF) == 0xF030 || (opcode & 0xF0FF) == 0xF075 ||
+        (opcode & 0xF0FF) == 0xF085) {
+        return QUIRKS_SCHIP;
+    }
+    return QUIRKS_MODERN;
+}
+
+// Sprite data is full of bytes like 00 FF, so only instructions reachable from the entry point are looked
+// at. Computed jumps (BNNN) are not followed. The result is the default profile of the instruction set found,
+// the COSMAC VIP and CHIP-48 quirks leave no trace in the opcodes and have to be asked for.
+enum QuirksProfile detect_quirks_profile(const uint8_t* data, size_t size) {
+    uint8_t visited[XO_MEMORY_SIZE / 8] = {0};
+    // each visited instruction pushes at most three addresses, 32 bits wide since the ones behind an instruction
+    // at the very end of the largest ROM are past 0xFFFF
+    uint32_t* pending = malloc((3 * XO_MEMORY_SIZE + 1) * sizeof(uint32_t));
+    if (!pending) {
+        exit(EXIT_FAILURE);
+    }
+    size_t pending_count = 0;
+    enum QuirksProfile profile = QUIRKS_MODERN;
+    size_t end = PROGRAM_OFFSET + size;
+    pending[pending_count++] = PROGRAM_OFFSET;
+    while (pending_count) {
+        uint32_t address = pending[--pending_count];
+        while (address >= PROGRAM_OFFSET && (size_t) address + 1 < end &&
+               !(visited[address / 8] & (1U << (address % 8)))) {
+            visited[address / 8] |= 1U << (address % 8);
+            uint16_t opcode = data[address - PROGRAM_OFFSET] << 8 | data[address - PROGRAM_OFFSET + 1];
+            enum QuirksProfile needed = opcode_profile(opcode);
+            if (needed > profile) profile = needed;
+            uint32_t next = address + (opcode == 0xF000 ? 4 : 2);
+            uint8_t group = opcode >> 12;
+            if (opcode == 0x00EE || opcode == 0x00FD || group == 0xB) break;
+            if (group == 0x1) {
+                address = opcode & 0xFFF;
+                continue;
+            }
+            if (group == 0x2) pending[pending_count++] = opcode & 0xFFF;
+            // skips, over the 4 byte F000 NNNN as well
+            if (group == 0x3 || group == 0x4 || group == 0x5 || group == 0x9 ||
+                (group == 0xE && ((opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1))) {
+                pending[pending_count++] = next + 2;
+                if ((size_t) next + 1 < end && data[next - PROGRAM_OFFSET] == 0xF0 &&
+                    data[next - PROGRAM_OFFSET + 1] == 0x00) {
+                    pending[pending_count++] = next + 4;
+                }
+            }
+            address = next;
+        }
+    }
+    free(pending);
+    return profile;
+}
+
+static int compare_roms(const void* a, const void* b) {
+    return strcmp(((const struct RomInfo*) a)->path, ((const struct RomInfo*) b)->path);
+}
+
+static const char* rom_name(const struct RomInfo* rom, size_t directory_length) {
+    return rom->path + directory_length + 1;
+}
+
+static void append_rom(struct RomInfo** roms, size_t* count, size_t* capacity, const struct RomInfo* rom) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *roms = realloc(*roms, *capacity * sizeof(struct RomInfo));
+        if (!*roms) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*roms)[(*count)++] = *rom;
+}
+
+static char* join_path(const char* directory, const char* name) {
+    char* path = malloc(strlen(directory) + strlen(name) + 2);
+    if (!path) {
+        exit(EXIT_FAILURE);
+    }
+    sprintf(path, "%s/%s", directory, name);
+    return path;
+}
+
+// the cached entries sorted by path, an unreadable or outdated cache is simply empty
+static struct RomLibrary read_cache(const char* directory) {
+    struct RomLibrary cache = {NULL, 0, 0};
+    size_t capacity = 0;
+    char* cache_path = join_path(directory, ROM_LIBRARY_CACHE);
+    FILE* file = fopen(cache_path, "r");
+    free(cache_path);
+    if (!file) return cache;
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length = getline(&line, &line_capacity, file);
+    if (length > 0 && strcmp(line, ROM_LIBRARY_HEADER "\n") == 0) {
+        while ((length = getline(&line, &line_capacity, file)) != -1) {
+            if (length > 0 && line[length - 1] == '\n') line[--length] = '\0';
+            unsigned long long size, hash;
+            long long modified_ns;
+            int valid, quirks, pc_confined, name_start;
+            struct AnalysisSummary analysis;
+            if (sscanf(line, "%llu\t%lld\t%d\t%llx\t%d\t%u\t%u\t%u\t%u\t%u\t%d\t%n", &size, &modified_ns, &valid,
+                       &hash, &quirks, &analysis.code_bytes, &analysis.blocks, &analysis.indirect_jumps,
+                       &analysis.self_modifying_stores, &analysis.unresolved_stores, &pc_confined,
+                       &name_start) != 11 || name_start >= length) {
+                continue;
+            }
+            analysis.pc_confined = pc_confined;
+            struct RomInfo rom = {join_path(directory, line + name_start), size, modified_ns, valid, hash, quirks,
+                                  analysis};
+            append_rom(&cache.roms, &cache.count, &capacity, &rom);
+        }
+    }
+    free(line);
+    fclose(file);
+    if (cache.count) qsort(cache.roms, cache.count, sizeof(struct RomInfo), compare_roms);
+    return cache;
+}
+
+// written to a temporary file first so a concurrent reader never sees half an index, failing is harmless
+static void write_cache(const char* directory, const struct RomLibrary* library) {
+    char* cache_path = join_path(directory, ROM_LIBRARY_CACHE);
+    char* temporary_path = join_path(directory, ROM_LIBRARY_CACHE ".tmp");
+    FILE* file = fopen(temporary_path, "w");
+    if (file) {
+        size_t directory_length = strlen(directory);
+        fprintf(file, ROM_LIBRARY_HEADER "\n");
+        for (size_t i = 0; i < library->count; ++i) {
+            const struct RomInfo* rom = &library->roms[i];
+            const struct AnalysisSummary* analysis = &rom->analysis;
+            fprintf(file, "%llu\t%lld\t%d\t%016llx\t%d\t%u\t%u\t%u\t%u\t%u\t%d\t%s\n",
+                    (unsigned long long) rom->size, (long long) rom->modified_ns, rom->valid,
+                    (unsigned long long) rom->hash, rom->quirks, analysis->code_bytes, analysis->blocks, analysis->indirect_jumps,
+                    analysis->self_modifying_stores, analysis->unresolved_stores, analysis->pc_confined,
+                    rom_name(rom, directory_length));
+        }
+        if (fclose(file) != 0 || rename(temporary_path, cache_path) != 0) remove(temporary_path);
+    }
+    free(temporary_path);
+    free(cache_path);
+}
+
+struct RomLibrary* open_rom_library(const char* directory) {
+    DIR* listing = opendir(directory);
+    if (!listing) {
+        fprintf(stderr, "Could not open directory %s.\n", directory);
+        exit(EXIT_FAILURE);
+    }
+    struct RomLibrary* library = calloc(1, sizeof(struct RomLibrary));
+    if (!library) {
+        exit(EXIT_FAILURE);
+    }
+    struct RomLibrary cache = read_cache(directory);
+    size_t capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(listing)) != NULL) {
+        // skips the cache itself
+        if (entry->d_name[0] == '.') continue;
+        struct RomInfo rom = {join_path(directory, entry->d_name), 0, 0, false, 0, QUIRKS_MODERN, {0}};
+        struct stat info;
+        if (stat(rom.path, &info) != 0 || !S_ISREG(info.st_mode)) {
+            free(rom.path);
+            continue;
+        }
+        rom.size = info.st_size;
+        rom.modified_ns = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+
+        struct RomInfo* cached = cache.count ? bsearch(&rom, cache.roms, cache.count, sizeof(struct RomInfo),
+                                                        compare_roms) : NULL;
+        if (cached && cached->size == rom.size && cached->modified_ns == rom.modified_ns) {
+            rom.valid = cached->valid;
+            rom.hash = cached->hash;
+            rom.quirks = cached->quirks;
+            rom.analysis = cached->analysis;
+            library->cached++;
+        } else {
+            struct Rom contents;
+            rom.valid = map_rom(rom.path, &contents);
+            if (rom.valid) {
+                rom.hash = hash_rom(contents.data, contents.size);
+                rom.quirks = detect_quirks_profile(contents.data, contents.size);
+                struct RomAnalysis* analysis = analyze_rom(contents.data, contents.size,
+                                                           quirks_profile_mode(rom.quirks));
+                rom.analysis = analysis->summary;
+                delete_rom_analysis(&analysis);
+                unmap_rom(&contents);
+            }
+        }
+        append_rom(&library->roms, &library->count, &capacity, &rom);
+    }
+    closedir(listing);
+    if (library->count) qsort(library->roms, library->count, sizeof(struct RomInfo), compare_roms);
+    if (library->cached != library->count || library->count != cache.count) write_cache(directory, library);
+
+    for (size_t i = 0; i < cache.count; ++i) {
+        free(cache.roms[i].path);
+    }
+    free(cache.roms);
+    return library;
+}
+
+void delete_rom_library(struct RomLibrary** library) {
+    if (!(*library)) return;
+
+    for (size_t i = 0; i < (*library)->count; ++i) {
+        free((*library)->roms[i].path);
+    }
+    free((*library)->roms);
+    free(*library);
+    *library = NULL;
+}
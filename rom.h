@@ -0,0 +1,50 @@
+#ifndef CHIP_8_ROM_H
+#define CHIP_8_ROM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "CHIP-8.h"
+#include "analysis.h"
+
+// A read only mapping of a ROM file. The size is checked against the largest XO-CHIP program before anything is
+// mapped, load_program then copies straight from the page cache into the machine's memory.
+struct Rom {
+    const uint8_t* data;
+    size_t size;
+};
+
+// returns false if the file cannot be opened or is empty or too long for any mode's memory
+extern bool map_rom(const char* path, struct Rom* rom);
+extern void unmap_rom(struct Rom* rom);
+extern uint64_t hash_rom(const uint8_t* data, size_t size);
+// the instruction set a ROM was written for, guessed from the opcodes it contains
+extern enum QuirksProfile detect_quirks_profile(const uint8_t* data, size_t size);
+
+// One file of a ROM library directory. Files that cannot be loaded stay in the index as invalid, so they
+// aren't looked at again until they change.
+struct RomInfo {
+    char* path;
+    uint64_t size;
+    int64_t modified_ns;
+    bool valid;
+    uint64_t hash; // hash_rom of the contents
+    enum QuirksProfile quirks;
+    struct AnalysisSummary analysis; // of the ROM in the mode of quirks
+};
+
+// Every regular file of a directory, sorted by name. The index is cached in a file inside the directory and a
+// file whose size and modification time match its cached entry is neither mapped nor hashed again.
+struct RomLibrary {
+    struct RomInfo* roms;
+    size_t count;
+    size_t cached; // entries taken from the cache without reading the file
+};
+
+#define ROM_LIBRARY_CACHE ".crispychip-library"
+
+// rescans the directory and rewrites the cache if anything changed, exits if the directory cannot be read
+extern struct RomLibrary* open_rom_library(const char* directory);
+extern void delete_rom_library(struct RomLibrary** library);
+
+#endif //CHIP_8_ROM_H
@@ -0,0 +1,162 @@
+#include "CHIP-8-internal.h"
+#include <string.h>
+
+// The extended modes draw into one or two planes at 64x32 or 128x64. Rows are whole words, so scrolling
+// vertically moves words and scrolling horizontally shifts them, nothing here works pixel by pixel. CHIP-8
+// programs never get here, read_sprite_data and the 64x32 clear stay as they were.
+
+#define SCROLL_PIXELS 4
+
+void clear_screen(struct MachineState* state) {
+    struct Screen* screen = &state->screen;
+    if (state->mode == MODE_CHIP_8) {
+        memset(screen->rows[0], 0, SCREEN_HEIGHT * sizeof(uint64_t));
+    } else {
+        for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+            if (state->planes & (1U << plane)) memset(screen->rows[plane], 0, sizeof(screen->rows[plane]));
+        }
+    }
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
+
+// 00FE and 00FF, switching clears every plane
+void set_resolution(struct MachineState* state, bool hires) {
+    struct Screen* screen = &state->screen;
+    screen->width = hires ? HIRES_SCREEN_WIDTH : SCREEN_WIDTH;
+    screen->height = hires ? HIRES_SCREEN_HEIGHT : SCREEN_HEIGHT;
+    memset(screen->rows, 0, sizeof(screen->rows));
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
+
+// a row of up to 16 sprite bits, XORed in at x, returns whether a lit pixel was hit
+// with wrap the bits pushed past the right edge come back in on the left
+static uint64_t draw_row_64(uint64_t* row, uint16_t bits, uint8_t sprite_width, uint8_t x, bool wrap) {
+    uint64_t placed = (uint64_t) bits << (64 - sprite_width);
+    uint64_t sprite = placed >> x;
+    if (wrap && x) sprite |= placed << (64 - x);
+    uint64_t collision = *row & sprite;
+    *row ^= sprite;
+    return collision;
+}
+
+static uint64_t draw_row_128(uint64_t* row, uint16_t bits, uint8_t sprite_width, uint8_t x, bool wrap) {
+    unsigned __int128 placed = (unsigned __int128) bits << (128 - sprite_width);
+    unsigned __int128 sprite = placed >> x;
+    if (wrap && x) sprite |= placed << (128 - x);
+    uint64_t left = (uint64_t) (sprite >> 64);
+    uint64_t right = (uint64_t) sprite;
+    uint64_t collision = (row[0] & left) | (row[1] & right);
+    row[0] ^= left;
+    row[1] ^= right;
+    return collision;
+}
+
+// DXYN into every selected plane, DXY0 draws 16x16. Each plane takes the next sprite from I on, the start
+// position wraps and the sprite is clipped at the edges unless wrap is set.
+void draw_extended_sprite(struct MachineState* state, uint8_t x, uint8_t y, uint8_t n, bool wrap) {
+    struct Screen* screen = &state->screen;
+    uint8_t x_start = state->rf.d_reg[x] & (screen->width - 1);
+    uint8_t y_start = state->rf.d_reg[y] & (screen->height - 1);
+    uint8_t sprite_width = n == 0 ? 16 : 8;
+    uint8_t rows = n == 0 ? 16 : n;
+    uint8_t bytes_per_row = sprite_width / 8;
+    uint8_t visible = !wrap && rows > screen->height - y_start ? screen->height - y_start : rows;
+    uint8_t row_words = SCREEN_ROW_WORDS(screen);
+    uint16_t address = state->rf.I;
+    uint64_t collision = 0;
+    uint64_t dirty = 0;
+    for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!(state->planes & (1U << plane))) continue;
+        for (int row = 0; row < visible; ++row) {
+            uint8_t screen_row = (y_start + row) & (screen->height - 1);
+            uint16_t bits = state->mem.mem[(address + row * bytes_per_row) & state->address_mask];
+            if (bytes_per_row == 2) {
+                bits = bits << 8 | state->mem.mem[(address + row * bytes_per_row + 1) & state->address_mask];
+            }
+            uint64_t* words = screen->rows[plane] + screen_row * row_words;
+            if (row_words == 1) {
+                collision |= draw_row_64(words, bits, sprite_width, x_start, wrap);
+            } else {
+                collision |= draw_row_128(words, bits, sprite_width, x_start, wrap);
+            }
+            dirty |= 1ULL << screen_row;
+        }
+        address += rows * bytes_per_row;
+    }
+    state->rf.d_reg[0xf] = collision != 0;
+    state->side_effects++;
+    screen->dirty_rows |= dirty;
+}
+
+void scroll_screen_down(struct MachineState* state, uint8_t rows) {
+    struct Screen* screen = &state->screen;
+    if (rows > screen->height) rows = screen->height;
+    size_t shifted = (size_t) rows * SCREEN_ROW_WORDS(screen);
+    size_t kept = (size_t) (screen->height - rows) * SCREEN_ROW_WORDS(screen);
+    for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!(state->planes & (1U << plane))) continue;
+        memmove(screen->rows[plane] + shifted, screen->rows[plane], kept * sizeof(uint64_t));
+        memset(screen->rows[plane], 0, shifted * sizeof(uint64_t));
+    }
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
+
+void scroll_screen_up(struct MachineState* state, uint8_t rows) {
+    struct Screen* screen = &state->screen;
+    if (rows > screen->height) rows = screen->height;
+    size_t shifted = (size_t) rows * SCREEN_ROW_WORDS(screen);
+    size_t kept = (size_t) (screen->height - rows) * SCREEN_ROW_WORDS(screen);
+    for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!(state->planes & (1U << plane))) continue;
+        memmove(screen->rows[plane], screen->rows[plane] + shifted, kept * sizeof(uint64_t));
+        memset(screen->rows[plane] + kept, 0, shifted * sizeof(uint64_t));
+    }
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
+
+// the bits leaving the left word enter the right one
+void scroll_screen_right(struct MachineState* state) {
+    struct Screen* screen = &state->screen;
+    for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!(state->planes & (1U << plane))) continue;
+        uint64_t* words = screen->rows[plane];
+        if (SCREEN_ROW_WORDS(screen) == 1) {
+            for (int row = 0; row < screen->height; ++row) {
+                words[row] >>= SCROLL_PIXELS;
+            }
+            continue;
+        }
+        for (int row = 0; row < screen->height; ++row) {
+            uint64_t* pair = &words[row * 2];
+            pair[1] = pair[1] >> SCROLL_PIXELS | pair[0] << (64 - SCROLL_PIXELS);
+            pair[0] >>= SCROLL_PIXELS;
+        }
+    }
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
+
+void scroll_screen_left(struct MachineState* state) {
+    struct Screen* screen = &state->screen;
+    for (int plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!(state->planes & (1U << plane))) continue;
+        uint64_t* words = screen->rows[plane];
+        if (SCREEN_ROW_WORDS(screen) == 1) {
+            for (int row = 0; row < screen->height; ++row) {
+                words[row] <<= SCROLL_PIXELS;
+            }
+            continue;
+        }
+        for (int row = 0; row < screen->height; ++row) {
+            uint64_t* pair = &words[row * 2];
+            pair[0] = pair[0] << SCROLL_PIXELS | pair[1] >> (64 - SCROLL_PIXELS);
+            pair[1] <<= SCROLL_PIXELS;
+        }
+    }
+    screen->dirty_rows = ALL_ROWS_DIRTY;
+    state->side_effects++;
+}
@@ -0,0 +1,197 @@
+#include "snapshot.h"
+#include "CHIP-8-internal.h"
+#include "predecode.h"
+#include "jit.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct RewindFrame {
+    struct CoreSnapshot core;
+    uint16_t saved_pages; // pages stored to since this capture
+    uint8_t pages[REWIND_PAGES][REWIND_PAGE_SIZE]; // their contents at the time of the capture
+};
+
+struct Rewind {
+    struct RewindFrame* frames;
+    uint32_t capacity;
+    uint32_t head; // where the next capture goes
+    uint32_t count;
+};
+
+_Static_assert(REWIND_PAGES <= 16, "saved_pages has one bit per page");
+
+static void save_core(const struct MachineState* state, struct CoreSnapshot* core) {
+    const struct RegisterFile* rf = &state->rf;
+    memcpy(core->d_reg, rf->d_reg, sizeof(core->d_reg));
+    core->pc = PC_ADDRESS(state);
+    core->I = rf->I;
+    core->delay_timer = rf->delay_timer;
+    core->sound_timer = rf->sound_timer;
+    core->stack_depth = (uint8_t) (state->mem.stack_pointer - state->mem.stack_base_pointer);
+    for (int i = 0; i < core->stack_depth; ++i) {
+        // a slot the program overwrote holds no address, 0 faults on return just the same
+        const uint16_t* address = state->mem.stack_base_pointer[i];
+        bool valid = address >= ADDRESS_TO_PC(state, PROGRAM_OFFSET) &&
+                     address < ADDRESS_TO_PC(state, program_end(state));
+        core->stack[i] = valid ? (uint16_t) ((const uint8_t*) address - state->mem.mem) : 0;
+    }
+    // unused slots are cleared so equal states give equal snapshots
+    memset(core->stack + core->stack_depth, 0, (STACK_SIZE - core->stack_depth) * sizeof(core->stack[0]));
+    core->keypad = state->keypad;
+    core->random_state = state->random_state;
+    core->cycles = state->cycles;
+    memcpy(core->rows, state->screen.rows, sizeof(core->rows));
+    core->screen_width = state->screen.width;
+    core->screen_height = state->screen.height;
+    core->planes = state->planes;
+    memcpy(core->rpl_flags, state->rpl_flags, sizeof(core->rpl_flags));
+    core->mode = (uint8_t) state->mode;
+}
+
+// pops down to depth, the popped slots are cleared like stack_pop_pc does
+static void clear_stack_slots(struct MachineState* state, uint8_t depth) {
+    uint16_t** top = state->mem.stack_pointer;
+    state->mem.stack_pointer = state->mem.stack_base_pointer + depth;
+    if (top > state->mem.stack_pointer) {
+        memset(state->mem.stack_pointer, 0, (size_t) (top - state->mem.stack_pointer) * sizeof(uint16_t*));
+    }
+}
+
+static void restore_core(struct MachineState* state, const struct CoreSnapshot* core) {
+    struct RegisterFile* rf = &state->rf;
+    // pushes are not seen by rewind_note_write, so restored memory can leave pointers above the restored depth
+    clear_stack_slots(state, core->stack_depth);
+    memcpy(rf->d_reg, core->d_reg, sizeof(rf->d_reg));
+    rf->pc = ADDRESS_TO_PC(state, core->pc);
+    rf->I = core->I;
+    rf->delay_timer = core->delay_timer;
+    rf->sound_timer = core->sound_timer;
+    for (int i = 0; i < core->stack_depth; ++i) {
+        state->mem.stack_base_pointer[i] = ADDRESS_TO_PC(state, core->stack[i]);
+    }
+    state->keypad = core->keypad;
+    state->key_presses = 0;
+    state->random_state = core->random_state;
+    state->cycles = core->cycles;
+    memcpy(state->screen.rows, core->rows, sizeof(core->rows));
+    state->screen.width = core->screen_width;
+    state->screen.height = core->screen_height;
+    state->planes = core->planes;
+    memcpy(state->rpl_flags, core->rpl_flags, sizeof(state->rpl_flags));
+    state->screen.dirty_rows = ALL_ROWS_DIRTY;
+    state->waiting_for_key = false;
+    state->stack_fault = false;
+    reset_idle_detection(state);
+}
+
+// copies a page back into memory, decodings and translations of it are dropped if it changed
+// nothing from STACK_OFFSET on is ever executed, so changes there are not counted: the live stack slots hold
+// host pointers that never match the saved contents
+static bool restore_page(struct MachineState* state, uint16_t page, const uint8_t* contents) {
+    uint16_t start = page * REWIND_PAGE_SIZE;
+    uint8_t* target = state->mem.mem + start;
+    size_t code_bytes = start >= STACK_OFFSET ? 0 : STACK_OFFSET - start;
+    if (code_bytes > REWIND_PAGE_SIZE) code_bytes = REWIND_PAGE_SIZE;
+    bool changed = memcmp(target, contents, code_bytes) != 0;
+    memcpy(target, contents, REWIND_PAGE_SIZE);
+    if (changed) invalidate_decode_cache(state->decode_cache, start, code_bytes);
+    return changed;
+}
+
+void save_snapshot(const struct MachineState* state, struct Snapshot* snapshot) {
+    save_core(state, &snapshot->core);
+    memcpy(snapshot->mem, state->mem.mem, MEMORY_SIZE);
+    // the live slots hold host pointers, whatever the program stored elsewhere in the area is kept, XO-CHIP
+    // keeps its stack outside of the 4 KB
+    if (state->mode != MODE_XO_CHIP) {
+        memset(snapshot->mem + STACK_OFFSET, 0, snapshot->core.stack_depth * sizeof(uint16_t*));
+    }
+}
+
+bool restore_snapshot(struct MachineState* state, const struct Snapshot* snapshot) {
+    if (snapshot->core.mode != state->mode) return false;
+    // before the pages, whatever the snapshot has above its depth is program data and stays
+    clear_stack_slots(state, 0);
+    bool changed = false;
+    for (uint16_t page = 0; page < REWIND_PAGES; ++page) {
+        changed |= restore_page(state, page, snapshot->mem + page * REWIND_PAGE_SIZE);
+    }
+    if (changed) reset_jit_cache(state->jit);
+    restore_core(state, &snapshot->core);
+    // the snapshot may come from anywhere
+    state->pc_confined = false;
+    if (state->rewind) reset_rewind(state->rewind);
+    return true;
+}
+
+struct Rewind* create_rewind(uint32_t frames) {
+    struct Rewind* rewind = calloc(1, sizeof(struct Rewind));
+    if (!rewind || frames == 0) {
+        exit(EXIT_FAILURE);
+    }
+    rewind->frames = malloc(frames * sizeof(struct RewindFrame));
+    if (!rewind->frames) {
+        exit(EXIT_FAILURE);
+    }
+    rewind->capacity = frames;
+    return rewind;
+}
+
+void rewind_capture(struct Rewind* rewind, const struct MachineState* state) {
+    struct RewindFrame* frame = &rewind->frames[rewind->head];
+    rewind->head = (rewind->head + 1) % rewind->capacity;
+    if (rewind->count < rewind->capacity) rewind->count++;
+    frame->saved_pages = 0;
+    save_core(state, &frame->core);
+}
+
+void rewind_note_write(struct Rewind* rewind, const struct MachineState* state, uint16_t address) {
+    if (!rewind->count) return;
+    struct RewindFrame* frame = &rewind->frames[(rewind->head + rewind->capacity - 1) % rewind->capacity];
+    uint16_t page = address / REWIND_PAGE_SIZE;
+    if (frame->saved_pages & (1U << page)) return;
+    frame->saved_pages |= 1U << page;
+    size_t start = (size_t) page * REWIND_PAGE_SIZE;
+    memcpy(frame->pages[page], state->mem.mem + start, REWIND_PAGE_SIZE);
+    // The live slots may have been pushed since the capture, the page is saved without their host pointers.
+    // restore_core puts back the slots of the capture.
+    if (state->mode == MODE_XO_CHIP) return;
+    size_t depth = (size_t) (state->mem.stack_pointer - state->mem.stack_base_pointer);
+    size_t stack_end = STACK_OFFSET + depth * sizeof(uint16_t*);
+    size_t from = start > STACK_OFFSET ? start : STACK_OFFSET;
+    size_t to = start + REWIND_PAGE_SIZE < stack_end ? start + REWIND_PAGE_SIZE : stack_end;
+    if (from < to) memset(frame->pages[page] + (from - start), 0, to - from);
+}
+
+// the restored capture and everything newer is dropped, the next rewind_capture takes its place
+bool rewind_step(struct Rewind* rewind, struct MachineState* state, uint32_t frames) {
+    if (!rewind->count || frames == 0) return false;
+    if (frames > rewind->count) frames = rewind->count;
+    bool changed = false;
+    struct RewindFrame* frame = NULL;
+    for (uint32_t i = 0; i < frames; ++i) {
+        rewind->head = (rewind->head + rewind->capacity - 1) % rewind->capacity;
+        rewind->count--;
+        frame = &rewind->frames[rewind->head];
+        for (uint16_t page = 0; page < REWIND_PAGES; ++page) {
+            if (frame->saved_pages & (1U << page)) changed |= restore_page(state, page, frame->pages[page]);
+        }
+    }
+    if (changed) reset_jit_cache(state->jit);
+    restore_core(state, &frame->core);
+    return true;
+}
+
+void reset_rewind(struct Rewind* rewind) {
+    rewind->head = 0;
+    rewind->count = 0;
+}
+
+void delete_rewind(struct Rewind** rewind) {
+    if (!(*rewind)) return;
+
+    free((*rewind)->frames);
+    free(*rewind);
+    *rewind = NULL;
+}
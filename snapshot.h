@@ -0,0 +1,57 @@
+#ifndef CHIP_8_SNAPSHOT_H
+#define CHIP_8_SNAPSHOT_H
+
+#include "CHIP-8.h"
+
+// The complete machine state without any host pointers: pc and the return addresses are stored as 12 bit
+// addresses, so a snapshot can be copied, written to disk or restored into any other machine in the same mode.
+// Snapshots and rewinding cover the 4 KB of CHIP-8 and SCHIP, not the 64 KB of XO-CHIP.
+struct CoreSnapshot {
+    uint8_t d_reg[16];
+    uint16_t pc;
+    uint16_t I;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t stack_depth;
+    uint16_t stack[STACK_SIZE]; // return addresses, oldest first
+    uint16_t keypad;
+    uint32_t random_state;
+    uint64_t cycles;
+    uint64_t rows[SCREEN_PLANES][SCREEN_WORDS];
+    uint8_t screen_width;
+    uint8_t screen_height;
+    uint8_t planes;
+    uint8_t rpl_flags[16];
+    uint8_t mode; // MachineMode
+};
+
+struct Snapshot {
+    struct CoreSnapshot core; // everything but memory
+    uint8_t mem[MEMORY_SIZE]; // the live stack slots are zero, their return addresses are in core.stack
+};
+
+extern void save_snapshot(const struct MachineState* state, struct Snapshot* snapshot);
+// also forgets the rewind history, which does not lead to the restored state, returns false and leaves the
+// machine alone if it is not in the mode of the snapshot
+extern bool restore_snapshot(struct MachineState* state, const struct Snapshot* snapshot);
+
+// Keeps the last frames of execution for rewinding. A capture only copies registers, stack and screen. Memory
+// is copy-on-write: the first store into a page after a capture saves the page's old contents with that
+// capture, so stepping back restores the saved pages of every newer capture in reverse order.
+#define REWIND_PAGE_SIZE 256
+#define REWIND_PAGES (MEMORY_SIZE / REWIND_PAGE_SIZE)
+
+struct Rewind;
+
+// keeps up to frames captures, the oldest ones are dropped
+extern struct Rewind* create_rewind(uint32_t frames);
+// called at the start of every frame
+extern void rewind_capture(struct Rewind* rewind, const struct MachineState* state);
+// goes back up to frames captures, returns false if there was nothing to go back to
+extern bool rewind_step(struct Rewind* rewind, struct MachineState* state, uint32_t frames);
+// called by write_memory before the store
+extern void rewind_note_write(struct Rewind* rewind, const struct MachineState* state, uint16_t address);
+extern void reset_rewind(struct Rewind* rewind);
+extern void delete_rewind(struct Rewind** rewind);
+
+#endif //CHIP_8_SNAPSHOT_H
@@ -0,0 +1,64 @@
+#include "timer.h"
+#include "audio.h"
+#include <string.h>
+
+void add_nanoseconds(struct timespec* time, long nanoseconds) {
+    time->tv_nsec += nanoseconds;
+    while (time->tv_nsec >= NANOSECONDS_PER_SECOND) {
+        time->tv_nsec -= NANOSECONDS_PER_SECOND;
+        time->tv_sec++;
+    }
+}
+
+int64_t nanoseconds_between(const struct timespec* from, const struct timespec* to) {
+    return (int64_t) (to->tv_sec - from->tv_sec) * NANOSECONDS_PER_SECOND + (to->tv_nsec - from->tv_nsec);
+}
+
+void start_timers(struct MachineState* state, const struct timespec* now) {
+    state->timer_epoch = *now;
+    state->timer_ticks = 0;
+}
+
+void update_timers(struct MachineState* state, const struct timespec* now) {
+    int64_t elapsed = nanoseconds_between(&state->timer_epoch, now);
+    if (elapsed < 0) return;
+    uint64_t ticks = (uint64_t) elapsed / NANOSECONDS_PER_FRAME;
+    tick_timers(state, ticks - state->timer_ticks);
+    state->timer_ticks = ticks;
+}
+
+void tick_timers(struct MachineState* state, uint64_t ticks) {
+    if (ticks == 0) return;
+    state->elapsed_ticks += ticks;
+    struct RegisterFile* rf = &state->rf;
+    if (state->frontend && state->frontend->audio) queue_audio_ticks(state->frontend->audio, state, ticks);
+    rf->delay_timer = ticks >= rf->delay_timer ? 0 : rf->delay_timer - ticks;
+    rf->sound_timer = ticks >= rf->sound_timer ? 0 : rf->sound_timer - ticks;
+}
+
+void reset_idle_detection(struct MachineState* state) {
+    state->idle.armed = false;
+    state->waiting_for_timer = false;
+}
+
+// Between two reads of the delay timer at the same pc nothing observable may have happened: nothing counted in
+// side_effects, and the registers, timers and stack are unchanged. The keypad only changes between frames. The
+// program will then run the exact same loop again until the next tick, so the rest of the frame can be skipped.
+void note_delay_timer_read(struct MachineState* state, uint16_t pc) {
+    struct IdleDetector* idle = &state->idle;
+    struct RegisterFile* rf = &state->rf;
+    if (idle->armed && idle->pc == pc && idle->side_effects == state->side_effects && idle->I == rf->I &&
+        idle->delay_timer == rf->delay_timer && idle->sound_timer == rf->sound_timer &&
+        idle->stack_pointer == state->mem.stack_pointer && memcmp(idle->d_reg, rf->d_reg, sizeof(idle->d_reg)) == 0) {
+        state->waiting_for_timer = rf->delay_timer > 0;
+        return;
+    }
+    idle->armed = true;
+    idle->pc = pc;
+    idle->side_effects = state->side_effects;
+    idle->I = rf->I;
+    idle->delay_timer = rf->delay_timer;
+    idle->sound_timer = rf->sound_timer;
+    idle->stack_pointer = state->mem.stack_pointer;
+    memcpy(idle->d_reg, rf->d_reg, sizeof(idle->d_reg));
+}
@@ -0,0 +1,24 @@
+#ifndef CHIP_8_TIMER_H
+#define CHIP_8_TIMER_H
+
+#include "CHIP-8.h"
+#include <time.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000L
+#define NANOSECONDS_PER_FRAME (NANOSECONDS_PER_SECOND / FRAME_RATE)
+
+extern void add_nanoseconds(struct timespec* time, long nanoseconds);
+extern int64_t nanoseconds_between(const struct timespec* from, const struct timespec* to);
+
+// (re)starts the 60 Hz timer clock at now
+extern void start_timers(struct MachineState* state, const struct timespec* now);
+// decrements delay_timer and sound_timer by every 60 Hz tick that passed on the monotonic clock until now
+extern void update_timers(struct MachineState* state, const struct timespec* now);
+// decrements both timers by ticks, used directly when running in emulated time
+extern void tick_timers(struct MachineState* state, uint64_t ticks);
+
+// called after FX07 at pc, sets waiting_for_timer once the program provably spins on the delay timer
+extern void note_delay_timer_read(struct MachineState* state, uint16_t pc);
+extern void reset_idle_detection(struct MachineState* state);
+
+#endif //CHIP_8_TIMER_H
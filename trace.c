@@ -0,0 +1,103 @@
+#include "trace.h"
+#include "CHIP-8.h"
+#include "CHIP-8-internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TRACE_CAPACITY (1U << 16) // records, a power of two
+#define TRACE_FLUSH_INTERVAL_NS 1000000L
+
+struct TraceBuffer {
+    // written by the machine only
+    _Alignas(64) atomic_uint_fast64_t head;
+    uint64_t cycle;
+    uint64_t dropped;
+    // written by the flush thread only
+    _Alignas(64) atomic_uint_fast64_t tail;
+    _Alignas(64) atomic_bool stopping;
+    FILE* file;
+    pthread_t thread;
+    struct TraceRecord records[TRACE_CAPACITY];
+};
+
+void trace_instruction(struct TraceBuffer* trace, const struct MachineState* state) {
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    uint64_t cycle = trace->cycle++;
+    if (head - atomic_load_explicit(&trace->tail, memory_order_acquire) == TRACE_CAPACITY) {
+        trace->dropped++;
+        return;
+    }
+    struct TraceRecord* record = &trace->records[head & (TRACE_CAPACITY - 1)];
+    const uint8_t* pc = (const uint8_t*) state->rf.pc;
+    record->cycle = cycle;
+    record->pc = PC_ADDRESS(state);
+    record->opcode = pc[0] << 8 | pc[1];
+    record->I = state->rf.I;
+    record->delay_timer = state->rf.delay_timer;
+    record->sound_timer = state->rf.sound_timer;
+    for (int i = 0; i < 16; ++i) {
+        record->d_reg[i] = state->rf.d_reg[i];
+    }
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+// writes every record published so far, in at most two contiguous runs
+static void flush_records(struct TraceBuffer* trace) {
+    uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    while (tail != head) {
+        uint64_t start = tail & (TRACE_CAPACITY - 1);
+        uint64_t count = head - tail;
+        if (count > TRACE_CAPACITY - start) count = TRACE_CAPACITY - start;
+        fwrite(&trace->records[start], sizeof(struct TraceRecord), count, trace->file);
+        tail += count;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+}
+
+static void* run_flush_thread(void* data) {
+    struct TraceBuffer* trace = data;
+    struct timespec interval = {0, TRACE_FLUSH_INTERVAL_NS};
+    while (!atomic_load_explicit(&trace->stopping, memory_order_acquire)) {
+        flush_records(trace);
+        nanosleep(&interval, NULL);
+    }
+    flush_records(trace);
+    return NULL;
+}
+
+struct TraceBuffer* start_trace(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return NULL;
+    struct TraceBuffer* trace = aligned_alloc(64, sizeof(struct TraceBuffer));
+    if (!trace) {
+        exit(EXIT_FAILURE);
+    }
+    memset(trace, 0, sizeof(struct TraceBuffer));
+    trace->file = file;
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->stopping, false);
+    if (pthread_create(&trace->thread, NULL, run_flush_thread, trace) != 0) {
+        fprintf(stderr, "Could not start the trace thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    return trace;
+}
+
+void stop_trace(struct TraceBuffer** trace) {
+    if (!(*trace)) return;
+
+    atomic_store_explicit(&(*trace)->stopping, true, memory_order_release);
+    pthread_join((*trace)->thread, NULL);
+    if ((*trace)->dropped) {
+        fprintf(stderr, "Trace: dropped %llu of %llu records.\n", (unsigned long long) (*trace)->dropped,
+                (unsigned long long) (*trace)->cycle);
+    }
+    fclose((*trace)->file);
+    free(*trace);
+    *trace = NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef CHIP_8_TRACE_H
+#define CHIP_8_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Text logging is selected at compile time, anything above TRACE_LEVEL is removed by the compiler while its
+// arguments are still type checked. The build defines TRACE_LEVEL per configuration.
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_INFO 2
+#define TRACE_LEVEL_DEBUG 3 // every instruction
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_ERROR
+#endif
+
+#define TRACE_AT(level, ...) do { if (TRACE_LEVEL >= (level)) fprintf(stderr, __VA_ARGS__); } while (0)
+#define TRACE_ERROR(...) TRACE_AT(TRACE_LEVEL_ERROR, __VA_ARGS__)
+#define TRACE_INFO(...) TRACE_AT(TRACE_LEVEL_INFO, __VA_ARGS__)
+#define TRACE_DEBUG(...) TRACE_AT(TRACE_LEVEL_DEBUG, __VA_ARGS__)
+
+// The binary trace is a runtime mode: one fixed size record per instruction, taken before it executes, is
+// appended to a lock-free single producer ring buffer and written to a file by a background thread. Records
+// are dropped rather than stalling the machine when the writer falls behind. The file holds raw TraceRecords
+// in host byte order.
+struct TraceRecord {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t d_reg[16];
+};
+
+_Static_assert(sizeof(struct TraceRecord) == 32, "trace records are written as fixed size blocks");
+
+struct MachineState;
+struct TraceBuffer;
+
+// opens path and starts the flush thread, returns NULL if the file cannot be created
+extern struct TraceBuffer* start_trace(const char* path);
+// records the instruction at pc, called only while state->trace is set
+extern void trace_instruction(struct TraceBuffer* trace, const struct MachineState* state);
+// writes out what is left, stops the flush thread and closes the file
+extern void stop_trace(struct TraceBuffer** trace);
+
+#endif //CHIP_8_TRACE_H
@@ -0,0 +1,864 @@
+#include "wide.h"
+#include "CHIP-8-internal.h"
+#include "predecode.h"
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The vector operations are written with the GNU vector extensions. On x86-64 the functions running them are
+// compiled twice, for AVX2 and for the SSE2 baseline, and the loader picks the one the host supports.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define WIDE_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define WIDE_TARGETS
+#endif
+
+
+typedef uint8_t wide_u8 __attribute__((vector_size(WIDE_BLOCK)));
+typedef int8_t wide_i8 __attribute__((vector_size(WIDE_BLOCK)));
+typedef uint16_t wide_u16 __attribute__((vector_size(WIDE_BLOCK * 2)));
+typedef int16_t wide_i16 __attribute__((vector_size(WIDE_BLOCK * 2)));
+typedef uint32_t wide_u32 __attribute__((vector_size(WIDE_BLOCK * 4)));
+typedef int32_t wide_i32 __attribute__((vector_size(WIDE_BLOCK * 4)));
+typedef uint64_t wide_u64 __attribute__((vector_size(WIDE_BLOCK * 8)));
+
+// masks have all bits of a lane set or none, SELECT takes a where the mask is set and b elsewhere
+#define SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+#define FOR_EACH_BLOCK(lane, first, last) for (size_t lane = (first); lane < (last); lane += WIDE_BLOCK)
+#define FOR_EACH_GROUP_LANE(wide, lane, group) \
+    for (size_t lane = (group)->first; lane < (group)->last; ++lane) if ((wide)->group[lane])
+
+// snapshot taken at a delay timer read, see note_delay_timer_read
+struct WideIdleDetector {
+    uint8_t d_reg[16];
+    uint16_t pc;
+    uint16_t I;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t stack_depth;
+    uint32_t side_effects;
+    uint64_t frame; // armed while it equals the current frame
+};
+
+// lanes at the same pc executing together
+struct WideGroup {
+    size_t first; // first lane of the first block with a lane in the group
+    size_t last; // behind the last block with a lane in the group
+    size_t first_lane;
+    uint16_t address;
+    uint32_t steps; // the smallest budget in the group
+    bool full; // no attached lane outside the group can run
+    bool shared; // fetches from image, false for a detached lane
+};
+
+enum WideStep {
+    WIDE_STEP_NEXT, // every lane continues behind the instruction
+    WIDE_STEP_JUMP, // every lane continues at the same target
+    WIDE_STEP_DIVERGED, // the lanes set their own pc, and may have blocked, halted or detached
+};
+
+// macros rather than functions, vectors are never passed to or returned from a call
+#define LOAD(type, p) ({ type vector_; memcpy(&vector_, (p), sizeof(vector_)); vector_; })
+#define STORE(p, v) do { __typeof__(v) vector_ = (v); memcpy((p), &vector_, sizeof(vector_)); } while (0)
+#define STORE_MASKED(type, p, v, mask) STORE(p, SELECT(mask, v, LOAD(type, p)))
+#define load_u8(p) LOAD(wide_u8, p)
+#define load_u16(p) LOAD(wide_u16, p)
+#define load_u32(p) LOAD(wide_u32, p)
+#define load_u64(p) LOAD(wide_u64, p)
+#define store_masked_u8(p, v, mask) STORE_MASKED(wide_u8, p, v, mask)
+#define store_masked_u16(p, v, mask) STORE_MASKED(wide_u16, p, v, mask)
+#define store_masked_u32(p, v, mask) STORE_MASKED(wide_u32, p, v, mask)
+#define SPLAT(type, x) ({ type vector_; for (int i_ = 0; i_ < WIDE_BLOCK; ++i_) vector_[i_] = (x); vector_; })
+#define splat_u8(x) SPLAT(wide_u8, x)
+#define splat_u16(x) SPLAT(wide_u16, x)
+#define splat_u32(x) SPLAT(wide_u32, x)
+// comparisons give masks of signed lanes as wide as their operands, converting between 8 and 32 bits in one
+// step ends up element by element, going through 16 bits keeps it in vector registers
+#define widen_mask(mask) ((wide_u16) __builtin_convertvector((wide_i8) (mask), wide_i16))
+#define widen_mask_32(mask) ((wide_u32) __builtin_convertvector(__builtin_convertvector((wide_i8) (mask), wide_i16), wide_i32))
+#define narrow_mask(mask) ((wide_u8) __builtin_convertvector((mask), wide_i8))
+#define narrow_mask_32(mask) ((wide_u8) __builtin_convertvector(__builtin_convertvector((mask), wide_i16), wide_i8))
+// Comparisons of vectors wider than a register end up element by element, 16 and 32 bit masks are computed
+// from their sign bits instead: x | -x has it set for any x but 0, a - b borrows it when a < b.
+#define SIGN_MASK(type, x) ((type) ((x) >> (sizeof((x)[0]) * 8 - 1)))
+#define nonzero_u16(x) ({ wide_u16 x_ = (x); SIGN_MASK(wide_u16, (wide_i16) (x_ | -x_)); })
+#define nonzero_u32(x) ({ wide_u32 x_ = (x); SIGN_MASK(wide_u32, (wide_i32) (x_ | -x_)); })
+#define equal_u16(a, b) (~nonzero_u16((a) ^ (b)))
+#define LESS(type, signed_type, a, b) ({ \
+    type a_ = (a), b_ = (b); \
+    SIGN_MASK(type, (signed_type) ((~a_ & b_) | (~(a_ ^ b_) & (a_ - b_)))); \
+})
+#define less_u16(a, b) LESS(wide_u16, wide_i16, a, b)
+#define less_u32(a, b) LESS(wide_u32, wide_i32, a, b)
+#define any_lane(mask) ({ \
+    uint64_t words_[WIDE_BLOCK / 8]; \
+    wide_u8 mask_ = (mask); \
+    memcpy(words_, &mask_, sizeof(words_)); \
+    uint64_t any_ = 0; \
+    for (int i_ = 0; i_ < WIDE_BLOCK / 8; ++i_) any_ |= words_[i_]; \
+    any_ != 0; \
+})
+
+static inline uint8_t* lane_memory(const struct WideMachines* wide, size_t lane) {
+    return wide->mem + lane * MEMORY_SIZE;
+}
+
+// what a lane reads, a lane that never stored anything still has image as its memory, which stays in cache
+static inline const uint8_t* lane_view(const struct WideMachines* wide, size_t lane) {
+    return wide->wrote[lane] ? lane_memory(wide, lane) : wide->image;
+}
+
+// row words are interleaved, consecutive lanes share cache lines when they draw into the same rows
+#define SCREEN_ROW(wide, lane, row) ((wide)->screen[(size_t) (row) * (wide)->padded_lanes + (lane)])
+
+
+static void* allocate_lanes(size_t lanes, size_t size) {
+    // aligned_alloc wants a multiple of the alignment
+    size_t bytes = (lanes * size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    void* array = aligned_alloc(CACHE_LINE_SIZE, bytes);
+    if (!array) {
+        exit(EXIT_FAILURE);
+    }
+    memset(array, 0, bytes);
+    return array;
+}
+
+struct WideMachines* create_wide_machines(size_t lanes, const uint8_t* binary, size_t binary_size) {
+    struct WideMachines* wide = calloc(1, sizeof(struct WideMachines));
+    if (!wide) {
+        exit(EXIT_FAILURE);
+    }
+    size_t padded = (lanes + WIDE_BLOCK - 1) / WIDE_BLOCK * WIDE_BLOCK;
+    wide->lanes = lanes;
+    wide->padded_lanes = padded;
+    wide->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+    set_wide_quirks_profile(wide, QUIRKS_MODERN);
+    for (int i = 0; i < 16; ++i) {
+        wide->v[i] = allocate_lanes(padded, sizeof(uint8_t));
+    }
+    wide->I = allocate_lanes(padded, sizeof(uint16_t));
+    wide->pc = allocate_lanes(padded, sizeof(uint16_t));
+    wide->delay_timer = allocate_lanes(padded, sizeof(uint8_t));
+    wide->sound_timer = allocate_lanes(padded, sizeof(uint8_t));
+    wide->stack_depth = allocate_lanes(padded, sizeof(uint8_t));
+    wide->stack = allocate_lanes(padded, WIDE_STACK_DEPTH * sizeof(uint16_t));
+    wide->keypad = allocate_lanes(padded, sizeof(uint16_t));
+    wide->key_presses = allocate_lanes(padded, sizeof(uint16_t));
+    wide->random_state = allocate_lanes(padded, sizeof(uint32_t));
+    wide->side_effects = allocate_lanes(padded, sizeof(uint32_t));
+    wide->budget = allocate_lanes(padded, sizeof(uint32_t));
+    wide->cycles = allocate_lanes(padded, sizeof(uint64_t));
+    wide->status = allocate_lanes(padded, sizeof(uint8_t));
+    wide->wrote = allocate_lanes(padded, sizeof(uint8_t));
+    wide->group = allocate_lanes(padded, sizeof(int8_t));
+    wide->idle = allocate_lanes(padded, sizeof(struct WideIdleDetector));
+    wide->mem = allocate_lanes(padded, MEMORY_SIZE);
+    wide->screen = allocate_lanes(padded, SCREEN_HEIGHT * sizeof(uint64_t));
+    wide->decoded = allocate_lanes(MEMORY_SIZE, sizeof(struct DecodedOp));
+
+    // an ordinary machine lays out the font and the program
+    struct MachineState* machine = create_machine(NULL);
+    load_program(machine, binary, binary_size);
+    memcpy(wide->image, machine->mem.mem, MEMORY_SIZE);
+    delete_machine(&machine);
+
+    for (size_t lane = 0; lane < padded; ++lane) {
+        wide->pc[lane] = PROGRAM_OFFSET;
+        wide->random_state[lane] = DEFAULT_RANDOM_SEED;
+        wide->status[lane] = lane < lanes ? 0 : WIDE_HALTED;
+    }
+    return wide;
+}
+
+void set_wide_quirks_profile(struct WideMachines* wide, enum QuirksProfile profile) {
+    wide->quirks_profile = profile;
+    wide->quirks = quirks_profile_flags(profile);
+}
+
+void seed_wide_lane(struct WideMachines* wide, size_t lane, uint32_t seed) {
+    wide->random_state[lane] = seed ? seed : DEFAULT_RANDOM_SEED;
+}
+
+void set_wide_keypad(struct WideMachines* wide, size_t lane, uint16_t keypad) {
+    wide->key_presses[lane] = keypad & ~wide->keypad[lane];
+    wide->keypad[lane] = keypad;
+}
+
+bool wide_lane_halted(const struct WideMachines* wide, size_t lane) {
+    // a lane only notices when it fetches the next instruction
+    return (wide->status[lane] & WIDE_HALTED) || wide->pc[lane] < PROGRAM_OFFSET || wide->pc[lane] >= PROGRAM_END;
+}
+
+static void halt_lane(struct WideMachines* wide, size_t lane, uint16_t address) {
+    wide->status[lane] |= WIDE_HALTED;
+    wide->pc[lane] = address;
+}
+
+// the attached lanes that can run, picks the lowest pc among them so lanes that fell behind catch up first
+static WIDE_TARGETS bool form_group(struct WideMachines* wide, struct WideGroup* group) {
+    // a lane that cannot run takes part with a pc of UINT16_MAX and a budget of 0
+    wide_u16 lowest = splat_u16(UINT16_MAX);
+    FOR_EACH_BLOCK(lane, 0, wide->padded_lanes) {
+        wide_u8 runnable = (wide_u8) (load_u8(wide->status + lane) == 0) &
+                           narrow_mask_32(nonzero_u32(load_u32(wide->budget + lane)));
+        wide_u16 pc = load_u16(wide->pc + lane) | ~widen_mask(runnable);
+        lowest = SELECT(less_u16(pc, lowest), pc, lowest);
+    }
+    uint16_t address = UINT16_MAX;
+    for (int i = 0; i < WIDE_BLOCK; ++i) {
+        if (lowest[i] < address) address = lowest[i];
+    }
+    // pc never gets anywhere near the end of the 16 bit range
+    if (address == UINT16_MAX) return false;
+
+    const wide_u16 group_address = splat_u16(address);
+    wide_u8 outside = {0};
+    wide_u32 steps = splat_u32(UINT32_MAX);
+    group->first = wide->padded_lanes;
+    group->last = 0;
+    FOR_EACH_BLOCK(lane, 0, wide->padded_lanes) {
+        wide_u32 budget = load_u32(wide->budget + lane);
+        wide_u8 runnable = (wide_u8) (load_u8(wide->status + lane) == 0) & narrow_mask_32(nonzero_u32(budget));
+        wide_u8 mask = runnable & narrow_mask(equal_u16(load_u16(wide->pc + lane), group_address));
+        STORE(wide->group + lane, mask);
+        outside |= runnable & ~mask;
+        budget |= ~widen_mask_32(mask);
+        steps = SELECT(less_u32(budget, steps), budget, steps);
+        if (any_lane(mask)) {
+            if (group->first == wide->padded_lanes) group->first = lane;
+            group->last = lane + WIDE_BLOCK;
+        }
+    }
+    group->steps = UINT32_MAX;
+    for (int i = 0; i < WIDE_BLOCK; ++i) {
+        if (steps[i] < group->steps) group->steps = steps[i];
+    }
+    group->first_lane = group->first;
+    while (!wide->group[group->first_lane]) ++group->first_lane;
+    group->address = address;
+    group->full = !any_lane(outside);
+    group->shared = true;
+    return true;
+}
+
+// count instructions were executed by every lane of the group, the pc is only set if the lanes share it
+static WIDE_TARGETS void finish_group(struct WideMachines* wide, const struct WideGroup* group, bool set_pc,
+                                      uint16_t address, uint32_t count) {
+    FOR_EACH_BLOCK(lane, group->first, group->last) {
+        wide_u8 mask = load_u8(wide->group + lane);
+        if (set_pc) store_masked_u16(wide->pc + lane, splat_u16(address), widen_mask(mask));
+        STORE(wide->budget + lane, load_u32(wide->budget + lane) - (splat_u32(count) & widen_mask_32(mask)));
+    }
+}
+
+// 6XNN, 7XNN, the 8XYN family, ANNN, CXNN and the FX instructions that only touch registers and timers
+static WIDE_TARGETS void execute_vector_op(struct WideMachines* wide, const struct DecodedOp* op, size_t first,
+                                           size_t last) {
+    const uint32_t quirks = wide->quirks;
+    uint8_t* vx = wide->v[op->x];
+    uint8_t* vy = wide->v[op->y];
+    uint8_t* vf = wide->v[0xf];
+    // the shifts read VY or VX, and read it again after VF was written in case it is VF itself
+    uint8_t* shift_source = quirks & QUIRK_SHIFT_VY ? vy : vx;
+    const wide_u8 kk = splat_u8(op->kk);
+    const wide_u8 one = splat_u8(1);
+    const wide_u8 zero = {0};
+    switch (op->kind) {
+        case OP_SET_IMM: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u8(vx + lane, kk, load_u8(wide->group + lane));
+            }
+            break;
+        }
+        case OP_ADD_IMM: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u8(vx + lane, load_u8(vx + lane) + kk, load_u8(wide->group + lane));
+            }
+            break;
+        }
+        case OP_LOAD: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u8(vx + lane, load_u8(vy + lane), load_u8(wide->group + lane));
+            }
+            break;
+        }
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                wide_u8 a = load_u8(vx + lane);
+                wide_u8 b = load_u8(vy + lane);
+                store_masked_u8(vx + lane, op->kind == OP_OR ? a | b : op->kind == OP_AND ? a & b : a ^ b, mask);
+                if (quirks & QUIRK_VF_RESET) store_masked_u8(vf + lane, zero, mask);
+            }
+            break;
+        }
+        case OP_ADD: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                wide_u8 a = load_u8(vx + lane);
+                wide_u8 sum = a + load_u8(vy + lane);
+                store_masked_u8(vf + lane, (wide_u8) (sum < a) & one, mask);
+                store_masked_u8(vx + lane, sum, mask);
+            }
+            break;
+        }
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_N: {
+            bool reverse = op->kind == OP_SUBTRACT_N;
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                wide_u8 a = load_u8((reverse ? vy : vx) + lane);
+                wide_u8 b = load_u8((reverse ? vx : vy) + lane);
+                store_masked_u8(vf + lane, (wide_u8) (a > b) & one, mask);
+                // VF was written first, the operands are read again
+                a = load_u8((reverse ? vy : vx) + lane);
+                b = load_u8((reverse ? vx : vy) + lane);
+                store_masked_u8(vx + lane, a - b, mask);
+            }
+            break;
+        }
+        case OP_RIGHT_SHIFT: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                store_masked_u8(vf + lane, load_u8(shift_source + lane) & one, mask);
+                store_masked_u8(vx + lane, load_u8(shift_source + lane) >> 1, mask);
+            }
+            break;
+        }
+        case OP_LEFT_SHIFT: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                store_masked_u8(vf + lane, load_u8(shift_source + lane) >> 7, mask);
+                store_masked_u8(vx + lane, load_u8(shift_source + lane) << 1, mask);
+            }
+            break;
+        }
+        case OP_SET_INDEX: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u16(wide->I + lane, splat_u16(op->nnn), widen_mask(load_u8(wide->group + lane)));
+            }
+            break;
+        }
+        case OP_ADD_TO_INDEX: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                wide_u16 index = load_u16(wide->I + lane) + __builtin_convertvector(load_u8(vx + lane), wide_u16);
+                store_masked_u16(wide->I + lane, index, widen_mask(mask));
+                if (quirks & QUIRK_INDEX_OVERFLOW) {
+                    store_masked_u8(vf + lane, one, mask & narrow_mask(nonzero_u16(index >> 12)));
+                }
+            }
+            break;
+        }
+        case OP_FONT_CHARACTER: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u16 character = __builtin_convertvector(load_u8(vx + lane) & 0xf, wide_u16);
+                store_masked_u16(wide->I + lane, FONT_MEMORY_OFFSET + character * BYTES_PER_FONT_CHARACTER,
+                                 widen_mask(load_u8(wide->group + lane)));
+            }
+            break;
+        }
+        case OP_SET_DELAY_TIMER: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u8(wide->delay_timer + lane, load_u8(vx + lane), load_u8(wide->group + lane));
+            }
+            break;
+        }
+        case OP_SET_SOUND_TIMER: {
+            FOR_EACH_BLOCK(lane, first, last) {
+                store_masked_u8(wide->sound_timer + lane, load_u8(vx + lane), load_u8(wide->group + lane));
+            }
+            break;
+        }
+        case OP_RANDOM: {
+            // xorshift32 in every lane, see random_byte
+            FOR_EACH_BLOCK(lane, first, last) {
+                wide_u8 mask = load_u8(wide->group + lane);
+                wide_u32 mask_32 = widen_mask_32(mask);
+                wide_u32 x = load_u32(wide->random_state + lane);
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                store_masked_u32(wide->random_state + lane, x, mask_32);
+                store_masked_u8(vx + lane, __builtin_convertvector(__builtin_convertvector(x >> 24, wide_u16), wide_u8) & kk, mask);
+                STORE(wide->side_effects + lane, load_u32(wide->side_effects + lane) - mask_32);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// 3XNN, 4XNN, 5XY0, 9XY0, EX9E and EXA1 set the pc of every lane in the group
+static WIDE_TARGETS enum WideStep execute_skip(struct WideMachines* wide, const struct WideGroup* group,
+                                               const struct DecodedOp* op, uint16_t* target) {
+    const uint8_t* vx = wide->v[op->x];
+    const uint8_t* vy = wide->v[op->y];
+    const wide_u8 kk = splat_u8(op->kk);
+    const wide_u16 next = splat_u16(group->address + 2);
+    const wide_u16 skip_distance = splat_u16(2);
+    wide_u8 skipped = {0};
+    wide_u8 kept = {0};
+    FOR_EACH_BLOCK(lane, group->first, group->last) {
+        wide_u8 mask = load_u8(wide->group + lane);
+        wide_u8 a = load_u8(vx + lane);
+        wide_u8 skip;
+        switch (op->kind) {
+            case OP_SKIP_EQ_IMM: skip = (wide_u8) (a == kk); break;
+            case OP_SKIP_NEQ_IMM: skip = (wide_u8) (a != kk); break;
+            case OP_SKIP_EQ_REG: skip = (wide_u8) (a == load_u8(vy + lane)); break;
+            case OP_SKIP_NEQ_REG: skip = (wide_u8) (a != load_u8(vy + lane)); break;
+            default: {
+                // there are variable shifts of 32 bit lanes only
+                wide_u32 keys = __builtin_convertvector(load_u16(wide->keypad + lane), wide_u32) >>
+                                __builtin_convertvector(__builtin_convertvector(a & 0xf, wide_u16), wide_u32);
+                skip = narrow_mask_32(-(keys & 1));
+                if (op->kind == OP_SKIP_NOT_KEY) skip = ~skip;
+                break;
+            }
+        }
+        skip &= mask;
+        skipped |= skip;
+        kept |= mask & ~skip;
+        store_masked_u16(wide->pc + lane, next + (widen_mask(skip) & skip_distance), widen_mask(mask));
+    }
+    if (!any_lane(skipped)) return WIDE_STEP_NEXT;
+    if (any_lane(kept)) return WIDE_STEP_DIVERGED;
+    *target = group->address + 4;
+    return WIDE_STEP_JUMP;
+}
+
+// returns true if the lane now differs from image in code that was executed and has to be detached
+static bool write_lane_memory(struct WideMachines* wide, size_t lane, uint16_t address, uint8_t value) {
+    uint8_t* mem = lane_memory(wide, lane);
+    if (!wide->wrote[lane]) {
+        // until its first store a lane reads image instead of its own memory
+        memcpy(mem, wide->image, MEMORY_SIZE);
+        wide->wrote[lane] = 1;
+        wide->any_wrote = true;
+    }
+    address &= MEMORY_SIZE - 1;
+    wide->side_effects[lane]++;
+    mem[address] = value;
+    if (wide->status[lane] & WIDE_DETACHED) return false;
+    if (!wide->executed[address] || value == wide->image[address]) return false;
+    wide->status[lane] |= WIDE_DETACHED;
+    return true;
+}
+
+// see note_delay_timer_read
+static void note_lane_delay_timer_read(struct WideMachines* wide, size_t lane, uint16_t address) {
+    struct WideIdleDetector* idle = &wide->idle[lane];
+    bool unchanged = idle->frame == wide->frames && idle->pc == address && idle->I == wide->I[lane] &&
+                     idle->side_effects == wide->side_effects[lane] && idle->delay_timer == wide->delay_timer[lane] &&
+                     idle->sound_timer == wide->sound_timer[lane] && idle->stack_depth == wide->stack_depth[lane];
+    for (int i = 0; i < 16 && unchanged; ++i) {
+        unchanged = idle->d_reg[i] == wide->v[i][lane];
+    }
+    if (unchanged) {
+        if (wide->delay_timer[lane] > 0) wide->status[lane] |= WIDE_WAITING_FOR_TIMER;
+        return;
+    }
+    idle->frame = wide->frames;
+    idle->pc = address;
+    idle->I = wide->I[lane];
+    idle->side_effects = wide->side_effects[lane];
+    idle->delay_timer = wide->delay_timer[lane];
+    idle->sound_timer = wide->sound_timer[lane];
+    idle->stack_depth = wide->stack_depth[lane];
+    for (int i = 0; i < 16; ++i) {
+        idle->d_reg[i] = wide->v[i][lane];
+    }
+}
+
+// read_sprite_data and wrap_sprite_data on the framebuffer of every lane in the group
+static void draw_group(struct WideMachines* wide, const struct WideGroup* group, const struct DecodedOp* op) {
+    // kept in locals, the stores into the rows could alias anything 64 bits wide
+    const uint8_t* vx = wide->v[op->x];
+    const uint8_t* vy = wide->v[op->y];
+    uint8_t* vf = wide->v[0xf];
+    const uint16_t* index = wide->I;
+    uint64_t* screen = wide->screen;
+    size_t stride = wide->padded_lanes;
+    bool wrap = wide->quirks & QUIRK_WRAP_SPRITES;
+    FOR_EACH_GROUP_LANE(wide, lane, group) {
+        const uint8_t* mem = lane_view(wide, lane);
+        uint8_t x_start = vx[lane] % SCREEN_WIDTH;
+        uint8_t y_start = vy[lane] % SCREEN_HEIGHT;
+        uint16_t address = index[lane];
+        uint8_t height = !wrap && op->n > SCREEN_HEIGHT - y_start ? SCREEN_HEIGHT - y_start : op->n;
+        uint64_t collision = 0;
+        for (int row = 0; row < height; ++row) {
+            uint64_t* word = &screen[(size_t) ((y_start + row) % SCREEN_HEIGHT) * stride + lane];
+            uint64_t placed = (uint64_t) mem[(address + row) & (MEMORY_SIZE - 1)] << (SCREEN_WIDTH - 8);
+            uint64_t sprite = placed >> x_start;
+            if (wrap && x_start) sprite |= placed << (SCREEN_WIDTH - x_start);
+            collision |= *word & sprite;
+            *word ^= sprite;
+        }
+        vf[lane] = collision != 0;
+        wide->side_effects[lane]++;
+    }
+}
+
+static void advance_lane_index(struct WideMachines* wide, size_t lane, uint8_t x) {
+    if (wide->quirks & QUIRK_INDEX_INCREMENT) {
+        wide->I[lane] += x + 1;
+    } else if (wide->quirks & QUIRK_INDEX_ADD_X) {
+        wide->I[lane] += x;
+    }
+}
+
+// everything that is not worth vectorizing runs lane by lane
+static enum WideStep execute_op(struct WideMachines* wide, const struct WideGroup* group, const struct DecodedOp* op,
+                                uint16_t* target) {
+    uint16_t address = group->address;
+    uint16_t next = address + 2;
+    switch (op->kind) {
+        case OP_JUMP: {
+            *target = op->nnn;
+            return WIDE_STEP_JUMP;
+        }
+        case OP_CALL: {
+            bool overflow = false;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                uint8_t depth = wide->stack_depth[lane];
+                if (depth == WIDE_STACK_DEPTH) {
+                    // the reference interpreter halts as well
+                    halt_lane(wide, lane, address);
+                    overflow = true;
+                    continue;
+                }
+                wide->stack[lane * WIDE_STACK_DEPTH + depth] = next;
+                wide->stack_depth[lane] = depth + 1;
+                wide->pc[lane] = op->nnn;
+            }
+            *target = op->nnn;
+            return overflow ? WIDE_STEP_DIVERGED : WIDE_STEP_JUMP;
+        }
+        case OP_RETURN: {
+            bool diverged = false;
+            *target = UINT16_MAX;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                uint8_t depth = wide->stack_depth[lane];
+                if (depth == 0) {
+                    halt_lane(wide, lane, address);
+                    diverged = true;
+                    continue;
+                }
+                uint16_t return_address = wide->stack[lane * WIDE_STACK_DEPTH + depth - 1];
+                wide->stack_depth[lane] = depth - 1;
+                wide->pc[lane] = return_address;
+                if (*target == UINT16_MAX) *target = return_address;
+                diverged = diverged || return_address != *target;
+            }
+            return diverged ? WIDE_STEP_DIVERGED : WIDE_STEP_JUMP;
+        }
+        case OP_JUMP_OFFSET: {
+            const uint8_t* offset = wide->v[wide->quirks & QUIRK_JUMP_VX ? op->x : 0];
+            bool diverged = false;
+            *target = op->nnn + offset[group->first_lane];
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                uint16_t jump_address = op->nnn + offset[lane];
+                if (jump_address >= PROGRAM_END) {
+                    // BNNN reaches up to 0x10FE, past the program area the reference interpreter halts and past
+                    // MEMORY_SIZE there is nothing left to decode
+                    halt_lane(wide, lane, jump_address);
+                    diverged = true;
+                    continue;
+                }
+                wide->pc[lane] = jump_address;
+                diverged = diverged || jump_address != *target;
+            }
+            return diverged ? WIDE_STEP_DIVERGED : WIDE_STEP_JUMP;
+        }
+        case OP_SKIP_EQ_IMM:
+        case OP_SKIP_NEQ_IMM:
+        case OP_SKIP_EQ_REG:
+        case OP_SKIP_NEQ_REG:
+        case OP_SKIP_KEY:
+        case OP_SKIP_NOT_KEY: {
+            return execute_skip(wide, group, op, target);
+        }
+        case OP_CLEAR: {
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                for (int row = 0; row < SCREEN_HEIGHT; ++row) {
+                    SCREEN_ROW(wide, lane, row) = 0;
+                }
+                wide->side_effects[lane]++;
+            }
+            return WIDE_STEP_NEXT;
+        }
+        case OP_DRAW: {
+            draw_group(wide, group, op);
+            return WIDE_STEP_NEXT;
+        }
+        case OP_GET_DELAY_TIMER: {
+            bool blocked = false;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                wide->v[op->x][lane] = wide->delay_timer[lane];
+                note_lane_delay_timer_read(wide, lane, address);
+                wide->pc[lane] = next;
+                blocked = blocked || (wide->status[lane] & WIDE_WAITING_FOR_TIMER);
+            }
+            return blocked ? WIDE_STEP_DIVERGED : WIDE_STEP_NEXT;
+        }
+        case OP_GET_KEY: {
+            // see take_key_press, a lane without a key press stays on the instruction
+            bool blocked = false;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                uint16_t presses = wide->key_presses[lane];
+                if (!presses) {
+                    wide->status[lane] |= WIDE_WAITING_FOR_KEY;
+                    wide->pc[lane] = address;
+                    blocked = true;
+                    continue;
+                }
+                wide->v[op->x][lane] = (uint8_t) __builtin_ctz(presses);
+                wide->key_presses[lane] = presses & (presses - 1);
+                wide->pc[lane] = next;
+            }
+            return blocked ? WIDE_STEP_DIVERGED : WIDE_STEP_NEXT;
+        }
+        case OP_BIN_TO_DEC: {
+            bool detached = false;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                uint8_t value = wide->v[op->x][lane];
+                uint16_t index = wide->I[lane];
+                detached |= write_lane_memory(wide, lane, index, value / 100);
+                detached |= write_lane_memory(wide, lane, index + 1, value / 10 % 10);
+                detached |= write_lane_memory(wide, lane, index + 2, value % 10);
+                wide->pc[lane] = next;
+            }
+            return detached ? WIDE_STEP_DIVERGED : WIDE_STEP_NEXT;
+        }
+        case OP_STORE_REGS: {
+            bool detached = false;
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                for (int i = 0; i <= op->x; ++i) {
+                    detached |= write_lane_memory(wide, lane, wide->I[lane] + i, wide->v[i][lane]);
+                }
+                advance_lane_index(wide, lane, op->x);
+                wide->pc[lane] = next;
+            }
+            return detached ? WIDE_STEP_DIVERGED : WIDE_STEP_NEXT;
+        }
+        case OP_LOAD_REGS: {
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                const uint8_t* mem = lane_view(wide, lane);
+                for (int i = 0; i <= op->x; ++i) {
+                    wide->v[i][lane] = mem[(wide->I[lane] + i) & (MEMORY_SIZE - 1)];
+                }
+                advance_lane_index(wide, lane, op->x);
+            }
+            return WIDE_STEP_NEXT;
+        }
+        case OP_UNKNOWN: {
+            return WIDE_STEP_NEXT;
+        }
+        default: {
+            execute_vector_op(wide, op, group->first, group->last);
+            return WIDE_STEP_NEXT;
+        }
+    }
+}
+
+// The first fetch of an instruction from image. Lanes that already stored something else into its bytes can no
+// longer share image and are detached, those in the group leave it. Returns false if the group is empty now.
+static bool mark_executed(struct WideMachines* wide, struct WideGroup* group, uint32_t* count) {
+    uint16_t address = group->address;
+    wide->executed[address] = 1;
+    wide->executed[address + 1] = 1;
+    if (!wide->any_wrote) return true;
+
+    bool leaving = false;
+    for (size_t lane = 0; lane < wide->lanes; ++lane) {
+        if (!wide->wrote[lane] || (wide->status[lane] & WIDE_DETACHED)) continue;
+        const uint8_t* mem = lane_memory(wide, lane);
+        if (mem[address] == wide->image[address] && mem[address + 1] == wide->image[address + 1]) continue;
+        wide->status[lane] |= WIDE_DETACHED;
+        leaving = leaving || wide->group[lane];
+    }
+    if (!leaving) return true;
+
+    // what the group executed so far is settled before it shrinks
+    finish_group(wide, group, true, address, *count);
+    group->steps -= *count;
+    *count = 0;
+    bool empty = true;
+    FOR_EACH_GROUP_LANE(wide, lane, group) {
+        if (wide->status[lane] & WIDE_DETACHED) {
+            wide->group[lane] = 0;
+        } else if (empty) {
+            group->first_lane = lane;
+            empty = false;
+        }
+    }
+    return !empty;
+}
+
+// runs the group until its lanes diverge, one of them blocks or the smallest budget is used up
+static void run_group(struct WideMachines* wide, struct WideGroup* group) {
+    const uint8_t* code = lane_memory(wide, group->first_lane);
+    struct DecodedOp detached_op;
+    uint32_t count = 0;
+    while (count < group->steps) {
+        const struct DecodedOp* op = &detached_op;
+        // decode_op turns an address past the program into OP_HALT without reading code
+        if (group->shared && group->address < PROGRAM_END) {
+            // image never changes, so its decodings are kept
+            op = &wide->decoded[group->address];
+            if (op->kind == OP_UNDECODED) {
+                decode_op(&wide->decoded[group->address], wide->image, group->address);
+                if (op->kind != OP_HALT && !mark_executed(wide, group, &count)) return;
+            }
+        } else {
+            decode_op(&detached_op, code, group->address);
+        }
+        if (op->kind == OP_HALT) {
+            finish_group(wide, group, true, group->address, count);
+            FOR_EACH_GROUP_LANE(wide, lane, group) {
+                wide->status[lane] |= WIDE_HALTED;
+            }
+            return;
+        }
+
+        uint16_t target = group->address + 2;
+        enum WideStep step = execute_op(wide, group, op, &target);
+        ++count;
+        if (step == WIDE_STEP_DIVERGED) {
+            finish_group(wide, group, false, 0, count);
+            return;
+        }
+        group->address = target;
+        // a group that does not hold every runnable lane gives the others a chance to join at every branch
+        if (step == WIDE_STEP_JUMP && !group->full) break;
+    }
+    finish_group(wide, group, true, group->address, count);
+}
+
+// a detached lane runs as a group of its own, fetching from its own memory
+static void run_detached_lane(struct WideMachines* wide, size_t lane) {
+    size_t block = lane / WIDE_BLOCK * WIDE_BLOCK;
+    memset(wide->group + block, 0, WIDE_BLOCK);
+    wide->group[lane] = -1;
+    while (!(wide->status[lane] & WIDE_BLOCKED) && wide->budget[lane] > 0) {
+        struct WideGroup group = {block, block + WIDE_BLOCK, lane, wide->pc[lane], wide->budget[lane], true, false};
+        run_group(wide, &group);
+    }
+    wide->group[lane] = 0;
+}
+
+static WIDE_TARGETS void start_frame(struct WideMachines* wide) {
+    const wide_u8 unblocked = splat_u8((uint8_t) ~(WIDE_WAITING_FOR_KEY | WIDE_WAITING_FOR_TIMER));
+    const wide_u32 budget = splat_u32(wide->instructions_per_frame);
+    FOR_EACH_BLOCK(lane, 0, wide->padded_lanes) {
+        STORE(wide->status + lane, load_u8(wide->status + lane) & unblocked);
+        STORE(wide->budget + lane, budget);
+    }
+}
+
+// counts what the lanes executed and ticks their timers once, returns the instructions of all lanes
+static WIDE_TARGETS uint64_t end_frame(struct WideMachines* wide) {
+    const wide_u32 budget = splat_u32(wide->instructions_per_frame);
+    const wide_u8 one = splat_u8(1);
+    wide_u64 total = {0};
+    FOR_EACH_BLOCK(lane, 0, wide->padded_lanes) {
+        wide_u64 executed = __builtin_convertvector(budget - load_u32(wide->budget + lane), wide_u64);
+        STORE(wide->cycles + lane, load_u64(wide->cycles + lane) + executed);
+        total += executed;
+        wide_u8 delay = load_u8(wide->delay_timer + lane);
+        wide_u8 sound = load_u8(wide->sound_timer + lane);
+        STORE(wide->delay_timer + lane, delay - ((wide_u8) (delay != 0) & one));
+        STORE(wide->sound_timer + lane, sound - ((wide_u8) (sound != 0) & one));
+    }
+    uint64_t sum = 0;
+    for (int i = 0; i < WIDE_BLOCK; ++i) {
+        sum += total[i];
+    }
+    return sum;
+}
+
+uint64_t run_wide_frame(struct WideMachines* wide) {
+    // every idle detector is disarmed at once
+    wide->frames++;
+    start_frame(wide);
+    struct WideGroup group;
+    while (form_group(wide, &group)) {
+        run_group(wide, &group);
+    }
+    for (size_t lane = 0; lane < wide->lanes; ++lane) {
+        if (wide->status[lane] & WIDE_DETACHED) run_detached_lane(wide, lane);
+    }
+    return end_frame(wide);
+}
+
+// the same as hash_screen of the lane's machine
+uint64_t hash_wide_screen(const struct WideMachines* wide, size_t lane) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < SCREEN_HEIGHT; ++i) {
+        hash ^= SCREEN_ROW(wide, lane, i);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void export_wide_lane(const struct WideMachines* wide, size_t lane, struct MachineState* state) {
+    if (state->mode != MODE_CHIP_8) set_machine_mode(state, MODE_CHIP_8);
+    set_quirks_profile(state, wide->quirks_profile);
+    reset_machine(state);
+    memcpy(state->mem.mem, lane_view(wide, lane), STACK_OFFSET);
+    for (int i = 0; i < 16; ++i) {
+        state->rf.d_reg[i] = wide->v[i][lane];
+    }
+    state->rf.I = wide->I[lane];
+    state->rf.pc = ADDRESS_TO_PC(state, wide->pc[lane]);
+    state->rf.delay_timer = wide->delay_timer[lane];
+    state->rf.sound_timer = wide->sound_timer[lane];
+    for (uint8_t i = 0; i < wide->stack_depth[lane]; ++i) {
+        *(state->mem.stack_pointer++) = ADDRESS_TO_PC(state, wide->stack[lane * WIDE_STACK_DEPTH + i]);
+    }
+    for (int row = 0; row < SCREEN_HEIGHT; ++row) {
+        state->screen.rows[0][row] = SCREEN_ROW(wide, lane, row);
+    }
+    state->screen.dirty_rows = ALL_ROWS_DIRTY;
+    state->keypad = wide->keypad[lane];
+    state->key_presses = wide->key_presses[lane];
+    state->random_state = wide->random_state[lane];
+    state->cycles = wide->cycles[lane];
+    state->instructions_per_frame = wide->instructions_per_frame;
+    invalidate_decode_cache(state->decode_cache, 0, MEMORY_SIZE);
+    reset_jit_cache(state->jit);
+}
+
+void delete_wide_machines(struct WideMachines** wide) {
+    if (!(*wide)) return;
+
+    for (int i = 0; i < 16; ++i) {
+        free((*wide)->v[i]);
+    }
+    free((*wide)->I);
+    free((*wide)->pc);
+    free((*wide)->delay_timer);
+    free((*wide)->sound_timer);
+    free((*wide)->stack_depth);
+    free((*wide)->stack);
+    free((*wide)->keypad);
+    free((*wide)->key_presses);
+    free((*wide)->random_state);
+    free((*wide)->side_effects);
+    free((*wide)->budget);
+    free((*wide)->cycles);
+    free((*wide)->status);
+    free((*wide)->wrote);
+    free((*wide)->group);
+    free((*wide)->idle);
+    free((*wide)->mem);
+    free((*wide)->screen);
+    free((*wide)->decoded);
+    free(*wide);
+    *wide = NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef CHIP_8_WIDE_H
+#define CHIP_8_WIDE_H
+
+#include "CHIP-8.h"
+
+#define WIDE_BLOCK 32 // lanes stepped by one vector operation, the lane count is rounded up to a multiple of it
+// stack_push_pc refuses to go deeper than this
+#define WIDE_STACK_DEPTH (STACK_SIZE - sizeof(uint16_t*) + 1)
+
+// lane status bits
+#define WIDE_HALTED 0x1U // pc left the program area, or the stack over- or underflowed
+#define WIDE_WAITING_FOR_KEY 0x2U // FX0A found no key press, cleared at the start of every frame
+#define WIDE_WAITING_FOR_TIMER 0x4U // spins on the delay timer, cleared at the start of every frame
+#define WIDE_DETACHED 0x8U // executes code it modified itself, so it is stepped on its own
+#define WIDE_BLOCKED (WIDE_HALTED | WIDE_WAITING_FOR_KEY | WIDE_WAITING_FOR_TIMER)
+
+struct WideIdleDetector;
+struct DecodedOp;
+
+// Many CHIP-8 machines running the same program, e.g. to fuzz it with different inputs and seeds. The
+// registers, pc and timers are kept in structure of arrays form, one array entry per lane, and all lanes at the
+// same pc execute an instruction together: the 8XYN family, immediates, I and the timers with vector
+// operations over WIDE_BLOCK lanes at a time, draws, stores and the stack lane by lane. Lanes that branch
+// differently split up and join again once their pcs meet. The program is fetched from one shared image, a
+// lane that stores into code it runs is detached and stepped on its own from its own memory. Only the CHIP-8
+// instruction set is supported, with any quirks profile.
+struct WideMachines {
+    size_t lanes; // as requested, the padding behind them is halted
+    size_t padded_lanes;
+    uint32_t instructions_per_frame;
+    enum QuirksProfile quirks_profile;
+    uint32_t quirks; // QUIRK_* bits of quirks_profile
+
+    // one entry per lane
+    uint8_t* v[16];
+    uint16_t* I;
+    uint16_t* pc;
+    uint8_t* delay_timer;
+    uint8_t* sound_timer;
+    uint8_t* stack_depth;
+    uint16_t* stack; // WIDE_STACK_DEPTH return addresses per lane
+    uint16_t* keypad;
+    uint16_t* key_presses;
+    uint32_t* random_state;
+    uint32_t* side_effects;
+    uint32_t* budget; // instructions left in the current frame
+    uint64_t* cycles;
+    uint8_t* status; // WIDE_* bits
+    uint8_t* wrote; // the lane stored something, before that its memory is image and left uninitialized
+    int8_t* group; // -1 for the lanes executing the current instruction, 0 otherwise
+    struct WideIdleDetector* idle;
+    uint8_t* mem; // MEMORY_SIZE bytes per lane, only used once the lane wrote
+    uint64_t* screen; // SCREEN_HEIGHT row words per lane, row by row for all lanes
+
+    uint8_t image[MEMORY_SIZE]; // the program as loaded, attached lanes fetch from here
+    uint8_t executed[MEMORY_SIZE]; // set for every byte of image fetched as an instruction
+    struct DecodedOp* decoded; // of image, by byte address
+    bool any_wrote;
+    uint64_t frames;
+};
+
+// every lane starts out like a freshly created machine with the program loaded
+extern struct WideMachines* create_wide_machines(size_t lanes, const uint8_t* binary, size_t binary_size);
+extern void set_wide_quirks_profile(struct WideMachines* wide, enum QuirksProfile profile);
+extern void seed_wide_lane(struct WideMachines* wide, size_t lane, uint32_t seed);
+// like set_keypad for a single lane
+extern void set_wide_keypad(struct WideMachines* wide, size_t lane, uint16_t keypad);
+// One emulated frame on every lane: each one runs up to instructions_per_frame instructions and its timers tick
+// once, just like a machine driven by replay_input_log. Returns the instructions executed by all lanes together.
+extern uint64_t run_wide_frame(struct WideMachines* wide);
+extern bool wide_lane_halted(const struct WideMachines* wide, size_t lane);
+extern uint64_t hash_wide_screen(const struct WideMachines* wide, size_t lane);
+// turns a lane into an ordinary CHIP-8 machine, e.g. to continue an interesting run on its own
+extern void export_wide_lane(const struct WideMachines* wide, size_t lane, struct MachineState* state);
+extern void delete_wide_machines(struct WideMachines** wide);
+
+#endif //CHIP_8_WIDE_H